@@ -41,6 +41,71 @@ class CDecoder;
 class CEncoder;
 class CWaveletTransform;
 
+//////////////////////////////////////////////////////////////////////
+/// Shared read-only PGF image. It contains the parsed headers and level lengths of a PGF image in a positional stream.
+/// After Open(...) it isn't changed anymore, hence several threads can concurrently open their own CPGFImage objects
+/// of the same shared image and decode different ROIs and levels at once. Each CPGFImage object reads the positional 
+/// stream at its own stream position with its own decoder, but the headers are not read again.
+/// Usage:
+///		shared.Open(...)
+///		pgf.Open(shared) (in each thread)
+///		pgf.Read(...)
+///		pgf.GetBitmap(...)
+/// @author C. Stamm
+/// @brief Shared read-only PGF image
+class CPGFSharedImage {
+	friend class CPGFImage;
+
+public:
+	//////////////////////////////////////////////////////////////////////
+	/// Standard constructor
+	CPGFSharedImage();
+
+	//////////////////////////////////////////////////////////////////////
+	/// Destructor
+	~CPGFSharedImage()												{ Close(); }
+
+	//////////////////////////////////////////////////////////////////////
+	/// Open a PGF image at given stream position: read pre-header, header, post-header, and level lengths.
+	/// The positional stream must be valid as long as this shared image and the images opened from it are used.
+	/// It might throw an IOException.
+	/// @param stream A positional stream
+	/// @param startPos Stream position of the PGF pre-header
+	void Open(const CPGFPositionalStream* stream, UINT64 startPos = 0) THROW_;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Release the parsed headers. Images opened from this shared image must not be open anymore.
+	void Close();
+
+	//////////////////////////////////////////////////////////////////////
+	/// Returns true if the shared image has been opened.
+	bool IsOpen() const												{ return m_stream != NULL; }
+
+	//////////////////////////////////////////////////////////////////////
+	/// Return the PGF header.
+	/// @return A PGF header
+	const PGFHeader* GetHeader() const								{ return &m_header; }
+
+	//////////////////////////////////////////////////////////////////////
+	/// Return user data and size of user data. Images opened from this shared image don't copy the user data.
+	/// @param size [out] Size of user data in bytes.
+	/// @return A pointer to user data or NULL if there is no user data.
+	const UINT8* GetUserData(UINT32& size) const					{ size = m_postHeader.userDataLen; return m_postHeader.userData; }
+
+private:
+	CPGFSharedImage(const CPGFSharedImage&);
+	CPGFSharedImage& operator=(const CPGFSharedImage&);
+
+	const CPGFPositionalStream* m_stream;	///< positional stream containing the image
+	UINT64 m_startPos;				///< stream position of the PGF pre-header
+	UINT32 m_encodedHeaderLength;	///< length of all encoded headers in bytes
+	UINT32* m_levelLength;			///< length of each level in bytes
+	PGFPreHeader m_preHeader;		///< PGF pre-header
+	PGFHeader m_header;				///< PGF file header
+	PGFPostHeader m_postHeader;		///< PGF post-header
+	UINT64 m_userDataPos;			///< stream position of user data
+};
+
 //////////////////////////////////////////////////////////////////////
 /// PGF image class is the main class. You always need a PGF object
 /// for encoding or decoding image data.
@@ -82,6 +147,14 @@ public:
 	/// @param stream A PGF stream
 	void Open(CPGFStream* stream) THROW_;
 
+	//////////////////////////////////////////////////////////////////////
+	/// Open a shared PGF image without reading its headers again. The image is read at its own stream position,
+	/// hence several images of the same shared image can be read concurrently, each by one thread.
+	/// User data are not copied, but they are available in the shared image.
+	/// It might throw an IOException.
+	/// @param image An opened shared image
+	void Open(const CPGFSharedImage& image) THROW_;
+
 	//////////////////////////////////////////////////////////////////////
 	/// Returns true if the PGF has been opened and not closed.
 	bool IsOpen() const	{ return m_decoder != NULL; }
@@ -111,8 +184,41 @@ public:
 	/// @param cb A pointer to a callback procedure. The procedure is called after reading a single level. If cb returns true, then it stops proceeding.
 	/// @param data Data Pointer to C++ class container to host callback procedure.
 	void Read(PGFRect& rect, int level = 0, CallbackPtr cb = NULL, void *data = NULL) THROW_;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Read and decode a PGF image at given level and pass it row by row to a scanline sink.
+	/// The rows are passed from top to bottom. They are already converted in the same way as in GetBitmap(...).
+	/// Images using the ROI encoding scheme are inverse transformed row by row: only a few rows of each level 
+	/// and the currently needed tile rows are held in memory, hence the image is never completely buffered.
+	/// Other images are completely decoded with Read(...), but the bitmap is not buffered.
+	/// Afterwards, the image can be read again with Read(...).
+	/// Precondition: The PGF image has been opened with a call of Open(...).
+	/// It might throw an IOException.
+	/// @param level [0, nLevels) The image level of the resulting rows.
+	/// @param bpp The number of bits per pixel used in the rows.
+	/// @param channelMap A integer array containing the mapping of PGF channel ordering to expected channel ordering.
+	/// @param sink A pointer to a scanline procedure. It receives each row and its row index. The row is only valid during the call. If sink returns true, then it stops proceeding.
+	/// @param data Data Pointer to C++ class container to host the scanline procedure.
+	void ReadScanlines(int level, BYTE bpp, int channelMap[], ScanlineCB sink, void *data = NULL) THROW_;
 #endif
 
+	//////////////////////////////////////////////////////////////////////
+	/// Read and decode all levels of a PGF image in one pass and cut each level into square tiles, e.g., for a web tile server.
+	/// The levels are passed from the smallest level to level 0. Each level is inverse transformed from the previous level,
+	/// hence the image is decoded only once and the levels are not resampled. The tiles of a level are passed row by row; 
+	/// the tiles in the last column and row might be smaller. They are converted in the same way as in GetBitmap(...).
+	/// In parallel mode the tile rows of a level are converted concurrently and the sink has to be thread-safe.
+	/// Afterwards, the image is closed as after Read(0).
+	/// Precondition: The PGF image has been opened with a call of Open(...), but not yet been read.
+	/// It might throw an IOException.
+	/// @param tileSize The width and height of a tile in pixels. It must be even and tileSize*bpp must be a multiple of 8.
+	/// @param bpp The number of bits per pixel used in the tiles.
+	/// @param channelMap A integer array containing the mapping of PGF channel ordering to expected channel ordering.
+	/// @param sink A pointer to a tile procedure. It receives each tile with its pitch, size, level, and tile indices. The tile is only valid during the call. If sink returns true, then it stops proceeding (in parallel mode after the current tile rows).
+	/// @param data Data Pointer to C++ class container to host the tile procedure.
+	/// @param parallel Convert and pass the tile rows of a level in parallel. Default value: false. Influences the export only if the codec has been compiled with OpenMP support.
+	void ExportTiles(UINT32 tileSize, BYTE bpp, int channelMap[], TileCB sink, void *data = NULL, bool parallel = false) THROW_;
+
 	//////////////////////////////////////////////////////////////////////
 	/// Read and decode smallest level of a PGF image at current stream position.
 	/// For details, please refert to Read(...)
@@ -213,6 +319,49 @@ public:
 	/// @param data Data Pointer to C++ class container to host callback procedure.
 	void Write(CPGFStream* stream, UINT32* nWrittenBytes = NULL, CallbackPtr cb = NULL, void *data = NULL) THROW_;
 
+	//////////////////////////////////////////////////////////////////
+	/// Encode and write an entire PGF image (header and image) at current stream position with the best quality 
+	/// whose encoded size doesn't exceed a byte budget. The forward transform is computed only once. The quality is 
+	/// searched by encoding the quantized wavelet coefficients into memory, and the best trial is copied into stream.
+	/// The quality set in SetHeader(...) is the best quality considered. The downsampling of the chrominance channels is 
+	/// decided in SetHeader(...) and not changed: color images with a quality <= DownsampleThreshold are only searched up to DownsampleThreshold.
+	/// If the budget cannot be reached, then the image is written with the worst searched quality.
+	/// Precondition: the PGF image contains a valid header (see also SetHeader(...)). 
+	/// It might throw an IOException.
+	/// @param stream A PGF stream
+	/// @param maxBytes Maximum number of written bytes
+	/// @param nWrittenBytes [in-out] The number of bytes written into stream are added to the input value.
+	/// @return The quality of the written image
+	BYTE WriteToSize(CPGFStream* stream, UINT32 maxBytes, UINT32* nWrittenBytes = NULL) THROW_;
+
+	//////////////////////////////////////////////////////////////////
+	/// Encode and write an entire PGF image (header and image) into several streams with different qualities, 
+	/// e.g., for storing several quality tiers of the same image. Each image is written at current stream position.
+	/// The forward transform is computed only once and without quantization; the wavelet coefficients are quantized 
+	/// for each stream during encoding. The downsampling of the chrominance channels is decided in SetHeader(...) and 
+	/// not changed: the qualities of color images are corrected to the same side of DownsampleThreshold as the quality of SetHeader(...).
+	/// Precondition: the PGF image contains a valid header (see also SetHeader(...)). 
+	/// It might throw an IOException.
+	/// @param n Number of streams
+	/// @param streams An array of n PGF streams
+	/// @param qualities [inout] An array of n qualities. Each quality is eventually corrected.
+	/// @param nWrittenBytes [out] An array receiving the number of bytes written into each stream, or NULL
+	void WriteQualities(int n, CPGFStream* streams[], BYTE qualities[], UINT32 nWrittenBytes[] = NULL) THROW_;
+
+	//////////////////////////////////////////////////////////////////
+	/// Encode and write an entire PGF image (header and image) at current stream position with the worst quality 
+	/// whose peak signal-to-noise ratio (PSNR) isn't below a target. The forward transform is computed only once. The quality is 
+	/// searched by inverse transforming the dequantized wavelet coefficients, hence the image is encoded only once.
+	/// The PSNR is measured on the internal channels (e.g. luminance and chrominance of color images) with respect to UsedBitsPerChannel().
+	/// The quality set in SetHeader(...) is the best quality considered, and the search range is restricted as in WriteToSize(...).
+	/// Precondition: the PGF image contains a valid header (see also SetHeader(...)). 
+	/// It might throw an IOException.
+	/// @param stream A PGF stream
+	/// @param minPSNR Minimum PSNR in dB
+	/// @param nWrittenBytes [in-out] The number of bytes written into stream are added to the input value.
+	/// @return The quality of the written image
+	BYTE WriteToPSNR(CPGFStream* stream, double minPSNR, UINT32* nWrittenBytes = NULL) THROW_;
+
 	//////////////////////////////////////////////////////////////////
 	/// Create wavelet transform channels and encoder. Write header at current stream position.
 	/// Call this method before your first call of Write(int level) or WriteImage(), but after SetHeader().
@@ -251,6 +400,48 @@ public:
 	/// @param data Data Pointer to C++ class container to host callback procedure.
 	/// @return The number of bytes written into stream.
 	UINT32 Write(int level, CallbackPtr cb = NULL, void *data = NULL) THROW_;
+
+	//////////////////////////////////////////////////////////////////
+	/// Set PGF header and user data, write header at current stream position, and prepare line based encoding.
+	/// Line based encoding is an alternative to SetHeader(...), ImportBitmap(...), and Write(...) for very large images:
+	/// the image is imported in parts of a few rows with ImportScanlines(...) and immediately transformed and encoded.
+	/// Only a few rows of each level are held in memory, hence the image is never completely buffered.
+	/// Encoded tiles are spooled into a memory stream or into the given spool stream until FinishLineEncoding(...)
+	/// copies them in the order of the PGF format into stream. The ROI encoding scheme is always used.
+	/// Precondition: The PGF image has been closed with Close(...) or never opened with Open(...).
+	/// It might throw an IOException.
+	/// @param stream A PGF stream
+	/// @param header A valid and already filled in PGF header structure
+	/// @param flags A combination of additional version flags. PGFROI is always added, PGFTileIndex is not supported.
+	/// @param userData A user-defined memory block containing any kind of cached metadata.
+	/// @param userDataLength The size of user-defined memory block in bytes
+	/// @param spool A readable and writable stream (e.g. a temporary file) for encoded tiles, or NULL if a memory stream should be used
+	/// @return The number of bytes written into stream.
+	UINT32 StartLineEncoding(CPGFStream* stream, const PGFHeader& header, BYTE flags = 0, UINT8* userData = 0, UINT32 userDataLength = 0, CPGFStream* spool = NULL) THROW_;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Import the next rows of an image from a specified image buffer and transform and encode them as far as possible.
+	/// Rows have to be imported from top to bottom. Call this method after StartLineEncoding(...) and before FinishLineEncoding(...).
+	/// The absolute value of pitch is the number of bytes of an image row.
+	/// If pitch is negative, then the rows are stored in bottom-up order and buff points to the topmost of the imported rows.
+	/// If pitch is positive, then buff points to the first byte of the topmost of the imported rows.
+	/// The channelMap is used in the same way as in ImportBitmap(...).
+	/// It might throw an IOException.
+	/// @param pitch The number of bytes of a row of the image buffer.
+	/// @param buff An image buffer containing nRows rows.
+	/// @param bpp The number of bits per pixel used in image buffer.
+	/// @param nRows The number of imported rows.
+	/// @param channelMap A integer array containing the mapping of input channel ordering to expected channel ordering.
+	void ImportScanlines(int pitch, UINT8 *buff, BYTE bpp, UINT32 nRows, int channelMap[] = NULL) THROW_;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Write the encoded image at current stream position after all rows have been imported with ImportScanlines(...).
+	/// It might throw an IOException.
+	/// @param stream The PGF stream used in StartLineEncoding(...)
+	/// @param cb A pointer to a callback procedure. The procedure is called after writing a single level. If cb returns true, then it stops proceeding.
+	/// @param data Data Pointer to C++ class container to host callback procedure.
+	/// @return The number of bytes written into stream.
+	UINT32 FinishLineEncoding(CPGFStream* stream, CallbackPtr cb = NULL, void *data = NULL) THROW_;
 #endif
 
 	/////////////////////////////////////////////////////////////////////
@@ -265,6 +456,41 @@ public:
 	/// @param skipUserData The file might contain user data (metadata). User data ist usually read during Open and stored in memory. Set this flag to false when storing in memory is not needed.
 	void ConfigureDecoder(bool useOMP = true, bool skipUserData = false) { m_useOMPinDecoder = useOMP; m_skipUserData = skipUserData; }
 
+	/////////////////////////////////////////////////////////////////////
+	/// Configures fast decoding of a lower-fidelity image, e.g., for quick previews.
+	/// Each macro block is decoded up to the given number of bit planes. Its remaining bit planes are skipped.
+	/// Call this method before Read(...). Macro blocks which have already been decoded ahead are not affected.
+	/// @param maxPlanes Maximum number of decoded bit planes per macro block. Default value: 0 (all bit planes)
+	/// @param skipFinestDetails If true, Read(...) of level 0 doesn't decode the finest detail subbands (HL, LH, HH of the finest level) but treats them as zero. 
+	/// Images with only one level and line based reading with ReadScanlines(...) are not affected.
+	void ConfigureFastDecoding(int maxPlanes = 0, bool skipFinestDetails = false);
+
+#ifdef __PGFROISUPPORT__
+	/////////////////////////////////////////////////////////////////////
+	/// Configures the decoding of images using the ROI encoding scheme.
+	/// In parallel tile decoding the block headers of a level are scanned first to find the extents of the needed tiles, 
+	/// then the needed tiles of all channels are read and decoded concurrently, each tile by its own decoder. 
+	/// This is faster for large regions of interest and full reads, but the encoded tiles of a level are held in memory.
+	/// The tile cache keeps the decoded tiles of previous reads, e.g., in a panning viewer. A following Read(rect, level) of an 
+	/// overlapping ROI only decodes the newly exposed tiles. If the tile cache is used, the image isn't closed automatically after 
+	/// reading level 0, hence further regions can be read until Close() is called.
+	/// @param parallelTiles Decode the tiles of a level in parallel. Default value: false. Influences the decoding only if the codec has been compiled with OpenMP support.
+	/// @param cacheSize Memory budget of the tile cache in bytes, shared by all channels. Default value: 0 (no tile cache)
+	void ConfigureTileDecoding(bool parallelTiles = false, UINT64 cacheSize = 0);
+#endif
+
+	/////////////////////////////////////////////////////////////////////
+	/// Limits the number of threads used by this image during encoding and decoding.
+	/// The process-wide OpenMP settings are not changed, hence several images can be encoded and decoded concurrently without oversubscription.
+	/// The limit is taken over when the encoder or decoder is created, e.g., in Open(...) or WriteHeader(...).
+	/// @param maxThreads Maximum number of threads. Default value: 0 (number of processors). Influences the codec only if it has been compiled with OpenMP support.
+	void SetMaxThreads(int maxThreads)		{ m_maxThreads = __max(0, maxThreads); }
+
+	/////////////////////////////////////////////////////////////////////
+	/// Return the maximum number of threads used by this image.
+	/// @return Maximum number of threads or 0 (number of processors)
+	int GetMaxThreads() const				{ return m_maxThreads; }
+
 	////////////////////////////////////////////////////////////////////
 	/// Reset stream position to start of PGF pre-header
 	void ResetStreamPos() THROW_;
@@ -281,6 +507,7 @@ public:
 	/// It might throw an IOException.
 	/// @param header A valid and already filled in PGF header structure
 	/// @param flags A combination of additional version flags. In case you use level-wise encoding then set flag = PGFROI.
+	/// Set flag = PGFTileIndex (implies PGFROI) to write a tile index, which allows reading a region of interest with I/O proportional to its size.
 	/// @param userData A user-defined memory block containing any kind of cached metadata.
 	/// @param userDataLength The size of user-defined memory block in bytes
 	void SetHeader(const PGFHeader& header, BYTE flags = 0, UINT8* userData = 0, UINT32 userDataLength = 0) THROW_; // throws IOException
@@ -389,6 +616,41 @@ public:
 	/// @return The number of bytes copied to the target buffer
 	UINT32 ReadEncodedData(int level, UINT8* target, UINT32 targetLen) const THROW_;
 
+	//////////////////////////////////////////////////////////////////////
+	/// Write a new PGF image at current stream position containing only the levels >= level of this PGF image,
+	/// i.e., this image downscaled by a factor of 2^level. The encoded levels are copied without decoding; 
+	/// only width, height, number of levels, and quality of the header and the level length table are rewritten.
+	/// The quality of downsampled color images (quality > DownsampleThreshold) must remain larger than 
+	/// DownsampleThreshold after the reduction by level, otherwise FormatCannotRead is thrown.
+	/// Precondition: The PGF image has been opened with a call of Open(...).
+	/// It might throw an IOException.
+	/// @param stream A PGF stream
+	/// @param level The finest level of the new image, in [0, Levels())
+	/// @param nWrittenBytes [out] The number of bytes written into stream, or NULL
+	void ExtractLevels(CPGFStream* stream, int level, UINT32* nWrittenBytes = NULL) const THROW_;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Recompress this PGF image with another quality and write it at current stream position, 
+	/// e.g., for creating a smaller copy of lower quality. The encoded macro blocks are decoded into wavelet coefficients, 
+	/// which are requantized and encoded again level by level. Neither the wavelet transforms nor the color transforms are computed.
+	/// The quality should be larger than the current quality, otherwise the new image is just larger.
+	/// If the current image has been losslessly encoded (quality 0), then the new image is identical to an encoding of the original image with the new quality.
+	/// Otherwise, the already quantized coefficients are rounded a second time. The result is close to, but in general not the same as, 
+	/// a direct encoding of the original image or an encoding of the decoded image with the new quality.
+	/// Chrominance downsampling cannot be applied to wavelet coefficients, hence the quality of color images is corrected 
+	/// to the same side of DownsampleThreshold as the current quality: a color image without downsampled chrominance channels 
+	/// (quality <= DownsampleThreshold) is never recompressed with a quality larger than DownsampleThreshold.
+	/// Afterwards, the PGF image is closed and contains the header of the new image.
+	/// Precondition: The PGF image has been opened with a call of Open(...) and the user data haven't been skipped.
+	/// It might throw an IOException.
+	/// @param stream A PGF stream
+	/// @param quality The quality of the new image
+	/// @param nWrittenBytes [out] The number of bytes written into stream, or NULL
+	/// @param cb A pointer to a callback procedure. The procedure is called after writing a single level. If cb returns true, then it stops proceeding.
+	/// @param data Data Pointer to C++ class container to host callback procedure.
+	/// @return The quality of the new image
+	BYTE Recompress(CPGFStream* stream, BYTE quality, UINT32* nWrittenBytes = NULL, CallbackPtr cb = NULL, void *data = NULL) THROW_;
+
 	//////////////////////////////////////////////////////////////////////
 	/// Return current image width of given channel in pixels.
 	/// The returned width depends on the levels read so far and on ROI.
@@ -512,6 +774,7 @@ protected:
 	DataT* m_channel[MaxChannels];					///< untransformed channels in YUV format
 	CDecoder* m_decoder;			///< PGF decoder
 	CEncoder* m_encoder;			///< PGF encoder
+	CPGFCursorStream* m_cursor;		///< stream of an image opened from a shared image
 	UINT32* m_levelLength;			///< length of each level in bytes; first level starts immediately after this array
 	UINT32 m_width[MaxChannels];	///< width of each channel at current level
 	UINT32 m_height[MaxChannels];	///< height of each channel at current level
@@ -520,15 +783,27 @@ protected:
 	PGFPostHeader m_postHeader;		///< PGF post-header
 	UINT64 m_userDataPos;			///< stream position of user data
 	int m_currentLevel;				///< transform level of current image
+	int m_decodedChannels;			///< number of channels of level m_currentLevel, which have already been decoded ahead
 	BYTE m_quant;					///< quantization parameter
 	bool m_downsample;				///< chrominance channels are downsampled
 	bool m_favorSpeedOverSize;		///< favor encoding speed over compression ratio
 	bool m_useOMPinEncoder;			///< use Open MP in encoder
 	bool m_useOMPinDecoder;			///< use Open MP in decoder
 	bool m_skipUserData;			///< skip user data (metadata) during open
+	int m_maxThreads;				///< maximum number of threads used in encoder and decoder (0: number of processors)
+	int m_maxDecodedPlanes;			///< maximum number of decoded bit planes per macro block (0: all bit planes)
+	bool m_skipFinestDetails;		///< the finest detail subbands are treated as zero instead of being decoded
 #ifdef __PGFROISUPPORT__
 	bool m_streamReinitialized;		///< stream has been reinitialized
 	PGFRect m_roi;					///< region of interest
+	CEncoder* m_spoolEncoder;		///< encoder of spooled tiles in line based encoding
+	CPGFStream* m_spool;			///< stream of spooled tiles in line based encoding
+	CPGFMemoryStream* m_memSpool;	///< internal spool stream in line based encoding
+	UINT32 m_lineRow;				///< next imported row in line based encoding
+	bool m_useTileIndex;			///< the tile index is used to seek the needed tiles
+	bool m_seekTile;				///< tiles have been skipped without reading the stream, hence the next decoded tile has to be sought
+	bool m_parallelTiles;			///< the tiles of a level are decoded in parallel
+	UINT64 m_tileCacheSize;			///< memory budget of the tile cache in bytes (0: no tile cache)
 #endif
 
 private:	
@@ -538,14 +813,38 @@ private:
 	ProgressMode m_progressMode;	///< progress mode used in Read and Write; PM_Relative is default mode
 
 	void ComputeLevels();
+	int NumberOfThreads(bool useOMP) const;
 	void CompleteHeader();
-	void RgbToYuv(int pitch, UINT8* rgbBuff, BYTE bpp, int channelMap[], CallbackPtr cb, void *data) THROW_;
+	void InitDecoding() THROW_;
+	void InitHeader(const PGFHeader& header, BYTE flags, UINT8* userData, UINT32 userDataLength) THROW_;
+	bool DownsampleSupported() const;
+	void AllocChannels() THROW_;
+	void RgbToYuv(int pitch, UINT8* rgbBuff, BYTE bpp, int channelMap[], UINT32 nRows, CallbackPtr cb, void *data) THROW_;
+	void YuvToRgb(DataT* const channel[], UINT32 w, UINT32 h, int pitch, UINT8* buff, BYTE bpp, int channelMap[], CallbackPtr cb, void *data) const THROW_;
+	OSError ExportTileRow(int level, UINT32 tileY, UINT32 tileSize, BYTE bpp, int channelMap[], TileCB sink, void *data) const;
 	void Downsample(int nChannel);
+	void TransformChannels() THROW_;
+	UINT32 CreateEncoder(CPGFStream* stream) THROW_;
 	UINT32 UpdatePostHeaderSize() THROW_;
+	BYTE PrepareRateControl(DataT* channels[]) THROW_;
+	void SetQuality(BYTE quality);
+	BYTE CorrectQuality(BYTE quality) const;
+	double ComputePSNR(BYTE quality, DataT* const channels[]) THROW_;
 	void WriteLevel() THROW_;
+	void DecodeChannel(int i, int level) THROW_;
+	void ReadLevels(int level, double percent, CallbackPtr cb, void *data) THROW_;
 
 #ifdef __PGFROISUPPORT__
 	void SetROI(PGFRect rect);
+	void DownsampleRows(DataT* loRow, const DataT* hiRow) const;
+	UINT32 TileIndexEntry(int level, int i) const;
+	void SeekTile(int level, UINT32 entry) THROW_;
+	bool UseParallelTiles(int level) const;
+	void DecodeTiles(int level) THROW_;
+	OSError DecodeTile(int level, int i, UINT32 tileX, UINT32 tileY, UINT8* encodedTile, UINT32 len);
+	void InitTileCache();
+	bool LoadCachedTile(int level, int i, UINT32 tileX, UINT32 tileY);
+	void StoreCachedTile(int level, int i, UINT32 tileX, UINT32 tileY);
 #endif
 
 	UINT8 Clamp4(DataT v) const {
@@ -67,6 +67,13 @@
 #define __PGF32SUPPORT__ // without 32 bit the memory consumption during encoding and decoding is much lesser
 #endif
 
+//-------------------------------------------------------------------------------
+// SIMD support (x86 only, instruction set is selected at runtime)
+//-------------------------------------------------------------------------------
+#if !defined(NPGFSIMD) && (defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__))
+#define __PGFSIMDSUPPORT__ // without SIMD support the wavelet transform uses scalar code only
+#endif
+
 //-------------------------------------------------------------------------------
 //	32 Bit platform constants
 //-------------------------------------------------------------------------------
@@ -265,6 +272,22 @@ inline OSError FileWrite(HANDLE hFile, int *count, void *buffPtr) {
 	}
 }
 
+inline OSError FileReadAt(HANDLE hFile, UINT64 pos, int *count, void *buffPtr) {
+	OVERLAPPED ov = { 0 };
+	ov.Offset = (DWORD)pos;
+	ov.OffsetHigh = (DWORD)(pos >> 32);
+	if (ReadFile(hFile, buffPtr, *count, (ULONG *)count, &ov)) {
+		return NoError;
+	} else {
+		OSError err = GetLastError();
+		if (err == ERROR_HANDLE_EOF) {
+			*count = 0;
+			return NoError;
+		}
+		return err;
+	}
+}
+
 inline OSError GetFPos(HANDLE hFile, UINT64 *pos) {
 #ifdef WINCE
 	LARGE_INTEGER li;
@@ -312,6 +335,33 @@ inline OSError SetFPos(HANDLE hFile, int posMode, INT64 posOff) {
 	}
 #endif
 }
+
+inline OSError FileMap(HANDLE hFile, bool /*sequential*/, void **view, UINT64 *size) {
+	// Windows doesn't support access hints for mapped views
+	DWORD high = 0;
+	DWORD low = GetFileSize(hFile, &high);
+	if (low == INVALID_FILE_SIZE) {
+		OSError err = GetLastError();
+		if (err != NoError) return err;
+	}
+	*size = ((UINT64)high << 32) | low;
+	if (*size != (SIZE_T)*size) return InsufficientMemory;
+
+	HANDLE hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!hMap) return GetLastError();
+	*view = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+	OSError err = (*view) ? NoError : GetLastError();
+	CloseHandle(hMap); // the view keeps the mapping alive
+	return err;
+}
+
+inline void FileUnmap(void *view, UINT64 /*size*/) {
+	UnmapViewOfFile(view);
+}
+
+inline void FileAdvise(HANDLE /*hFile*/, UINT64 /*pos*/, UINT64 /*len*/) {
+	// Windows supports sequential access hints only when opening a file (FILE_FLAG_SEQUENTIAL_SCAN)
+}
 #endif //WIN32
 
 
@@ -365,6 +415,10 @@ inline OSError SetFPos(HANDLE hFile, int posMode, INT64 posOff) {
 #ifdef __POSIX__
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <climits>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdint.h>		// for int64_t and uint64_t
 #include <string.h>		// memcpy()
 
@@ -527,6 +581,19 @@ __inline OSError FileWrite(HANDLE hFile, int *count, void *buffPtr) {
 	}
 }
 
+__inline OSError FileReadAt(HANDLE hFile, UINT64 pos, int *count, void *buffPtr) {
+	#ifdef __APPLE__
+		*count = (int)pread(hFile, buffPtr, (size_t)*count, (off_t)pos);
+	#else
+		*count = (int)pread64(hFile, buffPtr, (size_t)*count, (off64_t)pos);
+	#endif
+	if (*count != -1) {
+		return NoError;
+	} else {
+		return errno;
+	}
+}
+
 __inline OSError GetFPos(HANDLE hFile, UINT64 *pos) {
 	#ifdef __APPLE__
 		off_t ret;
@@ -563,6 +630,42 @@ __inline OSError SetFPos(HANDLE hFile, int posMode, INT64 posOff) {
 	#endif
 }
 
+__inline OSError FileMap(HANDLE hFile, bool sequential, void **view, UINT64 *size) {
+	#ifdef __APPLE__
+		struct stat st;
+		if (fstat(hFile, &st) == -1) return errno;
+	#else
+		struct stat64 st;
+		if (fstat64(hFile, &st) == -1) return errno;
+	#endif
+	*size = (UINT64)st.st_size;
+	if (*size != (size_t)*size) return InsufficientMemory;
+
+	void *addr = mmap(NULL, (size_t)*size, PROT_READ, MAP_SHARED, hFile, 0);
+	if (addr == MAP_FAILED) return errno;
+	// access hint only: errors are ignored
+	madvise(addr, (size_t)*size, (sequential) ? MADV_SEQUENTIAL : MADV_RANDOM);
+	*view = addr;
+	return NoError;
+}
+
+__inline void FileUnmap(void *view, UINT64 size) {
+	munmap(view, (size_t)size);
+}
+
+__inline void FileAdvise(HANDLE hFile, UINT64 pos, UINT64 len) {
+	// access hints only: errors are ignored
+	#ifdef __APPLE__
+		radvisory ra;
+		ra.ra_offset = (off_t)pos;
+		ra.ra_count = (int)__min(len, (UINT64)INT_MAX);
+		fcntl(hFile, F_RDADVISE, &ra);
+	#else
+		posix_fadvise64(hFile, (off64_t)pos, (off64_t)len, POSIX_FADV_SEQUENTIAL);
+		posix_fadvise64(hFile, (off64_t)pos, (off64_t)len, POSIX_FADV_WILLNEED);
+	#endif
+}
+
 #endif /* __POSIX__ */
 //-------------------------------------------------------------------------------
 
@@ -629,6 +732,10 @@ __inline UINT64 ByteSwap(UINT64 ui64) {
 #endif // ifndef LIBPGF_DISABLE_OPENMP
 #ifdef LIBPGF_USE_OPENMP
 #include <omp.h>
+// OpenMP 3.1 tasks and atomics are used to overlap reading, decoding, and inverse transform
+# if _OPENMP >= 201107
+#  define LIBPGF_USE_OPENMP_TASKS
+# endif
 #endif
 
 #endif //PGF_PGFPLATFORM_H
@@ -73,6 +73,21 @@ public:
 	/// Check stream validity.
 	/// @return True if stream and current position is valid
 	virtual bool IsValid() const=0;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Return the memory address of the next bytes of this stream without reading them.
+	/// Streams with data in memory implement this method to avoid copying, e.g., of encoded macro blocks.
+	/// The address remains valid as long as the stream isn't changed or destroyed.
+	/// @param count Number of bytes which must be accessible at the current stream position
+	/// @return Memory address of the current stream position or NULL if the stream data isn't accessible in memory or less than count bytes are available
+	virtual const UINT8* Peek(int /*count*/) const	{ return NULL; }
+
+	//////////////////////////////////////////////////////////////////////
+	/// Access hint: the given range of this stream will be read next, mainly in sequence.
+	/// Streams may use it to size their buffers and to prefetch data.
+	/// @param pos Stream position of the first byte
+	/// @param len Length of the range in bytes
+	virtual void WillRead(UINT64 /*pos*/, UINT64 /*len*/)	{}
 };
 
 /////////////////////////////////////////////////////////////////////
@@ -99,6 +114,41 @@ public:
 	virtual bool   IsValid() const	{ return m_hFile != 0; }
 };
 
+/////////////////////////////////////////////////////////////////////
+/// A PGF file stream subclass with a read buffer.
+/// Small reads, e.g., of headers and macro block headers, are served from the buffer, and seeking doesn't need any 
+/// system calls: skipping inside of the buffer just moves the stream position, and the file is read at the new
+/// position when the buffer has to be refilled. The buffer grows up to a maximum size with the lengths of the levels 
+/// announced by WillRead, and the file system is told to prefetch these levels.
+/// Writing is unbuffered. The file position of the handle is undefined until the stream is destroyed.
+/// @author C. Stamm
+/// @brief Buffered file stream class
+class CPGFBufferedFileStream : public CPGFFileStream {
+protected:
+	UINT8 *m_buffer;		///< read buffer
+	size_t m_bufferSize;	///< current size of the read buffer
+	size_t m_maxBufferSize;	///< maximum size of the read buffer
+	UINT64 m_bufferPos;		///< file position of the first byte in the read buffer
+	size_t m_bufferLen;		///< number of valid bytes in the read buffer
+	UINT64 m_pos;			///< current stream position
+
+public:
+	/// Constructor
+	/// @param hFile File handle
+	/// @param maxBufferSize Maximum size of the read buffer in bytes
+	CPGFBufferedFileStream(HANDLE hFile, size_t maxBufferSize = 4194304) THROW_;
+
+	virtual ~CPGFBufferedFileStream();
+	virtual void Write(int *count, void *buffer) THROW_; // throws IOException 
+	virtual void Read(int *count, void *buffer) THROW_; // throws IOException 
+	virtual void SetPos(short posMode, INT64 posOff) THROW_; // throws IOException
+	virtual UINT64 GetPos() const THROW_	{ ASSERT(IsValid()); return m_pos; }
+	virtual void WillRead(UINT64 pos, UINT64 len);
+
+private:
+	void Fill() THROW_;
+};
+
 /////////////////////////////////////////////////////////////////////
 /// A PGF stream subclass for internal memory.
 /// @author C. Stamm
@@ -136,6 +186,7 @@ public:
 	virtual void SetPos(short posMode, INT64 posOff) THROW_; // throws IOException
 	virtual UINT64 GetPos() const { ASSERT(IsValid()); return m_pos - m_buffer; }
 	virtual bool   IsValid() const	{ return m_buffer != 0; }
+	virtual const UINT8* Peek(int count) const	{ ASSERT(IsValid()); return (m_pos + count <= m_eos) ? m_pos : NULL; }
 
 	/// @return Memory size
 	size_t GetSize() const			{ return m_size; }
@@ -149,6 +200,150 @@ public:
 	void SetEOS(UINT64 length)		{ ASSERT(IsValid()); m_eos = m_buffer + length; }
 };
 
+/////////////////////////////////////////////////////////////////////
+/// A read-only PGF stream subclass for memory-mapped files.
+/// Reading doesn't need any system calls, and the decoder uses the encoded data in place instead of copying it.
+/// The mapped file can also be shared by several threads: wrap GetBuffer() and GetSize() into a CPGFPositionalMemoryStream.
+/// @author C. Stamm
+/// @brief Memory-mapped file stream class
+class CPGFMappedStream : public CPGFStream {
+protected:
+	void *m_view;			///< mapped view of the file
+	const UINT8 *m_buffer;	///< start address of the mapped file
+	const UINT8 *m_pos;		///< current address
+	UINT64 m_size;			///< file size
+
+public:
+	/// Constructor. Maps the whole file into memory. The file handle can be closed afterwards.
+	/// @param hFile File handle
+	/// @param sequential Access hint: true if the file is mainly read sequentially, false if it is mainly read at random positions (e.g. ROIs)
+	CPGFMappedStream(HANDLE hFile, bool sequential = true) THROW_;
+
+	virtual ~CPGFMappedStream();
+	virtual void Write(int *count, void *buffer) THROW_; // throws IOException 
+	virtual void Read(int *count, void *buffer);
+	virtual void SetPos(short posMode, INT64 posOff) THROW_; // throws IOException
+	virtual UINT64 GetPos() const	{ ASSERT(IsValid()); return m_pos - m_buffer; }
+	virtual bool   IsValid() const	{ return m_buffer != 0; }
+	virtual const UINT8* Peek(int count) const	{ ASSERT(IsValid()); return ((UINT64)(m_pos - m_buffer) + count <= m_size) ? m_pos : NULL; }
+
+	/// @return File size
+	UINT64 GetSize() const			{ return m_size; }
+	/// @return Start address of the mapped file
+	const UINT8* GetBuffer() const	{ return m_buffer; }
+};
+
+/////////////////////////////////////////////////////////////////////
+/// Abstract positional stream base class.
+/// A positional stream doesn't have a current position: each read passes its own stream position.
+/// Therefore, a positional stream can be read by several threads concurrently, e.g., with one CPGFCursorStream per thread.
+/// @author C. Stamm
+/// @brief Abstract positional stream base class
+class CPGFPositionalStream {
+public:
+	//////////////////////////////////////////////////////////////////////
+	/// Standard constructor.
+	CPGFPositionalStream() {}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Standard destructor.
+	virtual ~CPGFPositionalStream() {}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Read some bytes at a given stream position and store them into a buffer.
+	/// Implementations must be thread-safe.
+	/// @param pos Stream position of the first byte
+	/// @param count A pointer to a value containing the number of bytes should be read. After this call it contains the number of read bytes.
+	/// @param buffer A memory buffer
+	virtual void ReadAt(UINT64 pos, int *count, void *buffer) const=0;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Check stream validity.
+	/// @return True if stream is valid
+	virtual bool IsValid() const=0;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Return the memory address of some bytes at a given stream position without reading them.
+	/// @param pos Stream position of the first byte
+	/// @param count Number of bytes which must be accessible
+	/// @return Memory address or NULL if the stream data isn't accessible in memory or less than count bytes are available
+	virtual const UINT8* PeekAt(UINT64 /*pos*/, int /*count*/) const	{ return NULL; }
+};
+
+/////////////////////////////////////////////////////////////////////
+/// A positional stream subclass for external storage files. It uses pread on POSIX systems and overlapped reads on Windows.
+/// @author C. Stamm
+/// @brief Positional file stream class
+class CPGFPositionalFileStream : public CPGFPositionalStream {
+protected:
+	HANDLE m_hFile;	///< file handle
+
+public:
+	/// Constructor
+	/// @param hFile File handle
+	CPGFPositionalFileStream(HANDLE hFile) : m_hFile(hFile) {}
+	/// @return File handle
+	HANDLE GetHandle() { return m_hFile; }
+
+	virtual ~CPGFPositionalFileStream() { m_hFile = 0; }
+	virtual void ReadAt(UINT64 pos, int *count, void *buffer) const THROW_; // throws IOException
+	virtual bool IsValid() const	{ return m_hFile != 0; }
+};
+
+/////////////////////////////////////////////////////////////////////
+/// A positional stream subclass for read-only memory, e.g., a PGF image held in memory by the application.
+/// @author C. Stamm
+/// @brief Positional memory stream class
+class CPGFPositionalMemoryStream : public CPGFPositionalStream {
+protected:
+	const UINT8 *m_buffer;	///< buffer start address
+	size_t m_size;			///< buffer size
+
+public:
+	/// Constructor. Use already allocated memory of given size
+	/// @param pBuffer Memory location
+	/// @param size Memory size
+	CPGFPositionalMemoryStream(const UINT8 *pBuffer, size_t size) : m_buffer(pBuffer), m_size(size) {}
+
+	virtual ~CPGFPositionalMemoryStream() { m_buffer = 0; }
+	virtual void ReadAt(UINT64 pos, int *count, void *buffer) const;
+	virtual bool IsValid() const	{ return m_buffer != 0; }
+	virtual const UINT8* PeekAt(UINT64 pos, int count) const	{ ASSERT(IsValid()); return (pos + count <= m_size) ? m_buffer + pos : NULL; }
+
+	/// @return Memory size
+	size_t GetSize() const			{ return m_size; }
+	/// @return Memory buffer 
+	const UINT8* GetBuffer() const	{ return m_buffer; }
+};
+
+/////////////////////////////////////////////////////////////////////
+/// A read-only PGF stream subclass reading a positional stream at its own current position.
+/// Several cursor streams of the same positional stream can be used concurrently, each by one thread.
+/// Positioning relative to the end of stream isn't supported.
+/// @author C. Stamm
+/// @brief Cursor stream class
+class CPGFCursorStream : public CPGFStream {
+protected:
+	const CPGFPositionalStream *m_source;	///< positional stream
+	UINT64 m_pos;							///< current stream position
+
+public:
+	/// Constructor
+	/// @param source A positional stream
+	/// @param pos Initial stream position
+	CPGFCursorStream(const CPGFPositionalStream *source, UINT64 pos = 0) : m_source(source), m_pos(pos) { ASSERT(IsValid()); }
+	/// @return Positional stream
+	const CPGFPositionalStream* GetSource() const { return m_source; }
+
+	virtual ~CPGFCursorStream() { m_source = 0; }
+	virtual void Write(int *count, void *buffer) THROW_; // throws IOException 
+	virtual void Read(int *count, void *buffer) THROW_; // throws IOException 
+	virtual void SetPos(short posMode, INT64 posOff) THROW_; // throws IOException
+	virtual UINT64 GetPos() const	{ ASSERT(IsValid()); return m_pos; }
+	virtual bool   IsValid() const	{ return m_source != 0 && m_source->IsValid(); }
+	virtual const UINT8* Peek(int count) const	{ ASSERT(IsValid()); return m_source->PeekAt(m_pos, count); }
+};
+
 /////////////////////////////////////////////////////////////////////
 /// A PGF stream subclass for internal memory files. Usable only with MFC.
 /// @author C. Stamm
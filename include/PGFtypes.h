@@ -64,6 +64,7 @@
 #define PGFROI				8					///< supports Regions Of Interest
 #define Version5			16					///< new coding scheme since major version 5
 #define Version6			32					///< new HeaderSize: 32 bits instead of 16 bits 
+#define PGFTileIndex		64					///< an index of all encoded tiles follows the encoded levels (only used with PGFROI)
 // version numbers
 #ifdef __PGF32SUPPORT__
 #define PGFVersion			(Version2 | PGF32 | Version5 | Version6)	///< current standard version
@@ -222,6 +223,8 @@ typedef INT16 DataT;
 #endif
 
 typedef void (*RefreshCB)(void *p);
+typedef bool (*ScanlineCB)(const UINT8* row, UINT32 y, void *data);	///< receives output row y; returns true to stop
+typedef bool (*TileCB)(const UINT8* tile, int pitch, UINT32 width, UINT32 height, int level, UINT32 tileX, UINT32 tileY, void *data);	///< receives tile (tileX, tileY) of a level; returns true to stop
 
 //-------------------------------------------------------------------------------
 // Image constants
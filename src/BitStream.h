@@ -31,6 +31,13 @@
 
 #include "PGFtypes.h"
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
 // constants
 //static const WordWidth = 32;
 //static const WordWidthLog = 5;
@@ -41,6 +48,81 @@ static const UINT32 Filled = 0xFFFFFFFF;
  
 // these procedures have to be inlined because of performance reasons
 
+//////////////////////////////////////////////////////////////////////
+/// Return the number of trailing zeros of a non-zero word
+/// @param word A non-zero word
+/// @return Position of the lowest 1 in word
+inline UINT32 TrailingZeros(UINT32 word) {
+	ASSERT(word);
+#if defined(__GNUC__)
+	return __builtin_ctz(word);
+#elif defined(_MSC_VER)
+	unsigned long pos;
+	_BitScanForward(&pos, word);
+	return pos;
+#else
+	UINT32 count = 0;
+	while (!(word & 1)) { word >>= 1; count++; }
+	return count;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Return the number of ones in a word
+/// @param word A word
+/// @return Number of ones
+inline UINT32 BitCount(UINT32 word) {
+#if defined(__GNUC__)
+	return __builtin_popcount(word);
+#else
+	word = word - ((word >> 1) & 0x55555555);
+	word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+	return (((word + (word >> 4)) & 0x0F0F0F0F)*0x01010101) >> 24;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Gather the bits of word selected by mask into the low bits of the result (parallel bit extract)
+/// @param word A word
+/// @param mask Selects the bits of word
+/// @return Selected bits of word, packed in the order of increasing mask position
+inline UINT32 ExtractBits(UINT32 word, UINT32 mask) {
+#if defined(__BMI2__)
+	return _pext_u32(word, mask);
+#else
+	if (mask == Filled) return word;
+	if (!(word & mask)) return 0;
+
+	UINT32 bits = 0;
+	for (UINT32 bit = 1; mask; bit <<= 1) {
+		if (word & mask & (0 - mask)) bits |= bit;
+		mask &= mask - 1;
+	}
+	return bits;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Scatter the low bits of word to the positions selected by mask (parallel bit deposit)
+/// @param word A word
+/// @param mask Selects the target positions
+/// @return The low bits of word, stored at the positions of mask in increasing order
+inline UINT32 DepositBits(UINT32 word, UINT32 mask) {
+#if defined(__BMI2__)
+	return _pdep_u32(word, mask);
+#else
+	if (mask == Filled) return word;
+	if (!word) return 0;
+
+	UINT32 bits = 0;
+	for (UINT32 bit = 1; mask; bit <<= 1) {
+		if (word & bit) bits |= mask & (0 - mask);
+		mask &= mask - 1;
+	}
+	return bits;
+#endif
+}
+
 //////////////////////////////////////////////////////////////////////
 /// Set one bit of a bit stream to 1
 /// @param stream A bit stream stored in array of unsigned integers
@@ -62,7 +144,7 @@ inline void ClearBit(UINT32* stream, UINT32 pos) {
 /// @param stream A bit stream stored in array of unsigned integers
 /// @param pos A valid zero-based position in the bit stream
 /// @return bit at position pos of bit stream stream
-inline bool GetBit(UINT32* stream, UINT32 pos)  {
+inline bool GetBit(const UINT32* stream, UINT32 pos)  {
 	return (stream[pos >> WordWidthLog] & (1 << (pos%WordWidth))) > 0;
 
 }
@@ -125,7 +207,7 @@ inline void SetValueBlock(UINT32* stream, UINT32 pos, UINT32 val, UINT32 k) {
 /// @param stream A bit stream stored in array of unsigned integers
 /// @param pos A valid zero-based position in the bit stream
 /// @param k Number of bits to read: 1 <= k <= 32
-inline UINT32 GetValueBlock(UINT32* stream, UINT32 pos, UINT32 k) {
+inline UINT32 GetValueBlock(const UINT32* stream, UINT32 pos, UINT32 k) {
 	UINT32 count, hiCount;
 	const UINT32 iLoInt = pos >> WordWidthLog;				// integer of first bit
 	const UINT32 iHiInt = (pos + k - 1) >> WordWidthLog;		// integer of last bit
@@ -204,25 +286,23 @@ inline void SetBitBlock(UINT32* stream, UINT32 pos, UINT32 len) {
 /// @param len size of search area (in bits)
 /// return The distance to the next 1 in stream at position pos
 inline UINT32 SeekBitRange(UINT32* stream, UINT32 pos, UINT32 len) {
-	UINT32 count = 0;
-	UINT32 testMask = 1 << (pos%WordWidth);
+	const UINT32 offset = pos%WordWidth;
 	UINT32* word = stream + (pos >> WordWidthLog);
+	UINT32 bits = *word >> offset;
+	UINT32 count;
+
+	if (bits) {
+		count = TrailingZeros(bits);
+	} else {
+		count = WordWidth - offset;
 
-	while (((*word & testMask) == 0) && (count < len)) {
-		count++; 
-		testMask <<= 1;
-		if (!testMask) {
-			word++; testMask = 1;
-
-			// fast steps if all bits in a word are zero
-			while ((count + WordWidth <= len) && (*word == 0)) {
-				word++; 
-				count += WordWidth;
-			}
+		// fast steps if all bits in a word are zero
+		while (count < len && !(bits = *++word)) {
+			count += WordWidth;
 		}
+		if (count < len) count += TrailingZeros(bits);
 	}
-
-	return count;
+	return (count < len) ? count : len;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -233,24 +313,23 @@ inline UINT32 SeekBitRange(UINT32* stream, UINT32 pos, UINT32 len) {
 /// @param len size of search area (in bits)
 /// return The distance to the next 0 in stream at position pos
 inline UINT32 SeekBit1Range(UINT32* stream, UINT32 pos, UINT32 len) {
-	UINT32 count = 0;
-	UINT32 testMask = 1 << (pos%WordWidth);
+	const UINT32 offset = pos%WordWidth;
 	UINT32* word = stream + (pos >> WordWidthLog);
+	UINT32 bits = ~*word >> offset;
+	UINT32 count;
+
+	if (bits) {
+		count = TrailingZeros(bits);
+	} else {
+		count = WordWidth - offset;
 
-	while (((*word & testMask) != 0) && (count < len)) {
-		count++; 
-		testMask <<= 1;
-		if (!testMask) {
-			word++; testMask = 1;
-
-			// fast steps if all bits in a word are one
-			while ((count + WordWidth <= len) && (*word == Filled)) {
-				word++; 
-				count += WordWidth;
-			}
+		// fast steps if all bits in a word are one
+		while (count < len && !(bits = ~*++word)) {
+			count += WordWidth;
 		}
+		if (count < len) count += TrailingZeros(bits);
 	}
-	return count;
+	return (count < len) ? count : len;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -269,4 +348,143 @@ inline UINT32 AlignWordPos(UINT32 pos) {
 inline UINT32 NumberOfWords(UINT32 pos) {
 	return (pos + WordWidth - 1) >> WordWidthLog;
 }
+
+//////////////////////////////////////////////////////////////////////
+/// Sequential writer of a bit stream.
+/// The bits are accumulated in a 64 bit register and stored word by word.
+/// The bits of the first and the last word outside of the written range are kept,
+/// hence the result is the same as writing each bit with SetBit or ClearBit.
+/// @author C. Stamm
+/// @brief Buffered bit stream writer
+class CBitWriter {
+public:
+	//////////////////////////////////////////////////////////////////////
+	/// Constructor
+	/// @param stream A bit stream stored in array of unsigned integers
+	/// @param pos A valid zero-based position in the bit stream where writing starts
+	CBitWriter(UINT32* stream, UINT32 pos)
+	: m_stream(stream)
+	, m_word(stream + (pos >> WordWidthLog))
+	, m_bits(*m_word & ~(Filled << (pos%WordWidth)))
+	, m_count(pos%WordWidth)
+	{}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Append k-bit binary representation of val
+	/// @param val Value to append: 0 <= val < 2^k
+	/// @param k Number of bits: 1 <= k <= 32
+	void Write(UINT32 val, UINT32 k) {
+		ASSERT(k <= WordWidth);
+		ASSERT(k == WordWidth || val < (1U << k));
+		m_bits |= UINT64(val) << m_count;
+		m_count += k;
+		if (m_count >= WordWidth) {
+			*m_word++ = UINT32(m_bits);
+			m_bits >>= WordWidth;
+			m_count -= WordWidth;
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Append one bit
+	/// @param bit Bit to append
+	void WriteBit(bool bit) {
+		Write(bit, 1);
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Store the bits of the last, partially written word. 
+	/// Has to be called after the last write.
+	void Flush() {
+		if (m_count) *m_word = (*m_word & (Filled << m_count)) | UINT32(m_bits);
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Return the current bit stream position
+	/// @return Position of the next bit to write
+	UINT32 Pos() const {
+		return (UINT32(m_word - m_stream) << WordWidthLog) + m_count;
+	}
+
+private:
+	UINT32* m_stream;	// bit stream
+	UINT32* m_word;		// word of the next bit to write
+	UINT64  m_bits;		// not yet stored bits of *m_word
+	UINT32  m_count;	// number of bits in m_bits: [0, WordWidth)
+};
+
+//////////////////////////////////////////////////////////////////////
+/// Sequential reader of a bit stream.
+/// The bits are loaded word by word into a 64 bit register.
+/// A word is loaded when its first bit is needed. SkipZeros loads up to one word beyond the last read bit.
+/// @author C. Stamm
+/// @brief Buffered bit stream reader
+class CBitReader {
+public:
+	//////////////////////////////////////////////////////////////////////
+	/// Constructor
+	/// @param stream A bit stream stored in array of unsigned integers
+	/// @param pos A valid zero-based position in the bit stream where reading starts
+	CBitReader(const UINT32* stream, UINT32 pos)
+	: m_stream(stream)
+	, m_word(stream + (pos >> WordWidthLog) + 1)
+	, m_bits(stream[pos >> WordWidthLog] >> (pos%WordWidth))
+	, m_count(WordWidth - pos%WordWidth)
+	{}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Read k-bit number
+	/// @param k Number of bits to read: 1 <= k <= 32
+	/// @return k-bit number
+	UINT32 Read(UINT32 k) {
+		ASSERT(0 < k && k <= WordWidth);
+		if (m_count < k) Load();
+		const UINT32 val = UINT32(m_bits) & (Filled >> (WordWidth - k));
+		m_bits >>= k;
+		m_count -= k;
+		return val;
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Read one bit
+	/// @return Bit
+	bool ReadBit() {
+		if (m_count == 0) Load();
+		const bool bit = (m_bits & 1) != 0;
+		m_bits >>= 1;
+		m_count--;
+		return bit;
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Skip the 0's in front of the next 1, but at most WordWidth of them
+	/// @return Number of skipped 0's: [0, WordWidth]
+	UINT32 SkipZeros() {
+		if (m_count < WordWidth) Load();
+		const UINT32 n = (UINT32(m_bits)) ? TrailingZeros(UINT32(m_bits)) : WordWidth;
+		m_bits >>= n;
+		m_count -= n;
+		return n;
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Return the current bit stream position
+	/// @return Position of the next bit to read
+	UINT32 Pos() const {
+		return (UINT32(m_word - m_stream) << WordWidthLog) - m_count;
+	}
+
+private:
+	// append the next word to the register
+	void Load() {
+		ASSERT(m_count < WordWidth);
+		m_bits |= UINT64(*m_word++) << m_count;
+		m_count += WordWidth;
+	}
+
+	const UINT32* m_stream;	// bit stream
+	const UINT32* m_word;	// next word to load
+	UINT64  m_bits;		// loaded but not yet read bits
+	UINT32  m_count;	// number of bits in m_bits: [0, 2*WordWidth)
+};
 #endif //PGF_BITSTREAM_H
@@ -27,6 +27,7 @@
 /// @author C. Stamm, R. Spuler
 
 #include "Decoder.h"
+#include "SIMD.h"
 #ifdef TRACE
 	#include <stdio.h>
 #endif
@@ -68,17 +69,21 @@
 /// @param postHeader [out] A PGF post-header
 /// @param levelLength The location of the levelLength array. The array is allocated in this method. The caller has to delete this array.
 /// @param userDataPos The stream position of the user data (metadata)
-/// @param useOMP If true, then the decoder will use multi-threading based on openMP
+/// @param nThreads Number of threads used for decoding (1: no multi-threading)
 /// @param skipUserData If true, then user data is not read. In case of available user data, the file position is still returned in userDataPos.
 CDecoder::CDecoder(CPGFStream* stream, PGFPreHeader& preHeader, PGFHeader& header, 
 				   PGFPostHeader& postHeader, UINT32*& levelLength, UINT64& userDataPos,
-				   bool useOMP, bool skipUserData) THROW_
+				   int nThreads, bool skipUserData) THROW_
 : m_stream(stream)
 , m_startPos(0)
 , m_streamSizeEstimation(0)
 , m_encodedHeaderLength(0)
 , m_currentBlockIndex(0)
 , m_macroBlocksAvailable(0)
+, m_batch(0)
+, m_aheadBlocks(0)
+, m_readError(NoError)
+, m_maxPlanes(0)
 #ifdef __PGFROISUPPORT__
 , m_roi(false)
 #endif
@@ -87,28 +92,7 @@ CDecoder::CDecoder(CPGFStream* stream, PGFPreHeader& preHeader, PGFHeader& heade
 
 	int count, expected;
 
-	// set number of threads
-#ifdef LIBPGF_USE_OPENMP 
-	m_macroBlockLen = omp_get_num_procs();
-#else
-	m_macroBlockLen = 1;
-#endif
-	
-	if (useOMP && m_macroBlockLen > 1) {
-#ifdef LIBPGF_USE_OPENMP
-		omp_set_num_threads(m_macroBlockLen);
-#endif
-
-		// create macro block array
-		m_macroBlocks = new(std::nothrow) CMacroBlock*[m_macroBlockLen];
-		if (!m_macroBlocks) ReturnWithError(InsufficientMemory);
-		for (int i=0; i < m_macroBlockLen; i++) m_macroBlocks[i] = new CMacroBlock(this);
-		m_currentBlock = m_macroBlocks[m_currentBlockIndex];
-	} else {
-		m_macroBlocks = 0;
-		m_macroBlockLen = 1; // there is only one macro block
-		m_currentBlock = new CMacroBlock(this); 
-	}
+	CreateMacroBlocks(nThreads);
 
 	// store current stream position
 	m_startPos = m_stream->GetPos();
@@ -211,11 +195,101 @@ CDecoder::CDecoder(CPGFStream* stream, PGFPreHeader& preHeader, PGFHeader& heade
 	m_encodedHeaderLength = UINT32(m_stream->GetPos() - m_startPos);
 }
 
+/////////////////////////////////////////////////////////////////////
+/// Constructor: Creates a decoder of an already opened PGF image. The headers are not read again.
+/// The stream position is set to the beginning of the data block.
+/// It might throw an IOException.
+/// @param stream A PGF stream
+/// @param startPos The stream position at the beginning of the PGF pre-header
+/// @param encodedHeaderLength The length of all encoded headers in bytes
+/// @param levelLength The lengths of the encoded levels
+/// @param nLevels The number of levels
+/// @param nThreads Number of threads used for decoding (1: no multi-threading)
+CDecoder::CDecoder(CPGFStream* stream, UINT64 startPos, UINT32 encodedHeaderLength, const UINT32* levelLength, int nLevels, int nThreads) THROW_
+: m_stream(stream)
+, m_startPos(startPos)
+, m_streamSizeEstimation(0)
+, m_encodedHeaderLength(encodedHeaderLength)
+, m_currentBlockIndex(0)
+, m_macroBlocksAvailable(0)
+, m_batch(0)
+, m_aheadBlocks(0)
+, m_readError(NoError)
+, m_maxPlanes(0)
+#ifdef __PGFROISUPPORT__
+, m_roi(false)
+#endif
+{
+	ASSERT(m_stream);
+	ASSERT(levelLength || nLevels == 0);
+
+	CreateMacroBlocks(nThreads);
+
+	// compute the total size in bytes; keep attention: level length information is optional
+	for (int i=0; i < nLevels; i++) {
+		m_streamSizeEstimation += levelLength[i];
+	}
+	m_stream->SetPos(FSFromStart, m_startPos + m_encodedHeaderLength);
+}
+
+#ifdef __PGFROISUPPORT__
+/////////////////////////////////////////////////////////////////////
+/// Creates a single-threaded decoder that reads ROI encoded macro blocks without any headers from stream.
+/// It is used to decode several tiles concurrently.
+/// @param stream A PGF stream positioned at the first block of a tile
+CDecoder::CDecoder(CPGFStream* stream)
+: m_stream(stream)
+, m_startPos(0)
+, m_streamSizeEstimation(0)
+, m_encodedHeaderLength(0)
+, m_macroBlocks(0)
+, m_currentBlockIndex(0)
+, m_macroBlockLen(1)
+, m_macroBlocksAvailable(0)
+, m_batch(0)
+, m_aheadBlocks(0)
+, m_readError(NoError)
+, m_maxPlanes(0)
+, m_roi(true)
+{
+	ASSERT(m_stream);
+
+	// there is only one macro block
+	m_currentBlock = new CMacroBlock(this); 
+	m_startPos = m_stream->GetPos();
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////
+// Creates the macro blocks: each thread decodes its own macro block.
+// @param nThreads Number of threads used for decoding (1: no multi-threading)
+void CDecoder::CreateMacroBlocks(int nThreads) THROW_ {
+	// set number of threads: each thread decodes its own macro block
+#ifdef LIBPGF_USE_OPENMP 
+	m_macroBlockLen = nThreads;
+#else
+	(void)nThreads;
+	m_macroBlockLen = 1;
+#endif
+	
+	if (m_macroBlockLen > 1) {
+		// create macro block array
+		m_macroBlocks = new(std::nothrow) CMacroBlock*[DecoderBatches*m_macroBlockLen];
+		if (!m_macroBlocks) ReturnWithError(InsufficientMemory);
+		for (int i=0; i < DecoderBatches*m_macroBlockLen; i++) m_macroBlocks[i] = new CMacroBlock(this);
+		m_currentBlock = m_macroBlocks[m_currentBlockIndex];
+	} else {
+		m_macroBlocks = 0;
+		m_macroBlockLen = 1; // there is only one macro block
+		m_currentBlock = new CMacroBlock(this); 
+	}
+}
+
 /////////////////////////////////////////////////////////////////////
 // Destructor
 CDecoder::~CDecoder() {
 	if (m_macroBlocks) {
-		for (int i=0; i < m_macroBlockLen; i++) delete m_macroBlocks[i];
+		for (int i=0; i < DecoderBatches*m_macroBlockLen; i++) delete m_macroBlocks[i];
 		delete[] m_macroBlocks;
 	} else {
 		delete m_currentBlock;
@@ -465,6 +539,10 @@ void CDecoder::DecodeTileBuffer() THROW_ {
 
 	if (m_macroBlocksAvailable > 0) {
 		m_currentBlock = m_macroBlocks[++m_currentBlockIndex];
+
+		// the block might still be decoded by a task or not yet be claimed at all
+		m_currentBlock->Decode();
+		m_currentBlock->Wait();
 	} else {
 		DecodeBuffer();
 	}
@@ -486,31 +564,123 @@ void CDecoder::DecodeBuffer() THROW_ {
 		m_currentBlock->BitplaneDecode();
 		m_macroBlocksAvailable = 1;
 	} else {
-		m_macroBlocksAvailable = 0;
-		for (int i=0; i < m_macroBlockLen; i++) {
+#ifdef LIBPGF_USE_OPENMP_TASKS
+		// pipelined reading: inside a parallel region the next batch is read ahead and 
+		// decoded by tasks of the enclosing team, while the current batch is placed into subbands
+		const bool readAhead = omp_in_parallel() != 0;
+#else
+		const bool readAhead = false;
+#endif
+
+		if (m_aheadBlocks > 0) {
+			// continue with the read ahead batch
+			m_batch = (m_batch + 1)%DecoderBatches;
+			m_macroBlocksAvailable = m_aheadBlocks;
+			m_aheadBlocks = 0;
+		} else {
+			if (m_readError != NoError) {
+				// reading ahead has failed
+				OSError err = m_readError;
+				m_readError = NoError;
+				ReturnWithError(err);
+			}
+
 			// read sequentially several blocks
-			try {
-				ReadMacroBlock(m_macroBlocks[i]);
-				m_macroBlocksAvailable++;
-			} catch(IOException& ex) {
-				if (ex.error == MissingData) {
-					break; // no further data available
-				} else {
-					throw ex;
-				}
+			m_macroBlocksAvailable = ReadMacroBlocks(m_batch);
+			if (m_macroBlocksAvailable == 0 && m_readError != NoError) {
+				OSError err = m_readError;
+				m_readError = NoError;
+				ReturnWithError(err);
 			}
-		}
 
-		// decode in parallel
-		#pragma omp parallel for default(shared) //no declared exceptions in next block
-		for (int i=0; i < m_macroBlocksAvailable; i++) {
-			m_macroBlocks[i]->BitplaneDecode();
+			// decode in parallel
+			DecodeMacroBlocks(m_batch, m_macroBlocksAvailable, readAhead);
 		}
 		
 		// prepare current macro block
-		m_currentBlockIndex = 0;
+		m_currentBlockIndex = m_batch*m_macroBlockLen;
 		m_currentBlock = m_macroBlocks[m_currentBlockIndex];
+
+		if (readAhead && m_readError == NoError) {
+			// read and decode next batch in the background
+			const int next = (m_batch + 1)%DecoderBatches;
+			m_aheadBlocks = ReadMacroBlocks(next);
+			DecodeMacroBlocks(next, m_aheadBlocks, true);
+		}
+
+		// wait for the current macro block only
+		m_currentBlock->Decode();
+		m_currentBlock->Wait();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read up to m_macroBlockLen blocks from stream into the given batch.
+// Missing data just ends the batch, other read errors are stored in m_readError.
+// @param batch Batch index
+// @return Number of read blocks
+int CDecoder::ReadMacroBlocks(int batch) THROW_ {
+	ASSERT(m_macroBlocks && 0 <= batch && batch < DecoderBatches);
+	CMacroBlock **blocks = m_macroBlocks + batch*m_macroBlockLen;
+	int nBlocks = 0;
+
+	for (int i=0; i < m_macroBlockLen; i++) {
+		// a task might still decode a block of this batch
+		blocks[i]->Discard();
+		blocks[i]->Wait();
+
+		try {
+			ReadMacroBlock(blocks[i]);
+			nBlocks++;
+		} catch(IOException& ex) {
+			if (ex.error != MissingData) m_readError = ex.error;
+			break; // no further data available
+		}
 	}
+	return nBlocks;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Decode the first nBlocks blocks of the given batch.
+// If async is true, then the blocks are decoded by tasks of the enclosing team. 
+// In this case use CMacroBlock::Decode and CMacroBlock::Wait before a block is accessed.
+// @param batch Batch index
+// @param nBlocks Number of blocks to decode
+// @param async Decode blocks by tasks without waiting for them
+void CDecoder::DecodeMacroBlocks(int batch, int nBlocks, bool async) {
+	ASSERT(m_macroBlocks && 0 <= batch && batch < DecoderBatches);
+	CMacroBlock **blocks = m_macroBlocks + batch*m_macroBlockLen;
+
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	if (async) {
+		for (int i=0; i < nBlocks; i++) {
+			#pragma omp task default(shared) firstprivate(i, blocks) //no declared exceptions in next block
+			blocks[i]->Decode();
+		}
+		return;
+	}
+#else
+	(void)async;
+#endif
+	#pragma omp parallel for default(shared) num_threads(m_macroBlockLen) //no declared exceptions in next block
+	for (int i=0; i < nBlocks; i++) {
+		blocks[i]->Decode();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Discard all pre-decoded and read ahead macro blocks.
+// Decoding tasks still working on them are awaited.
+void CDecoder::DiscardMacroBlocks() {
+	if (m_macroBlocks) {
+		for (int i=0; i < DecoderBatches*m_macroBlockLen; i++) {
+			m_macroBlocks[i]->Discard();
+			m_macroBlocks[i]->Wait();
+		}
+	}
+	m_macroBlocksAvailable = 0;
+	m_aheadBlocks = 0;
+	m_readError = NoError;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -551,16 +721,32 @@ void CDecoder::ReadMacroBlock(CMacroBlock* block) THROW_ {
 
 	// read data
 	count = expected = wordLen*WordBytes;
-	m_stream->Read(&count, block->m_codeBuffer);
-	if (count != expected) ReturnWithError(MissingData);
+	const UINT8* data = NULL;
+#ifndef PGF_USE_BIG_ENDIAN
+	// use word aligned data of memory-based streams in place;
+	// the bit stream positions are only bounded by the size of m_codeBuffer, hence that many bytes must be accessible
+	data = m_stream->Peek((CodeBufferLen + 1)*WordBytes);
+	if (data && (size_t(data) & (WordBytes - 1))) data = NULL;
+#endif
+	if (data) {
+		block->m_code = (const UINT32*)data;
+		m_stream->SetPos(FSFromCurrent, count);
+	} else {
+		block->m_code = block->m_codeBuffer;
+		m_stream->Read(&count, block->m_codeBuffer);
+		if (count != expected) ReturnWithError(MissingData);
 
-#ifdef PGF_USE_BIG_ENDIAN 
-	// convert data
-	count /= WordBytes;
-	for (int i=0; i < count; i++) {
-		block->m_codeBuffer[i] = __VAL(block->m_codeBuffer[i]);
+	#ifdef PGF_USE_BIG_ENDIAN 
+		// convert data
+		count /= WordBytes;
+		for (int i=0; i < count; i++) {
+			block->m_codeBuffer[i] = __VAL(block->m_codeBuffer[i]);
+		}
+	#endif
 	}
-#endif
+
+	// block is ready for decoding
+	block->Reset();
 
 #ifdef __PGFROISUPPORT__
 	ASSERT(m_roi && h.rbh.bufferSize <= BufferSize || h.rbh.bufferSize == BufferSize);
@@ -581,8 +767,26 @@ void CDecoder::SkipTileBuffer() THROW_ {
 	// check if pre-decoded data is available
 	if (m_macroBlocksAvailable > 0) {
 		m_currentBlock = m_macroBlocks[++m_currentBlockIndex];
+		m_currentBlock->Discard();
+		return;
+	}
+
+	// check if read ahead data is available
+	if (m_aheadBlocks > 0) {
+		m_batch = (m_batch + 1)%DecoderBatches;
+		m_macroBlocksAvailable = m_aheadBlocks;
+		m_aheadBlocks = 0;
+		m_currentBlockIndex = m_batch*m_macroBlockLen;
+		m_currentBlock = m_macroBlocks[m_currentBlockIndex];
+		m_currentBlock->Discard();
 		return;
 	}
+	if (m_readError != NoError) {
+		// reading ahead has failed
+		OSError err = m_readError;
+		m_readError = NoError;
+		ReturnWithError(err);
+	}
 
 	UINT16 wordLen;
 	int count, expected;
@@ -605,6 +809,144 @@ void CDecoder::SkipTileBuffer() THROW_ {
 	m_stream->SetPos(FSFromCurrent, wordLen*WordBytes);
 }
 
+#ifdef __PGFROISUPPORT__
+//////////////////////////////////////////////////////////////////////
+// Skip all blocks of the next tile without decoding them.
+// Only the block headers are read: the last block of a tile has the tile end flag set.
+// Pre-decoded macro blocks are ignored, hence call SetStreamPos(...) before the next tile is decoded.
+// It might throw an IOException.
+void CDecoder::SkipTile() THROW_ {
+	ASSERT(m_roi);
+
+	UINT16 wordLen;
+	ROIBlockHeader h(0);
+	int count, expected;
+
+	do {
+		// read wordLen
+		count = expected = sizeof(wordLen);
+		m_stream->Read(&count, &wordLen); 
+		if (count != expected) ReturnWithError(MissingData);
+		wordLen = __VAL(wordLen);
+		if (wordLen > BufferSize) ReturnWithError(FormatCannotRead);
+
+		// read ROIBlockHeader
+		m_stream->Read(&count, &h.val); 
+		if (count != expected) ReturnWithError(MissingData);
+		h.val = __VAL(h.val);
+
+		// skip data
+		m_stream->SetPos(FSFromCurrent, wordLen*WordBytes);
+	} while (!h.rbh.tileEnd);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read an entry of the tile index and set the stream position to the beginning of this encoded tile.
+// The tile index follows the encoded levels and contains the stream offsets of all tiles relative to the beginning of their levels.
+// It might throw an IOException.
+// @param entry Index of the tile in the tile index
+// @param levelOffset Stream offset of the level containing the tile relative to the beginning of the data block
+// @param levelLen Length of the level containing the tile in bytes
+void CDecoder::SetStreamPosToTile(UINT32 entry, UINT64 levelOffset, UINT32 levelLen) THROW_ {
+	ASSERT(m_roi);
+	const UINT64 dataPos = m_startPos + m_encodedHeaderLength;
+	UINT32 offset;
+	int count, expected;
+
+	DiscardMacroBlocks();
+
+	// read tile offset: m_streamSizeEstimation is the length of all levels
+	m_stream->SetPos(FSFromStart, dataPos + m_streamSizeEstimation + (UINT64)entry*WordBytes);
+	count = expected = WordBytes;
+	m_stream->Read(&count, &offset);
+	if (count != expected) ReturnWithError(MissingData);
+	offset = __VAL(offset);
+	if (offset >= levelLen) ReturnWithError(FormatCannotRead);
+
+	m_stream->SetPos(FSFromStart, dataPos + levelOffset + offset);
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// Make this block claimable again.
+// The decoded flag is cleared first, hence a late claimer cannot be overwritten.
+void CDecoder::CMacroBlock::Reset() {
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	#pragma omp atomic write
+#endif
+	m_decoded = 0;
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	#pragma omp flush
+	#pragma omp atomic write
+#endif
+	m_claims = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Decode this block, unless another thread has already claimed it.
+void CDecoder::CMacroBlock::Decode() {
+	if (Claim()) {
+		BitplaneDecode();
+		SetDecoded();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Mark this block as done without decoding it, unless another thread has already claimed it.
+void CDecoder::CMacroBlock::Discard() {
+	if (Claim()) SetDecoded();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Wait until the claiming thread has finished this block.
+// Other tasks are executed in the meantime.
+void CDecoder::CMacroBlock::Wait() {
+	while (!IsDecoded()) {
+#ifdef LIBPGF_USE_OPENMP_TASKS
+		#pragma omp taskyield
+#endif
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Claim this block. Only the first caller after reading the block succeeds.
+// @return True if the caller has to finish this block
+bool CDecoder::CMacroBlock::Claim() {
+	int claims;
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	#pragma omp atomic capture
+#endif
+	claims = m_claims++;
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	#pragma omp flush
+#endif
+	return claims == 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Publish decoded values to other threads.
+void CDecoder::CMacroBlock::SetDecoded() {
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	#pragma omp flush
+	#pragma omp atomic write
+#endif
+	m_decoded = 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// @return True if the claiming thread has finished this block
+bool CDecoder::CMacroBlock::IsDecoded() {
+	int decoded;
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	#pragma omp atomic read
+#endif
+	decoded = m_decoded;
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	#pragma omp flush
+#endif
+	return decoded != 0;
+}
+
 //////////////////////////////////////////////////////////////////////
 // Decode block into buffer of given size using bit plane coding.
 // A buffer contains bufferLen UINT32 values, thus, bufferSize bits per bit plane.
@@ -618,24 +960,19 @@ void CDecoder::SkipTileBuffer() THROW_ {
 void CDecoder::CMacroBlock::BitplaneDecode() {
 	UINT32 bufferSize = m_header.rbh.bufferSize; ASSERT(bufferSize <= BufferSize);
 
-	UINT32 nPlanes;
+	UINT32 nPlanes, lastPlane = 0;
 	UINT32 codePos = 0, codeLen, sigLen, sigPos, signLen, signPos;
 	DataT planeMask;
 
 	// clear significance vector
-	for (UINT32 k=0; k < bufferSize; k++) {
-		m_sigFlagVector[k] = false;
-	}
-	m_sigFlagVector[bufferSize] = true; // sentinel
+	memset(m_sigFlagVector, 0, NumberOfWords(bufferSize)*WordBytes);
 
 	// clear output buffer
-	for (UINT32 k=0; k < BufferSize; k++) {
-		m_value[k] = 0;
-	}
+	memset(m_value, 0, BufferSize*DataTSize);
 
 	// read number of bit planes
 	// <nPlanes>
-	nPlanes = GetValueBlock(m_codeBuffer, 0, MaxBitPlanesLog); 
+	nPlanes = GetValueBlock(m_code, 0, MaxBitPlanesLog); 
 	codePos += MaxBitPlanesLog;
 
 	// loop through all bit planes
@@ -643,15 +980,18 @@ void CDecoder::CMacroBlock::BitplaneDecode() {
 	ASSERT(0 < nPlanes && nPlanes <= MaxBitPlanes + 1);
 	planeMask = 1 << (nPlanes - 1);
 
-	for (int plane = nPlanes - 1; plane >= 0; plane--) {
+	// truncated decoding: the bit planes below lastPlane are skipped
+	if (m_decoder->m_maxPlanes > 0 && m_decoder->m_maxPlanes < nPlanes) lastPlane = nPlanes - m_decoder->m_maxPlanes;
+
+	for (int plane = nPlanes - 1; plane >= (int)lastPlane; plane--) {
 		// read RL code
-		if (GetBit(m_codeBuffer, codePos)) {
+		if (GetBit(m_code, codePos)) {
 			// RL coding of sigBits is used
 			// <1><codeLen><codedSigAndSignBits>_<refBits>
 			codePos++;
 
 			// read codeLen
-			codeLen = GetValueBlock(m_codeBuffer, codePos, RLblockSizeLen); ASSERT(codeLen <= MaxCodeLen);
+			codeLen = GetValueBlock(m_code, codePos, RLblockSizeLen); ASSERT(codeLen <= MaxCodeLen);
 
 			// position of encoded sigBits and signBits
 			sigPos = codePos + RLblockSizeLen; ASSERT(sigPos < CodeBufferBitLen); 
@@ -659,9 +999,9 @@ void CDecoder::CMacroBlock::BitplaneDecode() {
 			// refinement bits
 			codePos = AlignWordPos(sigPos + codeLen); ASSERT(codePos < CodeBufferBitLen); 
 
-			// run-length decode significant bits and signs from m_codeBuffer and 
-			// read refinement bits from m_codeBuffer and compose bit plane
-			sigLen = ComposeBitplaneRLD(bufferSize, planeMask, sigPos, &m_codeBuffer[codePos >> WordWidthLog]);
+			// run-length decode significant bits and signs from m_code and 
+			// read refinement bits from m_code and compose bit plane
+			sigLen = ComposeBitplaneRLD(bufferSize, planeMask, sigPos, &m_code[codePos >> WordWidthLog]);
 
 		} else {
 			// no RL coding is used for sigBits and signBits together
@@ -669,17 +1009,17 @@ void CDecoder::CMacroBlock::BitplaneDecode() {
 			codePos++;
 
 			// read sigLen
-			sigLen = GetValueBlock(m_codeBuffer, codePos, RLblockSizeLen); ASSERT(sigLen <= MaxCodeLen);
+			sigLen = GetValueBlock(m_code, codePos, RLblockSizeLen); ASSERT(sigLen <= MaxCodeLen);
 			codePos += RLblockSizeLen; ASSERT(codePos < CodeBufferBitLen);
 
 			// read RL code for signBits
-			if (GetBit(m_codeBuffer, codePos)) {
+			if (GetBit(m_code, codePos)) {
 				// RL coding is used just for signBits
 				// <1><codeLen><codedSignBits>_<sigBits>_<refBits>
 				codePos++;
 
 				// read codeLen
-				codeLen = GetValueBlock(m_codeBuffer, codePos, RLblockSizeLen); ASSERT(codeLen <= MaxCodeLen);
+				codeLen = GetValueBlock(m_code, codePos, RLblockSizeLen); ASSERT(codeLen <= MaxCodeLen);
 
 				// sign bits
 				signPos = codePos + RLblockSizeLen; ASSERT(signPos < CodeBufferBitLen);
@@ -690,8 +1030,8 @@ void CDecoder::CMacroBlock::BitplaneDecode() {
 				// refinement bits
 				codePos = AlignWordPos(sigPos + sigLen); ASSERT(codePos < CodeBufferBitLen);
 
-				// read significant and refinement bitset from m_codeBuffer
-				sigLen = ComposeBitplaneRLD(bufferSize, planeMask, &m_codeBuffer[sigPos >> WordWidthLog], &m_codeBuffer[codePos >> WordWidthLog], signPos);
+				// read significant and refinement bitset from m_code
+				sigLen = ComposeBitplaneRLD(bufferSize, planeMask, &m_code[sigPos >> WordWidthLog], &m_code[codePos >> WordWidthLog], signPos);
 			
 			} else {
 				// RL coding of signBits was not efficient and therefore not used
@@ -699,7 +1039,7 @@ void CDecoder::CMacroBlock::BitplaneDecode() {
 				codePos++;
 
 				// read signLen
-				signLen = GetValueBlock(m_codeBuffer, codePos, RLblockSizeLen); ASSERT(signLen <= MaxCodeLen);
+				signLen = GetValueBlock(m_code, codePos, RLblockSizeLen); ASSERT(signLen <= MaxCodeLen);
 				
 				// sign bits
 				signPos = AlignWordPos(codePos + RLblockSizeLen); ASSERT(signPos < CodeBufferBitLen);
@@ -710,8 +1050,8 @@ void CDecoder::CMacroBlock::BitplaneDecode() {
 				// refinement bits
 				codePos = AlignWordPos(sigPos + sigLen); ASSERT(codePos < CodeBufferBitLen);
 
-				// read significant and refinement bitset from m_codeBuffer
-				sigLen = ComposeBitplane(bufferSize, planeMask, &m_codeBuffer[sigPos >> WordWidthLog], &m_codeBuffer[codePos >> WordWidthLog], &m_codeBuffer[signPos >> WordWidthLog]);
+				// read significant and refinement bitset from m_code
+				sigLen = ComposeBitplane(bufferSize, planeMask, &m_code[sigPos >> WordWidthLog], &m_code[codePos >> WordWidthLog], &m_code[signPos >> WordWidthLog]);
 			}
 		}
 
@@ -722,170 +1062,305 @@ void CDecoder::CMacroBlock::BitplaneDecode() {
 		planeMask >>= 1;
 	}
 
+	if (planeMask > 1) {
+		// the skipped bit planes of significant values are unknown: 
+		// move the values to the midpoint of their uncertainty interval [v, v + 2*planeMask)
+		const DataT mid = planeMask - 1;
+
+		for (UINT32 i=0; i < NumberOfWords(bufferSize); i++) {
+			for (UINT32 sigFlags = m_sigFlagVector[i]; sigFlags; sigFlags &= sigFlags - 1) {
+				DataT& v = m_value[(i << WordWidthLog) + TrailingZeros(sigFlags)];
+				v = (v < 0) ? v - mid : v + mid;
+			}
+		}
+	}
+
 	m_valuePos = 0;
 }
 
+#if defined(__PGFSIMDSUPPORT__) && defined(__PGF32SUPPORT__)
+// The SIMD bit plane kernels work on 32 bit coefficients. In 16 bit mode the scalar code is used.
+#define __PGFSIMDBITPLANES__
+
+//////////////////////////////////////////////////////////////
+// SIMD kernels of the refinement: the bits of refMask[i] select the values i*WordWidth..i*WordWidth + 31, 
+// which get the bit planeMask (broadcast + mask + blend). The absolute value of a selected value grows by planeMask.
+
+//////////////////////////////////////////////////////////////
+// Refinement of 4 values at a time (SSE2)
+PGF_SIMD_TARGET("sse2")
+static void SetRefinementBitsSSE2(DataT* values, const UINT32* refMask, UINT32 nWords, DataT planeMask) {
+	const __m128i lanes = _mm_setr_epi32(1, 2, 4, 8);
+	const __m128i mask = _mm_set1_epi32(planeMask);
+
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		for (UINT32 bits = refMask[i], j = 0; bits; bits >>= 4, j += 4) {
+			if (bits & 0xF) {
+				const __m128i sel = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32(bits), lanes), lanes);
+				const __m128i v = _mm_loadu_si128((const __m128i*)(values + j));
+				const __m128i neg = _mm_srai_epi32(v, 31);
+				// v >= 0: v | planeMask, v < 0: v - planeMask
+				const __m128i r = _mm_or_si128(_mm_and_si128(neg, _mm_sub_epi32(v, mask)), _mm_andnot_si128(neg, _mm_or_si128(v, mask)));
+				_mm_storeu_si128((__m128i*)(values + j), _mm_or_si128(_mm_and_si128(sel, r), _mm_andnot_si128(sel, v)));
+			}
+		}
+	}
+}
+
+#ifdef __PGFAVX2SUPPORT__
+//////////////////////////////////////////////////////////////
+// Refinement of 8 values at a time (AVX2)
+PGF_SIMD_TARGET("avx2")
+static void SetRefinementBitsAVX2(DataT* values, const UINT32* refMask, UINT32 nWords, DataT planeMask) {
+	const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	const __m256i mask = _mm256_set1_epi32(planeMask);
+
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		for (UINT32 bits = refMask[i], j = 0; bits; bits >>= 8, j += 8) {
+			if (bits & 0xFF) {
+				const __m256i sel = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits), lanes), lanes);
+				const __m256i v = _mm256_loadu_si256((const __m256i*)(values + j));
+				// v >= 0: v | planeMask, v < 0: v - planeMask
+				const __m256i r = _mm256_blendv_epi8(_mm256_or_si256(v, mask), _mm256_sub_epi32(v, mask), _mm256_srai_epi32(v, 31));
+				_mm256_storeu_si256((__m256i*)(values + j), _mm256_blendv_epi8(v, r, sel));
+			}
+		}
+	}
+}
+#endif //__PGFAVX2SUPPORT__
+
+#ifdef __PGFAVX512SUPPORT__
+//////////////////////////////////////////////////////////////
+// Refinement of 16 values at a time (AVX-512)
+PGF_SIMD_TARGET("avx512f")
+static void SetRefinementBitsAVX512(DataT* values, const UINT32* refMask, UINT32 nWords, DataT planeMask) {
+	const __m512i mask = _mm512_set1_epi32(planeMask);
+	const __m512i zero = _mm512_setzero_si512();
+
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		for (UINT32 bits = refMask[i], j = 0; bits; bits >>= 16, j += 16) {
+			const __mmask16 sel = (__mmask16)bits;
+			if (sel) {
+				__m512i v = _mm512_loadu_si512((const void*)(values + j));
+				const __mmask16 neg = _mm512_cmplt_epi32_mask(v, zero);
+				// v >= 0: v | planeMask, v < 0: v - planeMask
+				v = _mm512_mask_or_epi32(v, sel & ~neg, v, mask);
+				v = _mm512_mask_sub_epi32(v, sel & neg, v, mask);
+				_mm512_storeu_si512((void*)(values + j), v);
+			}
+		}
+	}
+}
+#endif //__PGFAVX512SUPPORT__
+#endif //__PGFSIMDSUPPORT__ && __PGF32SUPPORT__
+
+//////////////////////////////////////////////////////////////
+// Set the bit planeMask of the values selected by a bit set.
+// @param values Buffer of nWords*WordWidth values
+// @param refMask Bit set of values which get the bit planeMask
+// @param nWords Number of words of the bit set
+// @param planeMask Bit of the bit plane
+static void SetRefinementBits(DataT* values, const UINT32* refMask, UINT32 nWords, DataT planeMask) {
+#ifdef __PGFSIMDBITPLANES__
+	switch(GetSIMDLevel()) {
+#ifdef __PGFAVX512SUPPORT__
+	case SIMD_AVX512: SetRefinementBitsAVX512(values, refMask, nWords, planeMask); return;
+#endif
+#ifdef __PGFAVX2SUPPORT__
+	case SIMD_AVX2: SetRefinementBitsAVX2(values, refMask, nWords, planeMask); return;
+#endif
+	case SIMD_SSE2: SetRefinementBitsSSE2(values, refMask, nWords, planeMask); return;
+	default: break;
+	}
+#endif
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		for (UINT32 bits = refMask[i]; bits; bits &= bits - 1) {
+			DataT& v = values[TrailingZeros(bits)];
+			(v >= 0) ? v |= planeMask : v -= planeMask;
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Maps positions in the significant bitset to positions in the value buffer.
+// The significant bitset contains one bit for each value which has not been significant before the current bit plane.
+// Positions have to be mapped in increasing order. Significance flags set after the creation of the mapper 
+// are only allowed at already mapped positions.
+class CSigPosMapper {
+public:
+	CSigPosMapper(const UINT32* sigFlagVector)
+	: m_sigFlagVector(sigFlagVector)
+	, m_word(0)
+	, m_free(~sigFlagVector[0])
+	, m_sigPos(0)
+	{}
+
+	// Returns the value position of significant bitset position sigPos
+	// @param sigPos A valid position in the significant bitset (>= all formerly mapped positions)
+	UINT32 ValuePos(UINT32 sigPos) {
+		ASSERT(sigPos >= m_sigPos);
+		UINT32 skip = sigPos - m_sigPos;
+		UINT32 n;
+
+		// skip whole words
+		while (skip >= (n = BitCount(m_free))) {
+			skip -= n;
+			m_sigPos += n;
+			m_free = ~m_sigFlagVector[++m_word];
+		}
+
+		// skip values inside word
+		m_sigPos += skip + 1;
+		while (skip--) m_free &= m_free - 1;
+
+		const UINT32 valPos = (m_word << WordWidthLog) + TrailingZeros(m_free);
+		m_free &= m_free - 1;
+		return valPos;
+	}
+
+private:
+	const UINT32* m_sigFlagVector;	// significance flags before the current bit plane
+	UINT32 m_word;					// current word of m_sigFlagVector
+	UINT32 m_free;					// not yet mapped values of current word, which are not significant
+	UINT32 m_sigPos;				// significant bitset position of the lowest bit in m_free
+};
+
+////////////////////////////////////////////////////////////////////
+// Set refinement bits of all values which are already significant
+// returns number of refinement bits
+// input:  refBits
+// output: m_value
+UINT32 CDecoder::CMacroBlock::ComposeRefinementBits(UINT32 bufferSize, DataT planeMask, const UINT32* refBits) {
+	ASSERT(refBits);
+
+	const UINT32 nWords = NumberOfWords(bufferSize);
+	CBitReader ref(refBits, 0);
+	UINT32 refMask[BufferLen];
+
+	// distribute the refinement bits to the significant values of each word
+	for (UINT32 i=0; i < nWords; i++) {
+		const UINT32 sigFlags = m_sigFlagVector[i];
+
+		refMask[i] = (sigFlags) ? DepositBits(ref.Read(BitCount(sigFlags)), sigFlags) : 0;
+	}
+	const UINT32 refPos = ref.Pos();
+	ASSERT(refPos <= bufferSize);
+
+	// write refinement bits to m_value
+	SetRefinementBits(m_value, refMask, nWords, planeMask);
+
+	return refPos;
+}
+
 ////////////////////////////////////////////////////////////////////
 // Reconstruct bitplane from significant bitset and refinement bitset
 // returns length [bits] of sigBits
 // input:  sigBits, refBits, signBits
 // output: m_value
-UINT32 CDecoder::CMacroBlock::ComposeBitplane(UINT32 bufferSize, DataT planeMask, UINT32* sigBits, UINT32* refBits, UINT32* signBits) {
+UINT32 CDecoder::CMacroBlock::ComposeBitplane(UINT32 bufferSize, DataT planeMask, const UINT32* sigBits, const UINT32* refBits, const UINT32* signBits) {
 	ASSERT(sigBits);
 	ASSERT(refBits);
 	ASSERT(signBits);
 
-	UINT32 valPos = 0, signPos = 0, refPos = 0;
-	UINT32 sigPos = 0, sigEnd;
-	UINT32 zerocnt;
-
-	while (valPos < bufferSize) {
-		// search next 1 in m_sigFlagVector using searching with sentinel
-		sigEnd = valPos;
-		while(!m_sigFlagVector[sigEnd]) { sigEnd++; }
-		sigEnd -= valPos;
-		sigEnd += sigPos;
-
-		// search 1's in sigBits[sigPos..sigEnd)
-		// these 1's are significant bits
-		while (sigPos < sigEnd) {
-			// search 0's
-			zerocnt = SeekBitRange(sigBits, sigPos, sigEnd - sigPos);
-			sigPos += zerocnt;
-			valPos += zerocnt;
-			if (sigPos < sigEnd) {
-				// write bit to m_value
-				SetBitAtPos(valPos, planeMask);
+	// refinement bits have to be set before new significance flags are set
+	const UINT32 sigLen = bufferSize - ComposeRefinementBits(bufferSize, planeMask, refBits);
+	const UINT32 nWords = NumberOfWords(sigLen);
+	CSigPosMapper mapper(m_sigFlagVector);
+	CBitReader sign(signBits, 0);
 
-				// copy sign bit
-				SetSign(valPos, GetBit(signBits, signPos++)); 
+	// search 1's in sigBits[0..sigLen)
+	// these 1's are significant bits
+	for (UINT32 i=0; i < nWords; i++) {
+		UINT32 bits = sigBits[i];
+		if (i == nWords - 1 && sigLen%WordWidth) bits &= Filled >> (WordWidth - sigLen%WordWidth);
 
-				// update significance flag vector
-				m_sigFlagVector[valPos++] = true;
-				sigPos++; 
-			}
-		}
-		// refinement bit
-		if (valPos < bufferSize) {
-			// write one refinement bit
-			if (GetBit(refBits, refPos)) {
-				SetBitAtPos(valPos, planeMask);
-			}
-			refPos++;
-			valPos++;
+		while (bits) {
+			const UINT32 valPos = mapper.ValuePos((i << WordWidthLog) + TrailingZeros(bits));
+			bits &= bits - 1;
+
+			// write bit to m_value
+			SetBitAtPos(valPos, planeMask);
+
+			// copy sign bit
+			SetSign(valPos, sign.ReadBit()); 
+
+			// update significance flag vector
+			SetBit(m_sigFlagVector, valPos);
 		}
 	}
-	ASSERT(sigPos <= bufferSize);
-	ASSERT(refPos <= bufferSize);
-	ASSERT(signPos <= bufferSize);
-	ASSERT(valPos == bufferSize);
+	ASSERT(sign.Pos() <= bufferSize);
 
-	return sigPos;
+	return sigLen;
 }
 
 ////////////////////////////////////////////////////////////////////
 // Reconstruct bitplane from significant bitset and refinement bitset
 // returns length [bits] of decoded significant bits
-// input:  RL encoded sigBits and signBits in m_codeBuffer, refBits
+// input:  RL encoded sigBits and signBits in m_code, refBits
 // output: m_value
 // RLE:
 // - Decode run of 2^k zeros by a single 0.
 // - Decode run of count 0's followed by a 1 with codeword: 1<count>x
 // - x is 0: if a positive sign has been stored, otherwise 1
-// - Read each bit from m_codeBuffer[codePos] and increment codePos.
-UINT32 CDecoder::CMacroBlock::ComposeBitplaneRLD(UINT32 bufferSize, DataT planeMask, UINT32 codePos, UINT32* refBits) {
+// - Codewords are read from a 64 bit window at codePos: a sequence of 0's is consumed at once.
+UINT32 CDecoder::CMacroBlock::ComposeBitplaneRLD(UINT32 bufferSize, DataT planeMask, UINT32 codePos, const UINT32* refBits) {
 	ASSERT(refBits);
 
-	UINT32 valPos = 0, refPos = 0;
-	UINT32 sigPos = 0, sigEnd;
+	// refinement bits have to be set before new significance flags are set
+	const UINT32 sigLen = bufferSize - ComposeRefinementBits(bufferSize, planeMask, refBits);
+	CSigPosMapper mapper(m_sigFlagVector);
+	CBitReader code(m_code, codePos);
+	UINT32 sigPos = 0;
 	UINT32 k = 3;
 	UINT32 runlen = 1 << k; // = 2^k
-	UINT32 count = 0, rest = 0;
-	bool set1 = false;
-
-	while (valPos < bufferSize) {
-		// search next 1 in m_sigFlagVector using searching with sentinel
-		sigEnd = valPos;
-		while(!m_sigFlagVector[sigEnd]) { sigEnd++; }
-		sigEnd -= valPos;
-		sigEnd += sigPos;
-
-		while (sigPos < sigEnd) {
-			if (rest || set1) {
-				// rest of last run
-				sigPos += rest;
-				valPos += rest;
-				rest = 0;
-			} else {
-				// decode significant bits
-				if (GetBit(m_codeBuffer, codePos++)) {
-					// extract counter and generate zero run of length count
-					if (k > 0) {
-						// extract counter
-						count = GetValueBlock(m_codeBuffer, codePos, k); 
-						codePos += k;
-						if (count > 0) {
-							sigPos += count;
-							valPos += count;
-						}
 
-						// adapt k (half run-length interval)
-						k--;
-						runlen >>= 1;
-					}
+	while (sigPos < sigLen) {
+		if (code.ReadBit()) {
+			// extract counter and generate zero run of length count
+			UINT32 count = 0;
 
-					set1 = true;
+			if (k > 0) {
+				// extract counter
+				count = code.Read(k);
 
-				} else {
-					// generate zero run of length 2^k
-					sigPos += runlen;
-					valPos += runlen;
-
-					// adapt k (double run-length interval)
-					if (k < WordWidth) {
-						k++;
-						runlen <<= 1;
-					}
-				}
+				// adapt k (half run-length interval)
+				k--;
+				runlen >>= 1;
 			}
+			sigPos += count;
 
-			if (sigPos < sigEnd) {
-				if (set1) {
-					set1 = false;
+			// read sign bit
+			const bool signBit = code.ReadBit();
 
-					// write 1 bit
-					SetBitAtPos(valPos, planeMask);
+			if (sigPos < sigLen) {
+				const UINT32 valPos = mapper.ValuePos(sigPos++);
 
-					// set sign bit
-					SetSign(valPos, GetBit(m_codeBuffer, codePos++)); 
+				// write 1 bit
+				SetBitAtPos(valPos, planeMask);
 
-					// update significance flag vector
-					m_sigFlagVector[valPos++] = true;
-					sigPos++;
-				}
-			} else {
-				rest = sigPos - sigEnd;
-				sigPos = sigEnd;
-				valPos -= rest;
+				// set sign bit
+				SetSign(valPos, signBit); 
+
+				// update significance flag vector
+				SetBit(m_sigFlagVector, valPos);
 			}
+		} else {
+			// each 0 generates a zero run of length 2^k
+			UINT32 zeros = 1 + code.SkipZeros();
 
-		}
+			while (zeros--) {
+				sigPos += runlen;
 
-		// refinement bit
-		if (valPos < bufferSize) {
-			// write one refinement bit
-			if (GetBit(refBits, refPos)) {
-				SetBitAtPos(valPos, planeMask);
+				// adapt k (double run-length interval)
+				if (k < WordWidth) {
+					k++;
+					runlen <<= 1;
+				}
 			}
-			refPos++;
-			valPos++;
 		}
 	}
-	ASSERT(sigPos <= bufferSize);
-	ASSERT(refPos <= bufferSize);
-	ASSERT(valPos == bufferSize);
 
-	return sigPos;
+	return sigLen;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -896,105 +1371,87 @@ UINT32 CDecoder::CMacroBlock::ComposeBitplaneRLD(UINT32 bufferSize, DataT planeM
 // RLE:
 // decode run of 2^k 1's by a single 1
 // decode run of count 1's followed by a 0 with codeword: 0<count>
-UINT32 CDecoder::CMacroBlock::ComposeBitplaneRLD(UINT32 bufferSize, DataT planeMask, UINT32* sigBits, UINT32* refBits, UINT32 signPos) {
+UINT32 CDecoder::CMacroBlock::ComposeBitplaneRLD(UINT32 bufferSize, DataT planeMask, const UINT32* sigBits, const UINT32* refBits, UINT32 signPos) {
 	ASSERT(sigBits);
 	ASSERT(refBits);
 
-	UINT32 valPos = 0, refPos = 0;
-	UINT32 sigPos = 0, sigEnd;
-	UINT32 zerocnt, count = 0;
+	// refinement bits have to be set before new significance flags are set
+	const UINT32 sigLen = bufferSize - ComposeRefinementBits(bufferSize, planeMask, refBits);
+	const UINT32 nWords = NumberOfWords(sigLen);
+	CSigPosMapper mapper(m_sigFlagVector);
+	CBitReader code(m_code, signPos);
+	UINT32 count = 0;
 	UINT32 k = 0;
 	UINT32 runlen = 1 << k; // = 2^k
 	bool signBit = false;
 	bool zeroAfterRun = false;
 
-	while (valPos < bufferSize) {
-		// search next 1 in m_sigFlagVector using searching with sentinel
-		sigEnd = valPos;
-		while(!m_sigFlagVector[sigEnd]) { sigEnd++; }
-		sigEnd -= valPos;
-		sigEnd += sigPos;
-
-		// search 1's in sigBits[sigPos..sigEnd)
-		// these 1's are significant bits
-		while (sigPos < sigEnd) {
-			// search 0's
-			zerocnt = SeekBitRange(sigBits, sigPos, sigEnd - sigPos);
-			sigPos += zerocnt;
-			valPos += zerocnt;
-			if (sigPos < sigEnd) {
-				// write bit to m_value
-				SetBitAtPos(valPos, planeMask);
-
-				// check sign bit
-				if (count == 0) {
-					// all 1's have been set
-					if (zeroAfterRun) {
-						// finish the run with a 0
-						signBit = false;
-						zeroAfterRun = false;
+	// search 1's in sigBits[0..sigLen)
+	// these 1's are significant bits
+	for (UINT32 i=0; i < nWords; i++) {
+		UINT32 bits = sigBits[i];
+		if (i == nWords - 1 && sigLen%WordWidth) bits &= Filled >> (WordWidth - sigLen%WordWidth);
+
+		while (bits) {
+			const UINT32 valPos = mapper.ValuePos((i << WordWidthLog) + TrailingZeros(bits));
+			bits &= bits - 1;
+
+			// write bit to m_value
+			SetBitAtPos(valPos, planeMask);
+
+			// check sign bit
+			if (count == 0) {
+				// all 1's have been set
+				if (zeroAfterRun) {
+					// finish the run with a 0
+					signBit = false;
+					zeroAfterRun = false;
+				} else {
+					// decode next sign bit
+					if (code.ReadBit()) {
+						// generate 1's run of length 2^k
+						count = runlen - 1;
+						signBit = true;
+		
+						// adapt k (double run-length interval)
+						if (k < WordWidth) {
+							k++; 
+							runlen <<= 1;
+						}
 					} else {
-						// decode next sign bit
-						if (GetBit(m_codeBuffer, signPos++)) {
-							// generate 1's run of length 2^k
-							count = runlen - 1;
+						// extract counter and generate 1's run of length count
+						if (k > 0) {
+							// extract counter
+							count = code.Read(k); 
+
+							// adapt k (half run-length interval)
+							k--; 
+							runlen >>= 1;
+						}
+						if (count > 0) {
+							count--;
 							signBit = true;
-			
-							// adapt k (double run-length interval)
-							if (k < WordWidth) {
-								k++; 
-								runlen <<= 1;
-							}
+							zeroAfterRun = true;
 						} else {
-							// extract counter and generate 1's run of length count
-							if (k > 0) {
-								// extract counter
-								count = GetValueBlock(m_codeBuffer, signPos, k); 
-								signPos += k;
-
-								// adapt k (half run-length interval)
-								k--; 
-								runlen >>= 1;
-							}
-							if (count > 0) {
-								count--;
-								signBit = true;
-								zeroAfterRun = true;
-							} else {
-								signBit = false;
-							}
+							signBit = false;
 						}
 					}
-				} else {
-					ASSERT(count > 0);
-					ASSERT(signBit);
-					count--;
 				}
-
-				// copy sign bit
-				SetSign(valPos, signBit); 
-
-				// update significance flag vector
-				m_sigFlagVector[valPos++] = true;
-				sigPos++; 
+			} else {
+				ASSERT(count > 0);
+				ASSERT(signBit);
+				count--;
 			}
-		}
 
-		// refinement bit
-		if (valPos < bufferSize) {
-			// write one refinement bit
-			if (GetBit(refBits, refPos)) {
-				SetBitAtPos(valPos, planeMask);
-			}
-			refPos++;
-			valPos++;
+			// copy sign bit
+			SetSign(valPos, signBit); 
+
+			// update significance flag vector
+			SetBit(m_sigFlagVector, valPos);
 		}
 	}
-	ASSERT(sigPos <= bufferSize);
-	ASSERT(refPos <= bufferSize);
-	ASSERT(valPos == bufferSize);
 
-	return sigPos;
+	return sigLen;
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -38,6 +38,11 @@
 // Constants
 #define BufferLen			(BufferSize/WordWidth)	///< number of words per buffer
 #define CodeBufferLen		BufferSize				///< number of words in code buffer (CodeBufferLen > BufferLen)
+#ifdef LIBPGF_USE_OPENMP_TASKS
+#define DecoderBatches		2						///< number of macro block batches: one is placed into subbands, one is read ahead and decoded
+#else
+#define DecoderBatches		1						///< number of macro block batches
+#endif
 
 /////////////////////////////////////////////////////////////////////
 /// PGF decoder class.
@@ -57,8 +62,12 @@ class CDecoder {
 		: m_header(0)								// makes sure that IsCompletelyRead() returns true for an empty macro block
 		, m_valuePos(0)
 		, m_decoder(decoder)
+		, m_claims(1)								// an empty macro block has nothing to decode
+		, m_decoded(1)
 		{
 			ASSERT(m_decoder);
+			m_codeBuffer[CodeBufferLen] = 0;
+			m_code = m_codeBuffer;
 		}
 
 		//////////////////////////////////////////////////////////////////////
@@ -72,20 +81,45 @@ class CDecoder {
 		/// Call CDecoder::ReadMacroBlock before this method.
 		void BitplaneDecode();
 
+		//////////////////////////////////////////////////////////////////////
+		/// Makes this macro block claimable again. Call this method after the input data has been completely read.
+		/// A late task of an earlier batch might already claim and decode the block afterwards.
+		void Reset();
+
+		//////////////////////////////////////////////////////////////////////
+		/// Decodes this macro block, unless another thread has already claimed it.
+		/// Call CDecoder::ReadMacroBlock before this method.
+		void Decode();
+
+		//////////////////////////////////////////////////////////////////////
+		/// Marks this macro block as done without decoding it, unless another thread has already claimed it.
+		void Discard();
+
+		//////////////////////////////////////////////////////////////////////
+		/// Waits until the thread which has claimed this macro block has finished decoding it.
+		void Wait();
+
 		ROIBlockHeader m_header;					///< block header
 		DataT  m_value[BufferSize];					///< output buffer of values with index m_valuePos
-		UINT32 m_codeBuffer[CodeBufferLen];			///< input buffer for encoded bitstream
+		UINT32 m_codeBuffer[CodeBufferLen + 1];		///< input buffer for encoded bitstream (the last word is padding for CBitReader::SkipZeros)
+		const UINT32* m_code;						///< encoded bitstream: either m_codeBuffer or the encoded data in place in a memory-based stream
 		UINT32 m_valuePos;							///< current position in m_value
 
 	private:
-		UINT32 ComposeBitplane(UINT32 bufferSize, DataT planeMask, UINT32* sigBits, UINT32* refBits, UINT32* signBits);
-		UINT32 ComposeBitplaneRLD(UINT32 bufferSize, DataT planeMask, UINT32 sigPos, UINT32* refBits);
-		UINT32 ComposeBitplaneRLD(UINT32 bufferSize, DataT planeMask, UINT32* sigBits, UINT32* refBits, UINT32 signPos);
+		UINT32 ComposeRefinementBits(UINT32 bufferSize, DataT planeMask, const UINT32* refBits);
+		UINT32 ComposeBitplane(UINT32 bufferSize, DataT planeMask, const UINT32* sigBits, const UINT32* refBits, const UINT32* signBits);
+		UINT32 ComposeBitplaneRLD(UINT32 bufferSize, DataT planeMask, UINT32 sigPos, const UINT32* refBits);
+		UINT32 ComposeBitplaneRLD(UINT32 bufferSize, DataT planeMask, const UINT32* sigBits, const UINT32* refBits, UINT32 signPos);
 		void  SetBitAtPos(UINT32 pos, DataT planeMask)			{ (m_value[pos] >= 0) ? m_value[pos] |= planeMask : m_value[pos] -= planeMask; }
 		void  SetSign(UINT32 pos, bool sign)					{ m_value[pos] = -m_value[pos]*sign + m_value[pos]*(!sign); }
+		bool  Claim();
+		void  SetDecoded();
+		bool  IsDecoded();
 
 		CDecoder *m_decoder;						// outer class
-		bool m_sigFlagVector[BufferSize+1];			// see paper from Malvar, Fast Progressive Wavelet Coder
+		UINT32 m_sigFlagVector[BufferLen];			// bit set of significant values, see paper from Malvar, Fast Progressive Wavelet Coder
+		int  m_claims;								// number of threads which tried to claim this block since it has been read
+		int  m_decoded;								// 1 if the claiming thread has finished
 	};
 
 public:
@@ -98,11 +132,31 @@ public:
 	/// @param postHeader [out] A PGF post-header
 	/// @param levelLength The location of the levelLength array. The array is allocated in this method. The caller has to delete this array.
 	/// @param userDataPos The stream position of the user data (metadata)
-	/// @param useOMP If true, then the decoder will use multi-threading based on openMP
+	/// @param nThreads Number of threads used for decoding (1: no multi-threading)
 	/// @param skipUserData If true, then user data is not read. In case of available user data, the file position is still returned in userDataPos.
 	CDecoder(CPGFStream* stream, PGFPreHeader& preHeader, PGFHeader& header, 
 		     PGFPostHeader& postHeader, UINT32*& levelLength, UINT64& userDataPos, 
-			 bool useOMP, bool skipUserData) THROW_; // throws IOException
+			 int nThreads, bool skipUserData) THROW_; // throws IOException
+
+	/////////////////////////////////////////////////////////////////////
+	/// Constructor: Creates a decoder of an already opened PGF image. The headers are not read again.
+	/// The stream position is set to the beginning of the data block.
+	/// It might throw an IOException.
+	/// @param stream A PGF stream
+	/// @param startPos The stream position at the beginning of the PGF pre-header
+	/// @param encodedHeaderLength The length of all encoded headers in bytes
+	/// @param levelLength The lengths of the encoded levels
+	/// @param nLevels The number of levels
+	/// @param nThreads Number of threads used for decoding (1: no multi-threading)
+	CDecoder(CPGFStream* stream, UINT64 startPos, UINT32 encodedHeaderLength, const UINT32* levelLength, int nLevels, int nThreads) THROW_; // throws IOException
+
+#ifdef __PGFROISUPPORT__
+	/////////////////////////////////////////////////////////////////////
+	/// Creates a single-threaded decoder that reads ROI encoded macro blocks without any headers from stream.
+	/// It is used to decode several tiles concurrently.
+	/// @param stream A PGF stream positioned at the first block of a tile
+	CDecoder(CPGFStream* stream);
+#endif
 
 	/////////////////////////////////////////////////////////////////////
 	/// Destructor
@@ -140,8 +194,14 @@ public:
 	void SetStreamPosToStart() THROW_				{ ASSERT(m_stream); m_stream->SetPos(FSFromStart, m_startPos); }
 
 	////////////////////////////////////////////////////////////////////
-	/// Reset stream position to beginning of data block
-	void SetStreamPosToData() THROW_				{ ASSERT(m_stream); m_stream->SetPos(FSFromStart, m_startPos + m_encodedHeaderLength); }
+	/// Reset stream position to beginning of data block and discard all pre-decoded macro blocks
+	void SetStreamPosToData() THROW_				{ ASSERT(m_stream); DiscardMacroBlocks(); m_stream->SetPos(FSFromStart, m_startPos + m_encodedHeaderLength); }
+
+	////////////////////////////////////////////////////////////////////
+	/// Give the stream an access hint: some encoded levels are read next.
+	/// @param levelOffset Position of the first level relative to the beginning of the data block
+	/// @param len Length of the levels in bytes
+	void WillReadLevels(UINT64 levelOffset, UINT64 len)	{ ASSERT(m_stream); m_stream->WillRead(m_startPos + m_encodedHeaderLength + levelOffset, len); }
 
 	////////////////////////////////////////////////////////////////////
 	/// Skip a given number of bytes in the open stream.
@@ -173,9 +233,20 @@ public:
 	/// @return Stream
 	CPGFStream* GetStream()							{ return m_stream; }
 
+	/////////////////////////////////////////////////////////////////////
+	/// @return Number of threads used for decoding
+	int GetNofThreads() const						{ return m_macroBlockLen; }
+
+	/////////////////////////////////////////////////////////////////////
+	/// Limits the number of decoded bit planes of each macro block.
+	/// The less significant bit planes of a macro block are skipped, and the significant values get 
+	/// the midpoint of their remaining uncertainty interval. Macro blocks decoded ahead are not affected.
+	/// @param maxPlanes Maximum number of decoded bit planes per macro block (0: all bit planes)
+	void SetMaxPlanes(UINT32 maxPlanes)				{ m_maxPlanes = maxPlanes; }
+
 	/////////////////////////////////////////////////////////////////////
 	/// @return True if decoded macro blocks are available for processing
-	bool MacroBlocksAvailable() const				{ return m_macroBlocksAvailable > 1; }
+	bool MacroBlocksAvailable() const				{ return m_macroBlocksAvailable + m_aheadBlocks > 1; }
 
 #ifdef __PGFROISUPPORT__
 	/////////////////////////////////////////////////////////////////////
@@ -188,6 +259,29 @@ public:
 	/// It might throw an IOException.
 	void SkipTileBuffer() THROW_;
 
+	/////////////////////////////////////////////////////////////////////
+	/// Skips all blocks of the next tile without decoding them.
+	/// Pre-decoded macro blocks are ignored, hence call SetStreamPos(...) before the next tile is decoded.
+	/// It might throw an IOException.
+	void SkipTile() THROW_;
+
+	/////////////////////////////////////////////////////////////////////
+	/// Sets the stream position to the beginning of an encoded tile and discards all pre-decoded macro blocks.
+	/// Call DecodeTileBuffer() before the tile is placed.
+	/// It might throw an IOException.
+	/// @param pos Stream position of the first block of the tile
+	void SetStreamPos(UINT64 pos) THROW_			{ ASSERT(m_stream); DiscardMacroBlocks(); m_stream->SetPos(FSFromStart, pos); }
+
+	/////////////////////////////////////////////////////////////////////
+	/// Reads an entry of the tile index behind the encoded levels, sets the stream position to the beginning of 
+	/// this encoded tile, and discards all pre-decoded macro blocks.
+	/// Call DecodeTileBuffer() before the tile is placed.
+	/// It might throw an IOException.
+	/// @param entry Index of the tile in the tile index
+	/// @param levelOffset Stream offset of the level containing the tile relative to the beginning of the data block
+	/// @param levelLen Length of the level containing the tile in bytes
+	void SetStreamPosToTile(UINT32 entry, UINT64 levelOffset, UINT32 levelLen) THROW_;
+
 	/////////////////////////////////////////////////////////////////////
 	/// Enables region of interest (ROI) status.
 	void SetROI()					{ m_roi = true; }
@@ -198,18 +292,26 @@ public:
 #endif
 
 private:
+	void CreateMacroBlocks(int nThreads) THROW_;
 	void ReadMacroBlock(CMacroBlock* block) THROW_; ///< throws IOException
+	int  ReadMacroBlocks(int batch) THROW_;
+	void DecodeMacroBlocks(int batch, int nBlocks, bool async);
+	void DiscardMacroBlocks();
 
 	CPGFStream *m_stream;						///< input PGF stream
 	UINT64 m_startPos;							///< stream position at the beginning of the PGF pre-header
 	UINT64 m_streamSizeEstimation;				///< estimation of stream size
 	UINT32 m_encodedHeaderLength;				///< stream offset from startPos to the beginning of the data part (highest level)
 
-	CMacroBlock **m_macroBlocks;				///< array of macroblocks
+	CMacroBlock **m_macroBlocks;				///< array of DecoderBatches batches of macroblocks
 	int m_currentBlockIndex;					///< index of current macro block
-	int	m_macroBlockLen;						///< array length
+	int	m_macroBlockLen;						///< batch length
 	int	m_macroBlocksAvailable;					///< number of decoded macro blocks (including currently used macro block)
+	int m_batch;								///< batch containing the current macro block
+	int m_aheadBlocks;							///< number of macro blocks read ahead into the next batch
+	OSError m_readError;						///< error which stopped reading ahead; reported when the read ahead macro blocks are used up
 	CMacroBlock *m_currentBlock;				///< current macro block (used by main thread)
+	UINT32 m_maxPlanes;							///< maximum number of decoded bit planes per macro block (0: all bit planes)
 
 #ifdef __PGFROISUPPORT__
 	bool   m_roi;								///< true: ensures region of interest (ROI) decoding
@@ -27,6 +27,7 @@
 /// @author C. Stamm, R. Spuler
 
 #include "Encoder.h"
+#include "SIMD.h"
 #ifdef TRACE
 	#include <stdio.h>
 #endif
@@ -58,6 +59,237 @@
 #define CodeBufferBitLen		(CodeBufferLen*WordWidth)	///< max number of bits in m_codeBuffer
 #define MaxCodeLen				((1 << RLblockSizeLen) - 1)	///< max length of RL encoded block
 
+#if defined(__PGFSIMDSUPPORT__) && defined(__PGF32SUPPORT__)
+// The SIMD bit plane kernels work on 32 bit coefficients. In 16 bit mode the scalar code is used.
+#define __PGFSIMDBITPLANES__
+
+//////////////////////////////////////////////////////////////
+// SIMD kernels of the bit plane decomposition.
+// AbsBits kernels process the values i <= j < n in blocks and return the index of the first value not processed.
+// PlaneBits and SignFlags kernels process nWords blocks of WordWidth values: value j is mapped to bit j%WordWidth 
+// of word j/WordWidth (compare + movemask).
+
+//////////////////////////////////////////////////////////////
+// OR of the absolute values of 4 values at a time (SSE2)
+PGF_SIMD_TARGET("sse2")
+static UINT32 AbsBitsSSE2(const DataT* values, UINT32 i, UINT32 n, UINT32& absBits) {
+	__m128i acc = _mm_setzero_si128();
+
+	for (; i + 4 <= n; i += 4) {
+		const __m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+		const __m128i s = _mm_srai_epi32(v, 31);
+		acc = _mm_or_si128(acc, _mm_sub_epi32(_mm_xor_si128(v, s), s));
+	}
+	acc = _mm_or_si128(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_or_si128(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	absBits |= (UINT32)_mm_cvtsi128_si32(acc);
+	return i;
+}
+
+//////////////////////////////////////////////////////////////
+// One bit plane of 32 values at a time (SSE2)
+PGF_SIMD_TARGET("sse2")
+static void PlaneBitsSSE2(const DataT* values, UINT32 nWords, UINT32 planeMask, UINT32* planeBits) {
+	const __m128i mask = _mm_set1_epi32(planeMask);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		UINT32 word = 0;
+		for (UINT32 j=0; j < WordWidth; j += 4) {
+			const __m128i v = _mm_loadu_si128((const __m128i*)(values + j));
+			const __m128i s = _mm_srai_epi32(v, 31);
+			const __m128i bit = _mm_and_si128(_mm_sub_epi32(_mm_xor_si128(v, s), s), mask);
+			word |= (UINT32)(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(bit, zero))) ^ 0xF) << j;
+		}
+		planeBits[i] = word;
+	}
+}
+
+//////////////////////////////////////////////////////////////
+// Signs of 32 values at a time (SSE2)
+PGF_SIMD_TARGET("sse2")
+static void SignFlagsSSE2(const DataT* values, UINT32 nWords, UINT32* signFlags) {
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		UINT32 word = 0;
+		for (UINT32 j=0; j < WordWidth; j += 4) {
+			word |= (UINT32)_mm_movemask_ps(_mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(values + j)))) << j;
+		}
+		signFlags[i] = word;
+	}
+}
+
+#ifdef __PGFAVX2SUPPORT__
+//////////////////////////////////////////////////////////////
+// OR of the absolute values of 8 values at a time (AVX2)
+PGF_SIMD_TARGET("avx2")
+static UINT32 AbsBitsAVX2(const DataT* values, UINT32 i, UINT32 n, UINT32& absBits) {
+	__m256i acc = _mm256_setzero_si256();
+
+	for (; i + 8 <= n; i += 8) {
+		acc = _mm256_or_si256(acc, _mm256_abs_epi32(_mm256_loadu_si256((const __m256i*)(values + i))));
+	}
+	__m128i acc128 = _mm_or_si128(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	acc128 = _mm_or_si128(acc128, _mm_shuffle_epi32(acc128, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc128 = _mm_or_si128(acc128, _mm_shuffle_epi32(acc128, _MM_SHUFFLE(2, 3, 0, 1)));
+	absBits |= (UINT32)_mm_cvtsi128_si32(acc128);
+	return i;
+}
+
+//////////////////////////////////////////////////////////////
+// One bit plane of 32 values at a time (AVX2)
+PGF_SIMD_TARGET("avx2")
+static void PlaneBitsAVX2(const DataT* values, UINT32 nWords, UINT32 planeMask, UINT32* planeBits) {
+	const __m256i mask = _mm256_set1_epi32(planeMask);
+	const __m256i zero = _mm256_setzero_si256();
+
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		UINT32 word = 0;
+		for (UINT32 j=0; j < WordWidth; j += 8) {
+			const __m256i bit = _mm256_and_si256(_mm256_abs_epi32(_mm256_loadu_si256((const __m256i*)(values + j))), mask);
+			word |= (UINT32)(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(bit, zero))) ^ 0xFF) << j;
+		}
+		planeBits[i] = word;
+	}
+}
+
+//////////////////////////////////////////////////////////////
+// Signs of 32 values at a time (AVX2)
+PGF_SIMD_TARGET("avx2")
+static void SignFlagsAVX2(const DataT* values, UINT32 nWords, UINT32* signFlags) {
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		UINT32 word = 0;
+		for (UINT32 j=0; j < WordWidth; j += 8) {
+			word |= (UINT32)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(values + j)))) << j;
+		}
+		signFlags[i] = word;
+	}
+}
+#endif //__PGFAVX2SUPPORT__
+
+#ifdef __PGFAVX512SUPPORT__
+//////////////////////////////////////////////////////////////
+// OR of the absolute values of 16 values at a time (AVX-512)
+PGF_SIMD_TARGET("avx512f")
+static UINT32 AbsBitsAVX512(const DataT* values, UINT32 i, UINT32 n, UINT32& absBits) {
+	__m512i acc = _mm512_setzero_si512();
+	UINT32 lanes[16];
+
+	for (; i + 16 <= n; i += 16) {
+		acc = _mm512_or_si512(acc, _mm512_maskz_abs_epi32(0xFFFF, _mm512_loadu_si512((const void*)(values + i))));
+	}
+	_mm512_storeu_si512((void*)lanes, acc);
+	for (int j=0; j < 16; j++) absBits |= lanes[j];
+	return i;
+}
+
+//////////////////////////////////////////////////////////////
+// One bit plane of 32 values at a time (AVX-512)
+PGF_SIMD_TARGET("avx512f")
+static void PlaneBitsAVX512(const DataT* values, UINT32 nWords, UINT32 planeMask, UINT32* planeBits) {
+	const __m512i mask = _mm512_set1_epi32(planeMask);
+
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		const UINT32 lo = _mm512_test_epi32_mask(_mm512_maskz_abs_epi32(0xFFFF, _mm512_loadu_si512((const void*)values)), mask);
+		const UINT32 hi = _mm512_test_epi32_mask(_mm512_maskz_abs_epi32(0xFFFF, _mm512_loadu_si512((const void*)(values + 16))), mask);
+		planeBits[i] = lo | (hi << 16);
+	}
+}
+
+//////////////////////////////////////////////////////////////
+// Signs of 32 values at a time (AVX-512)
+PGF_SIMD_TARGET("avx512f")
+static void SignFlagsAVX512(const DataT* values, UINT32 nWords, UINT32* signFlags) {
+	const __m512i zero = _mm512_setzero_si512();
+
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		const UINT32 lo = _mm512_cmplt_epi32_mask(_mm512_loadu_si512((const void*)values), zero);
+		const UINT32 hi = _mm512_cmplt_epi32_mask(_mm512_loadu_si512((const void*)(values + 16)), zero);
+		signFlags[i] = lo | (hi << 16);
+	}
+}
+#endif //__PGFAVX512SUPPORT__
+#endif //__PGFSIMDSUPPORT__ && __PGF32SUPPORT__
+
+//////////////////////////////////////////////////////////////
+// OR of the absolute values of a buffer: it has the same highest bit as the maximum absolute value.
+// @param values Buffer
+// @param n Number of values
+// @return OR of all absolute values
+static UINT32 AbsBits(const DataT* values, UINT32 n) {
+	UINT32 absBits = 0, i = 0;
+
+#ifdef __PGFSIMDBITPLANES__
+	// the rest of a wider instruction set is processed with smaller blocks
+	const SIMDLevel level = GetSIMDLevel();
+#ifdef __PGFAVX512SUPPORT__
+	if (level >= SIMD_AVX512) i = AbsBitsAVX512(values, i, n, absBits);
+#endif
+#ifdef __PGFAVX2SUPPORT__
+	if (level >= SIMD_AVX2) i = AbsBitsAVX2(values, i, n, absBits);
+#endif
+	if (level >= SIMD_SSE2) i = AbsBitsSSE2(values, i, n, absBits);
+#endif
+	for (; i < n; i++) {
+		absBits |= abs(values[i]);
+	}
+	return absBits;
+}
+
+//////////////////////////////////////////////////////////////
+// Extract one bit plane of the absolute values of a buffer.
+// @param values Buffer of nWords*WordWidth values
+// @param nWords Number of words of the bit plane
+// @param planeMask Bit of the bit plane
+// @param planeBits [out] Bit plane
+static void PlaneBits(const DataT* values, UINT32 nWords, UINT32 planeMask, UINT32* planeBits) {
+#ifdef __PGFSIMDBITPLANES__
+	switch(GetSIMDLevel()) {
+#ifdef __PGFAVX512SUPPORT__
+	case SIMD_AVX512: PlaneBitsAVX512(values, nWords, planeMask, planeBits); return;
+#endif
+#ifdef __PGFAVX2SUPPORT__
+	case SIMD_AVX2: PlaneBitsAVX2(values, nWords, planeMask, planeBits); return;
+#endif
+	case SIMD_SSE2: PlaneBitsSSE2(values, nWords, planeMask, planeBits); return;
+	default: break;
+	}
+#endif
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		UINT32 word = 0;
+		for (UINT32 j=0; j < WordWidth; j++) {
+			if (abs(values[j]) & planeMask) word |= 1 << j;
+		}
+		planeBits[i] = word;
+	}
+}
+
+//////////////////////////////////////////////////////////////
+// Extract the signs of a buffer.
+// @param values Buffer of nWords*WordWidth values
+// @param nWords Number of words of the bit set
+// @param signFlags [out] Bit set of negative values
+static void SignFlags(const DataT* values, UINT32 nWords, UINT32* signFlags) {
+#ifdef __PGFSIMDBITPLANES__
+	switch(GetSIMDLevel()) {
+#ifdef __PGFAVX512SUPPORT__
+	case SIMD_AVX512: SignFlagsAVX512(values, nWords, signFlags); return;
+#endif
+#ifdef __PGFAVX2SUPPORT__
+	case SIMD_AVX2: SignFlagsAVX2(values, nWords, signFlags); return;
+#endif
+	case SIMD_SSE2: SignFlagsSSE2(values, nWords, signFlags); return;
+	default: break;
+	}
+#endif
+	for (UINT32 i=0; i < nWords; i++, values += WordWidth) {
+		UINT32 word = 0;
+		for (UINT32 j=0; j < WordWidth; j++) {
+			if (values[j] < 0) word |= 1 << j;
+		}
+		signFlags[i] = word;
+	}
+}
+
 //////////////////////////////////////////////////////
 /// Write pre-header, header, postHeader, and levelLength.
 /// It might throw an IOException.
@@ -66,44 +298,29 @@
 /// @param header An already filled in PGF header
 /// @param postHeader [in] An already filled in PGF post-header (containing color table, user data, ...)
 /// @param userDataPos [out] File position of user data
-/// @param useOMP If true, then the encoder will use multi-threading based on openMP
-CEncoder::CEncoder(CPGFStream* stream, PGFPreHeader preHeader, PGFHeader header, const PGFPostHeader& postHeader, UINT64& userDataPos, bool useOMP) THROW_
+/// @param nThreads Number of threads used for encoding (1: no multi-threading)
+CEncoder::CEncoder(CPGFStream* stream, PGFPreHeader preHeader, PGFHeader header, const PGFPostHeader& postHeader, UINT64& userDataPos, int nThreads) THROW_
 : m_stream(stream)
 , m_bufferStartPos(0)
+, m_levelLength(0)
 , m_currLevelIndex(0)
 , m_nLevels(header.nLevels)
 , m_favorSpeed(false)
 , m_forceWriting(false)
 #ifdef __PGFROISUPPORT__
 , m_roi(false)
+, m_tileIndex(0)
+, m_tileIndexLen(0)
+, m_indexedTiles(0)
+, m_tileStart(true)
 #endif
 {
 	ASSERT(m_stream);
 
 	int count;
 
-	// set number of threads
-#ifdef LIBPGF_USE_OPENMP
-	m_macroBlockLen = omp_get_num_procs();
-#else
-	m_macroBlockLen = 1;
-#endif
-	
-	if (useOMP && m_macroBlockLen > 1) {
-#ifdef LIBPGF_USE_OPENMP
-		omp_set_num_threads(m_macroBlockLen);
-#endif
-		// create macro block array
-		m_macroBlocks = new(std::nothrow) CMacroBlock*[m_macroBlockLen];
-		if (!m_macroBlocks) ReturnWithError(InsufficientMemory);
-		for (int i=0; i < m_macroBlockLen; i++) m_macroBlocks[i] = new CMacroBlock(this);
-		m_lastMacroBlock = 0;
-		m_currentBlock = m_macroBlocks[m_lastMacroBlock++];
-	} else {
-		m_macroBlocks = 0;
-		m_macroBlockLen = 1;
-		m_currentBlock = new CMacroBlock(this);
-	}
+	// create macro blocks
+	InitMacroBlocks(nThreads);
 
 	// save file position
 	m_startPosition = m_stream->GetPos();
@@ -141,11 +358,79 @@ CEncoder::CEncoder(CPGFStream* stream, PGFPreHeader preHeader, PGFHeader header,
 	m_levelLengthPos = m_stream->GetPos();
 }
 
+#ifdef __PGFROISUPPORT__
+//////////////////////////////////////////////////////
+/// Creates an encoder that writes encoded macro blocks without any headers into stream.
+/// It is used to spool encoded tiles in line based encoding.
+/// It might throw an IOException.
+/// @param stream A PGF stream
+/// @param nThreads Number of threads used for encoding (1: no multi-threading)
+CEncoder::CEncoder(CPGFStream* stream, int nThreads) THROW_
+: m_stream(stream)
+, m_bufferStartPos(0)
+, m_levelLength(0)
+, m_currLevelIndex(0)
+, m_nLevels(0)
+, m_favorSpeed(false)
+, m_forceWriting(false)
+, m_roi(false)
+, m_tileIndex(0)
+, m_tileIndexLen(0)
+, m_indexedTiles(0)
+, m_tileStart(true)
+{
+	ASSERT(m_stream);
+
+	// create macro blocks
+	InitMacroBlocks(nThreads);
+
+	// save file position
+	m_startPosition = m_levelLengthPos = m_stream->GetPos();
+	SetBufferStartPos();
+}
+#endif
+
+//////////////////////////////////////////////////////
+// Create macro blocks: several macro blocks are encoded in parallel.
+// @param nThreads Number of threads used for encoding (1: no multi-threading)
+void CEncoder::InitMacroBlocks(int nThreads) THROW_ {
+	// set number of threads: each thread encodes its own macro block
+#ifdef LIBPGF_USE_OPENMP
+	m_macroBlockLen = nThreads;
+#else
+	(void)nThreads;
+	m_macroBlockLen = 1;
+#endif
+	
+	m_batch = m_pendingBatch = m_pendingBlocks = 0;
+	m_writeError = NoError;
+
+	if (m_macroBlockLen > 1) {
+		// create macro block array
+		m_macroBlocks = new(std::nothrow) CMacroBlock*[MacroBlockBatches*m_macroBlockLen];
+		if (!m_macroBlocks) ReturnWithError(InsufficientMemory);
+		for (int i=0; i < MacroBlockBatches*m_macroBlockLen; i++) m_macroBlocks[i] = new CMacroBlock(this);
+		m_lastMacroBlock = 0;
+		m_currentBlock = m_macroBlocks[m_lastMacroBlock++];
+	} else {
+		m_macroBlocks = 0;
+		m_macroBlockLen = 1;
+		m_currentBlock = new CMacroBlock(this);
+	}
+}
+
 //////////////////////////////////////////////////////
 // Destructor
 CEncoder::~CEncoder() {	
-	delete m_currentBlock;
-	delete[] m_macroBlocks;
+	if (m_macroBlocks) {
+		for (int i=0; i < MacroBlockBatches*m_macroBlockLen; i++) delete m_macroBlocks[i];
+		delete[] m_macroBlocks;
+	} else {
+		delete m_currentBlock;
+	}
+#ifdef __PGFROISUPPORT__
+	delete[] m_tileIndex;
+#endif
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -195,6 +480,21 @@ UINT32 CEncoder::WriteLevelLength(UINT32*& levelLength) THROW_ {
 /// It might throw an IOException.
 /// @return Written image bytes.
 UINT32 CEncoder::UpdateLevelLength() THROW_ {
+#ifdef __PGFROISUPPORT__
+	if (m_tileIndex) {
+		// write tile index behind the encoded levels
+		ASSERT(m_indexedTiles == m_tileIndexLen);
+	#ifdef PGF_USE_BIG_ENDIAN 
+		for (UINT32 i=0; i < m_tileIndexLen; i++) {
+			m_tileIndex[i] = __VAL(m_tileIndex[i]);
+		}
+	#endif
+		int count = m_tileIndexLen*WordBytes;
+		m_stream->Write(&count, m_tileIndex);
+		delete[] m_tileIndex; m_tileIndex = NULL;
+	}
+#endif
+
 	UINT64 curPos = m_stream->GetPos(); // end of image
 
 	// set file pos to levelLength
@@ -228,6 +528,55 @@ UINT32 CEncoder::UpdateLevelLength() THROW_ {
 	return retValue;
 }
 
+#ifdef __PGFROISUPPORT__
+/////////////////////////////////////////////////////////////////////
+/// Copy already encoded macro blocks from a spool stream into stream.
+/// It might throw an IOException.
+/// @param spool A stream containing encoded macro blocks
+/// @param pos Stream position of the first macro block in spool
+/// @param len Number of bytes to copy
+/// @param levelEnd True if the copied macro blocks are the last ones of the current level
+void CEncoder::CopyMacroBlocks(CPGFStream* spool, UINT64 pos, UINT32 len, bool levelEnd) THROW_ {
+	ASSERT(spool);
+	// the code buffer is used as copy buffer, because this encoder doesn't encode macro blocks itself
+	UINT32* buffer = m_currentBlock->m_codeBuffer;
+	const UINT32 bufferLen = CodeBufferLen*WordBytes;
+	int count;
+
+	spool->SetPos(FSFromStart, pos);
+	while (len > 0) {
+		count = __min(len, bufferLen);
+		spool->Read(&count, buffer);
+		if (count <= 0) ReturnWithError(MissingData);
+		m_stream->Write(&count, buffer);
+		len -= count;
+	}
+
+	if (levelEnd && m_levelLength) {
+		// store level length
+		ASSERT(m_currLevelIndex < m_nLevels);
+		m_levelLength[m_currLevelIndex++] += (UINT32)ComputeBufferLength();
+		SetBufferStartPos();
+	}
+}
+
+//////////////////////////////////////////////////////
+/// Enables the tile index.
+/// It might throw an IOException.
+/// @param nTiles Number of tiles of all levels and channels
+void CEncoder::SetTileIndex(UINT32 nTiles) THROW_ {
+	ASSERT(m_roi);
+	ASSERT(!m_tileIndex);
+
+	m_tileIndex = new(std::nothrow) UINT32[nTiles];
+	if (!m_tileIndex) ReturnWithError(InsufficientMemory);
+	memset(m_tileIndex, 0, nTiles*WordBytes);
+	m_tileIndexLen = nTiles;
+	m_indexedTiles = 0;
+	m_tileStart = true;
+}
+#endif
+
 /////////////////////////////////////////////////////////////////////
 /// Partitions a rectangular region of a given subband.
 /// Partitioning scheme: The plane is partitioned in squares of side length LinBlockSize.
@@ -238,9 +587,12 @@ UINT32 CEncoder::UpdateLevelLength() THROW_ {
 /// @param height The height of the rectangle
 /// @param startPos The absolute subband position of the top left corner of the rectangular region
 /// @param pitch The number of bytes in row of the subband
-void CEncoder::Partition(CSubband* band, int width, int height, int startPos, int pitch) THROW_ {
+void CEncoder::Partition(CSubband* band, int quantParam, int width, int height, int startPos, int pitch) THROW_ {
 	ASSERT(band);
 
+	// uniform rounding quantization of LL, uniform deadzone quantization of the other subbands (see CSubband::Quantize)
+	const DataT threshold = (quantParam > 0 && band->GetOrientation() != LL) ? ((1 << quantParam)*7)/5 : 0;
+
 	const div_t hh = div(height, LinBlockSize);
 	const div_t ww = div(width, LinBlockSize);
 	const int ws = pitch - LinBlockSize;
@@ -255,7 +607,7 @@ void CEncoder::Partition(CSubband* band, int width, int height, int startPos, in
 			pos = base2;
 			for (int y=0; y < LinBlockSize; y++) {
 				for (int x=0; x < LinBlockSize; x++) {
-					WriteValue(band, pos);
+					QuantizeValue(band, pos, quantParam, threshold);
 					pos++;
 				}
 				pos += ws;
@@ -266,7 +618,7 @@ void CEncoder::Partition(CSubband* band, int width, int height, int startPos, in
 		pos = base2;
 		for (int y=0; y < LinBlockSize; y++) {
 			for (int x=0; x < ww.rem; x++) {
-				WriteValue(band, pos);
+				QuantizeValue(band, pos, quantParam, threshold);
 				pos++;
 			}
 			pos += wr;
@@ -280,7 +632,7 @@ void CEncoder::Partition(CSubband* band, int width, int height, int startPos, in
 		pos = base2;
 		for (int y=0; y < hh.rem; y++) {
 			for (int x=0; x < LinBlockSize; x++) {
-				WriteValue(band, pos);
+				QuantizeValue(band, pos, quantParam, threshold);
 				pos++;
 			}
 			pos += ws;
@@ -292,7 +644,7 @@ void CEncoder::Partition(CSubband* band, int width, int height, int startPos, in
 	for (int y=0; y < hh.rem; y++) {
 		// rest of width
 		for (int x=0; x < ww.rem; x++) {
-			WriteValue(band, pos);
+			QuantizeValue(band, pos, quantParam, threshold);
 			pos++;
 		}
 		pos += wr;
@@ -315,16 +667,25 @@ void CEncoder::Flush() THROW_ {
 }
 
 /////////////////////////////////////////////////////////////////////
-// Stores band value from given position bandPos into buffer m_value at position m_valuePos
+// Quantizes band value from given position bandPos and stores it into buffer m_value at position m_valuePos
 // If buffer is full encode it to file
 // It might throw an IOException.
-void CEncoder::WriteValue(CSubband* band, int bandPos) THROW_ {
+void CEncoder::QuantizeValue(CSubband* band, int bandPos, int quantParam, DataT threshold) THROW_ {
 	if (m_currentBlock->m_valuePos == BufferSize) {
 		EncodeBuffer(ROIBlockHeader(BufferSize, false));
 	}
-	DataT val = m_currentBlock->m_value[m_currentBlock->m_valuePos++] = band->GetData(bandPos);
-	UINT32 v = abs(val);
-	if (v > m_currentBlock->m_maxAbsValue) m_currentBlock->m_maxAbsValue = v;
+	DataT v = band->GetData(bandPos);
+
+	if (quantParam > 0) {
+		if (v < -threshold) {
+			v = -(((-v >> (quantParam - 1)) + 1) >> 1);
+		} else if (v > threshold) {
+			v = ((v >> (quantParam - 1)) + 1) >> 1;
+		} else {
+			v = 0;
+		}
+	}
+	m_currentBlock->m_value[m_currentBlock->m_valuePos++] = v;
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -351,32 +712,57 @@ void CEncoder::EncodeBuffer(ROIBlockHeader h) THROW_ {
 		int lastLevelIndex = m_currentBlock->m_lastLevelIndex;
 
 		if (m_forceWriting || m_lastMacroBlock == m_macroBlockLen) {
-			// encode macro blocks
-			/*
-			volatile OSError error = NoError;
-			#pragma omp parallel for ordered default(shared)
-			for (int i=0; i < m_lastMacroBlock; i++) {
-				if (error == NoError) {
-					m_macroBlocks[i]->BitplaneEncode();
-					#pragma omp ordered
+			CMacroBlock** batch = m_macroBlocks + m_batch*m_macroBlockLen;
+
+#ifdef LIBPGF_USE_OPENMP_TASKS
+			if (omp_in_parallel()) {
+				// pipelined writing: the filled batch is encoded by tasks of the enclosing team,
+				// while a writer task writes the previously encoded batch and the main thread fills the next batch
+				#pragma omp taskwait
+				if (m_writeError != NoError) ReturnWithError(m_writeError);
+
+				if (m_pendingBlocks > 0) {
+					const int pendingBatch = m_pendingBatch, pendingBlocks = m_pendingBlocks;
+
+					#pragma omp task default(shared) firstprivate(pendingBatch, pendingBlocks)
 					{
 						try {
-							WriteMacroBlock(m_macroBlocks[i]);
+							WriteMacroBlocks(pendingBatch, pendingBlocks);
 						} catch (IOException& e) {
-							error = e.error;
+							m_writeError = e.error;
 						}
-						delete m_macroBlocks[i]; m_macroBlocks[i] = 0;
 					}
 				}
-			}
-			if (error != NoError) ReturnWithError(error);
-			*/
-			#pragma omp parallel for default(shared) //no declared exceptions in next block
-			for (int i=0; i < m_lastMacroBlock; i++) {
-				m_macroBlocks[i]->BitplaneEncode();
-			}
-			for (int i=0; i < m_lastMacroBlock; i++) {
-				WriteMacroBlock(m_macroBlocks[i]);
+				for (int i=0; i < m_lastMacroBlock; i++) {
+					#pragma omp task default(shared) firstprivate(i, batch) //no declared exceptions in next block
+					batch[i]->BitplaneEncode();
+				}
+				m_pendingBatch = m_batch;
+				m_pendingBlocks = m_lastMacroBlock;
+				m_batch = (m_batch + 1) % MacroBlockBatches;
+
+				if (m_forceWriting) {
+					// all macro blocks have to be written into the stream
+					#pragma omp taskwait
+					if (m_writeError != NoError) ReturnWithError(m_writeError);
+					WriteMacroBlocks(m_pendingBatch, m_pendingBlocks);
+					m_pendingBlocks = 0;
+				}
+			} else
+#endif
+			{
+				// encoded macro blocks of a former pipeline are written first
+				if (m_pendingBlocks > 0) {
+					WriteMacroBlocks(m_pendingBatch, m_pendingBlocks);
+					m_pendingBlocks = 0;
+				}
+
+				// encode macro blocks
+				#pragma omp parallel for default(shared) num_threads(m_macroBlockLen) //no declared exceptions in next block
+				for (int i=0; i < m_lastMacroBlock; i++) {
+					batch[i]->BitplaneEncode();
+				}
+				WriteMacroBlocks(m_batch, m_lastMacroBlock);
 			}
 			
 			// prepare for next round
@@ -384,11 +770,25 @@ void CEncoder::EncodeBuffer(ROIBlockHeader h) THROW_ {
 			m_lastMacroBlock = 0;
 		}
 		// re-initialize macro block
-		m_currentBlock = m_macroBlocks[m_lastMacroBlock++];
+		m_currentBlock = m_macroBlocks[m_batch*m_macroBlockLen + m_lastMacroBlock++];
 		m_currentBlock->Init(lastLevelIndex);
 	}
 }
 
+/////////////////////////////////////////////////////////////////////
+// Write encoded macro blocks of a batch in their order into stream.
+// It might throw an IOException.
+// @param batch Batch index
+// @param nBlocks Number of encoded macro blocks in batch
+void CEncoder::WriteMacroBlocks(int batch, int nBlocks) THROW_ {
+	ASSERT(0 <= batch && batch < MacroBlockBatches);
+	CMacroBlock** blocks = m_macroBlocks + batch*m_macroBlockLen;
+
+	for (int i=0; i < nBlocks; i++) {
+		WriteMacroBlock(blocks[i]);
+	}
+}
+
 /////////////////////////////////////////////////////////////////////
 // Write encoded macro block into stream.
 // It might throw an IOException.
@@ -398,6 +798,17 @@ void CEncoder::WriteMacroBlock(CMacroBlock* block) THROW_ {
 	ROIBlockHeader h = block->m_header;
 	UINT16 wordLen = UINT16(NumberOfWords(block->m_codePos)); ASSERT(wordLen <= CodeBufferLen);
 	int count = sizeof(UINT16);
+
+#ifdef __PGFROISUPPORT__
+	if (m_tileIndex) {
+		if (m_tileStart && m_levelLength) {
+			// first macro block of a tile: the already written bytes of the current level are its offset
+			ASSERT(m_indexedTiles < m_tileIndexLen);
+			if (m_indexedTiles < m_tileIndexLen) m_tileIndex[m_indexedTiles++] = m_levelLength[m_currLevelIndex];
+		}
+		m_tileStart = h.rbh.tileEnd;
+	}
+#endif
 	
 #ifdef TRACE
 	//UINT32 filePos = (UINT32)m_stream->GetPos();
@@ -452,7 +863,6 @@ void CEncoder::WriteMacroBlock(CMacroBlock* block) THROW_ {
 
 	// reset values
 	block->m_valuePos = 0;
-	block->m_maxAbsValue = 0;
 }
 
 ////////////////////////////////////////////////////////
@@ -471,8 +881,11 @@ void CEncoder::CMacroBlock::BitplaneEncode() {
 	UINT32  sigBits[BufferLen] = { 0 }; 
 	UINT32  refBits[BufferLen] = { 0 }; 
 	UINT32  signBits[BufferLen] = { 0 }; 
+	UINT32  planeBits[BufferLen];
+	UINT32  signFlags[BufferLen];
 	UINT32  planeMask;
 	UINT32	bufferSize = m_header.rbh.bufferSize; ASSERT(bufferSize <= BufferSize);
+	const UINT32 nWords = NumberOfWords(bufferSize);
 	bool	useRL;
 
 #ifdef TRACE
@@ -480,19 +893,15 @@ void CEncoder::CMacroBlock::BitplaneEncode() {
 #endif 
 
 	// clear significance vector
-	for (UINT32 k=0; k < bufferSize; k++) {
-		m_sigFlagVector[k] = false;
-	}
-	m_sigFlagVector[bufferSize] = true; // sentinel
+	memset(m_sigFlagVector, 0, NumberOfWords(bufferSize)*WordBytes);
 
 	// clear output buffer
-	for (UINT32 k=0; k < bufferSize; k++) {
-		m_codeBuffer[k] = 0;
-	}
+	memset(m_codeBuffer, 0, bufferSize*WordBytes);
 	m_codePos = 0;
 
 	// compute number of bit planes and split buffer into separate bit planes
-	nPlanes = NumberOfBitplanes();
+	nPlanes = NumberOfBitplanes(AbsBits(m_value, bufferSize));
+	SignFlags(m_value, nWords, signFlags);
 
 	// write number of bit planes to m_codeBuffer
 	// <nPlanes>
@@ -505,12 +914,11 @@ void CEncoder::CMacroBlock::BitplaneEncode() {
 
 	for (int plane = nPlanes - 1; plane >= 0; plane--) {
 		// clear significant bitset
-		for (UINT32 k=0; k < BufferLen; k++) {
-			sigBits[k] = 0;
-		}
+		memset(sigBits, 0, BufferLen*WordBytes);
 
 		// split bitplane in significant bitset and refinement bitset
-		sigLen = DecomposeBitplane(bufferSize, planeMask, m_codePos + RLblockSizeLen + 1, sigBits, refBits, signBits, signLen, codeLen);
+		PlaneBits(m_value, nWords, planeMask, planeBits);
+		sigLen = DecomposeBitplane(bufferSize, planeBits, signFlags, m_codePos + RLblockSizeLen + 1, sigBits, refBits, signBits, signLen, codeLen);
 
 		if (sigLen > 0 && codeLen <= MaxCodeLen && codeLen < AlignWordPos(sigLen) + AlignWordPos(signLen) + 2*RLblockSizeLen) {
 			// set RL code bit
@@ -610,77 +1018,65 @@ void CEncoder::CMacroBlock::BitplaneEncode() {
 //////////////////////////////////////////////////////////
 // Split bitplane of length bufferSize into significant and refinement bitset
 // returns length [bits] of significant bits
-// input:  bufferSize, planeMask, codePos
+// input:  bufferSize, planeBits, signFlags, codePos
 // output: sigBits, refBits, signBits, signLen [bits], codeLen [bits]
+// The bit plane is processed word by word: the bits of the values which have been significant
+// before are appended to refBits, the other bits are appended to sigBits and RL encoded.
 // RLE
 // - Encode run of 2^k zeros by a single 0.
 // - Encode run of count 0's followed by a 1 with codeword: 1<count>x
 // - x is 0: if a positive sign is stored, otherwise 1
 // - Store each bit in m_codeBuffer[codePos] and increment codePos.
-UINT32 CEncoder::CMacroBlock::DecomposeBitplane(UINT32 bufferSize, UINT32 planeMask, UINT32 codePos, UINT32* sigBits, UINT32* refBits, UINT32* signBits, UINT32& signLen, UINT32& codeLen) {
+UINT32 CEncoder::CMacroBlock::DecomposeBitplane(UINT32 bufferSize, const UINT32* planeBits, const UINT32* signFlags, UINT32 codePos, UINT32* sigBits, UINT32* refBits, UINT32* signBits, UINT32& signLen, UINT32& codeLen) {
+	ASSERT(planeBits);
+	ASSERT(signFlags);
 	ASSERT(sigBits);
 	ASSERT(refBits);
 	ASSERT(signBits);
 	ASSERT(codePos < CodeBufferBitLen);
 
-	UINT32 sigPos = 0;
-	UINT32 valuePos = 0, valueEnd;
-	UINT32 refPos = 0;
-
-	// set output value
-	signLen = 0;
+	const UINT32 nWords = NumberOfWords(bufferSize);
+	CBitWriter sig(sigBits, 0), ref(refBits, 0), sign(signBits, 0);
+	UINT32 n;
 
 	// prepare RLE of Sigs and Signs
-	const UINT32 outStartPos = codePos;
+	CBitWriter code(m_codeBuffer, codePos);
 	UINT32 k = 3;
 	UINT32 runlen = 1 << k; // = 2^k
 	UINT32 count = 0;
 
-	while (valuePos < bufferSize) {
-		// search next 1 in m_sigFlagVector using searching with sentinel
-		valueEnd = valuePos;
-		while(!m_sigFlagVector[valueEnd]) { valueEnd++; }
-
-		// search 1's in m_value[plane][valuePos..valueEnd)
-		// these 1's are significant bits
-		while (valuePos < valueEnd) {
-			if (GetBitAtPos(valuePos, planeMask)) {
-				// RLE encoding
-				// encode run of count 0's followed by a 1
-				// with codeword: 1<count>(signBits[signPos])
-				SetBit(m_codeBuffer, codePos++); 
-				if (k > 0) {
-					SetValueBlock(m_codeBuffer, codePos, count, k);
-					codePos += k;
-
-					// adapt k (half the zero run-length)
-					k--; 
-					runlen >>= 1;
-				}
+	for (UINT32 i=0; i < nWords; i++) {
+		const UINT32 sigFlags = m_sigFlagVector[i];
+		const UINT32 plane = planeBits[i];
+		UINT32 free = ~sigFlags;
+		if (i == nWords - 1 && bufferSize%WordWidth) free &= Filled >> (WordWidth - bufferSize%WordWidth);
 
-				// copy and write sign bit
-				if (m_value[valuePos] < 0) {
-					SetBit(signBits, signLen++);
-					SetBit(m_codeBuffer, codePos++);
-				} else {
-					ClearBit(signBits, signLen++);
-					ClearBit(m_codeBuffer, codePos++);
-				}
+		// write refinement bits of the values which have been significant before
+		if ((n = BitCount(sigFlags)) > 0) {
+			ref.Write(ExtractBits(plane, sigFlags), n);
+		}
 
-				// write a 1 to sigBits
-				SetBit(sigBits, sigPos++); 
+		// write significant bits of the other values
+		if ((n = BitCount(free)) > 0) {
+			UINT32 bits = ExtractBits(plane, free);
+			UINT32 signs = ExtractBits(signFlags[i], plane & free);
+			UINT32 bitPos = 0;
 
-				// update m_sigFlagVector
-				m_sigFlagVector[valuePos] = true;
+			sig.Write(bits, n);
+			if (bits) sign.Write(signs, BitCount(bits));
 
-				// prepare for next run
-				count = 0;
-			} else {
-				// RLE encoding
-				count++;
-				if (count == runlen) {
+			// update m_sigFlagVector
+			m_sigFlagVector[i] = sigFlags | (plane & free);
+
+			while (bitPos < n) {
+				const UINT32 onePos = (bits) ? TrailingZeros(bits) : n;
+				UINT32 zeros = onePos - bitPos;
+
+				// RLE encoding of the zeros before onePos
+				while (count + zeros >= runlen) {
 					// encode run of 2^k zeros by a single 0
-					ClearBit(m_codeBuffer, codePos++);
+					code.WriteBit(false);
+					zeros -= runlen - count;
 					// adapt k (double the zero run-length)
 					if (k < WordWidth) {
 						k++;
@@ -690,56 +1086,70 @@ UINT32 CEncoder::CMacroBlock::DecomposeBitplane(UINT32 bufferSize, UINT32 planeM
 					// prepare for next run
 					count = 0;
 				}
+				count += zeros;
+
+				if (onePos < n) {
+					// RLE encoding
+					// encode run of count 0's followed by a 1
+					// with codeword: 1<count>(signBits[signPos])
+					code.WriteBit(true); 
+					if (k > 0) {
+						code.Write(count, k);
+
+						// adapt k (half the zero run-length)
+						k--; 
+						runlen >>= 1;
+					}
 
-				// write 0 to sigBits
-				sigPos++;
-			}
-			valuePos++;
-		}
-		// refinement bit
-		if (valuePos < bufferSize) {
-			// write one refinement bit
-			if (GetBitAtPos(valuePos++, planeMask)) {
-				SetBit(refBits, refPos);
-			} else {
-				ClearBit(refBits, refPos);
+					// write sign bit
+					code.WriteBit(signs & 1);
+					signs >>= 1;
+					bits &= bits - 1;
+
+					// prepare for next run
+					count = 0;
+				}
+				bitPos = onePos + 1;
 			}
-			refPos++;
 		}
 	}
 	// RLE encoding of the rest of the plane
 	// encode run of count 0's followed by a 1
 	// with codeword: 1<count>(signBits[signPos])
-	SetBit(m_codeBuffer, codePos++); 
+	code.WriteBit(true); 
 	if (k > 0) {
-		SetValueBlock(m_codeBuffer, codePos, count, k);
-		codePos += k;
+		code.Write(count, k);
 	}
 	// write dmmy sign bit
-	SetBit(m_codeBuffer, codePos++);
+	code.WriteBit(true);
 
-	// write word filler zeros
+	// store partially written words
+	code.Flush();
+	sig.Flush();
+	ref.Flush();
+	sign.Flush();
 
+	const UINT32 sigPos = sig.Pos();
+	signLen = sign.Pos();
 	ASSERT(sigPos <= bufferSize);
-	ASSERT(refPos <= bufferSize);
 	ASSERT(signLen <= bufferSize);
-	ASSERT(valuePos == bufferSize);
-	ASSERT(codePos >= outStartPos && codePos < CodeBufferBitLen);
-	codeLen = codePos - outStartPos;
+	ASSERT(sigPos + ref.Pos() == bufferSize);
+	ASSERT(code.Pos() >= codePos && code.Pos() < CodeBufferBitLen);
+	codeLen = code.Pos() - codePos;
 
 	return sigPos;
 }
 
-
 ///////////////////////////////////////////////////////
 // Compute number of bit planes needed
-UINT8 CEncoder::CMacroBlock::NumberOfBitplanes() {
+// input: absBits: OR of all absolute values
+UINT8 CEncoder::CMacroBlock::NumberOfBitplanes(UINT32 absBits) {
 	UINT8 cnt = 0;
 
 	// determine number of bitplanes for max value
-	if (m_maxAbsValue > 0) {
-		while (m_maxAbsValue > 0) {
-			m_maxAbsValue >>= 1; cnt++;
+	if (absBits > 0) {
+		while (absBits > 0) {
+			absBits >>= 1; cnt++;
 		}
 		if (cnt == MaxBitPlanes + 1) cnt = 0;
 		// end cs
@@ -762,7 +1172,7 @@ UINT32 CEncoder::CMacroBlock::RLESigns(UINT32 codePos, UINT32* signBits, UINT32
 	ASSERT(0 <= codePos && codePos < CodeBufferBitLen);
 	ASSERT(0 < signLen && signLen <= BufferSize);
 	
-	const UINT32  outStartPos = codePos;
+	CBitWriter code(m_codeBuffer, codePos);
 	UINT32 k = 0;
 	UINT32 runlen = 1 << k; // = 2^k
 	UINT32 count = 0;
@@ -775,7 +1185,7 @@ UINT32 CEncoder::CMacroBlock::RLESigns(UINT32 codePos, UINT32* signBits, UINT32
 		if (count == runlen) {
 			// encode run of 2^k ones by a single 1
 			signPos += count; 
-			SetBit(m_codeBuffer, codePos++);
+			code.WriteBit(true);
 			// adapt k (double the 1's run-length)
 			if (k < WordWidth) {
 				k++; 
@@ -785,10 +1195,9 @@ UINT32 CEncoder::CMacroBlock::RLESigns(UINT32 codePos, UINT32* signBits, UINT32
 			// encode run of count 1's followed by a 0
 			// with codeword: 0(count)
 			signPos += count + 1;
-			ClearBit(m_codeBuffer, codePos++);
+			code.WriteBit(false);
 			if (k > 0) {
-				SetValueBlock(m_codeBuffer, codePos, count, k);
-				codePos += k;
+				code.Write(count, k);
 			}
 			// adapt k (half the 1's run-length)
 			if (k > 0) {
@@ -797,9 +1206,11 @@ UINT32 CEncoder::CMacroBlock::RLESigns(UINT32 codePos, UINT32* signBits, UINT32
 			}
 		}
 	}
+	code.Flush();
+
 	ASSERT(signPos == signLen || signPos == signLen + 1);
-	ASSERT(codePos >= outStartPos && codePos < CodeBufferBitLen);
-	return codePos - outStartPos;
+	ASSERT(code.Pos() >= codePos && code.Pos() < CodeBufferBitLen);
+	return code.Pos() - codePos;
 }
 
 //////////////////////////////////////////////////////
@@ -38,6 +38,11 @@
 // Constants
 #define BufferLen			(BufferSize/WordWidth)	///< number of words per buffer
 #define CodeBufferLen		BufferSize				///< number of words in code buffer (CodeBufferLen > BufferLen)
+#ifdef LIBPGF_USE_OPENMP_TASKS
+#define MacroBlockBatches	3						///< number of macro block batches: one is filled, one is encoded, and one is written
+#else
+#define MacroBlockBatches	1						///< number of macro block batches
+#endif
 
 /////////////////////////////////////////////////////////////////////
 /// PGF encoder class.
@@ -66,7 +71,6 @@ class CEncoder {
 		/// @param lastLevelIndex Level length directory index of last encoded level: [0, nLevels)
 		void Init(int lastLevelIndex) {				// initialize for reusage
 			m_valuePos = 0;
-			m_maxAbsValue = 0;
 			m_codePos = 0;
 			m_lastLevelIndex = lastLevelIndex;
 		}
@@ -81,18 +85,16 @@ class CEncoder {
 		UINT32	m_codeBuffer[CodeBufferLen];		///< output buffer for encoded bitstream
 		ROIBlockHeader m_header;					///< block header
 		UINT32	m_valuePos;							///< current buffer position
-		UINT32	m_maxAbsValue;						///< maximum absolute coefficient in each buffer
 		UINT32	m_codePos;							///< current position in encoded bitstream
 		int		m_lastLevelIndex;					///< index of last encoded level: [0, nLevels); used because a level-end can occur before a buffer is full
 
 	private:
 		UINT32 RLESigns(UINT32 codePos, UINT32* signBits, UINT32 signLen);
-		UINT32 DecomposeBitplane(UINT32 bufferSize, UINT32 planeMask, UINT32 codePos, UINT32* sigBits, UINT32* refBits, UINT32* signBits, UINT32& signLen, UINT32& codeLen);
-		UINT8  NumberOfBitplanes();
-		bool   GetBitAtPos(UINT32 pos, UINT32 planeMask) const	{ return (abs(m_value[pos]) & planeMask) > 0; }	
+		UINT32 DecomposeBitplane(UINT32 bufferSize, const UINT32* planeBits, const UINT32* signFlags, UINT32 codePos, UINT32* sigBits, UINT32* refBits, UINT32* signBits, UINT32& signLen, UINT32& codeLen);
+		UINT8  NumberOfBitplanes(UINT32 absBits);
 
 		CEncoder *m_encoder;						// encoder instance
-		bool	m_sigFlagVector[BufferSize+1];		// see paper from Malvar, Fast Progressive Wavelet Coder
+		UINT32	m_sigFlagVector[BufferLen];			// bit set of significant values, see paper from Malvar, Fast Progressive Wavelet Coder
 	};
 
 public:
@@ -104,9 +106,19 @@ public:
 	/// @param header An already filled in PGF header
 	/// @param postHeader [in] An already filled in PGF post-header (containing color table, user data, ...)
 	/// @param userDataPos [out] File position of user data
-	/// @param useOMP If true, then the encoder will use multi-threading based on openMP
+	/// @param nThreads Number of threads used for encoding (1: no multi-threading)
 	CEncoder(CPGFStream* stream, PGFPreHeader preHeader, PGFHeader header, const PGFPostHeader& postHeader, 
-		UINT64& userDataPos, bool useOMP) THROW_; // throws IOException
+		UINT64& userDataPos, int nThreads) THROW_; // throws IOException
+
+#ifdef __PGFROISUPPORT__
+	/////////////////////////////////////////////////////////////////////
+	/// Creates an encoder that writes encoded macro blocks without any headers into stream.
+	/// It is used to spool encoded tiles in line based encoding.
+	/// It might throw an IOException.
+	/// @param stream A PGF stream
+	/// @param nThreads Number of threads used for encoding (1: no multi-threading)
+	CEncoder(CPGFStream* stream, int nThreads) THROW_; // throws IOException
+#endif
 
 	/////////////////////////////////////////////////////////////////////
 	/// Destructor
@@ -116,6 +128,10 @@ public:
 	/// Encoder favors speed over compression size
 	void FavorSpeedOverSize() { m_favorSpeed = true; }
 
+	/////////////////////////////////////////////////////////////////////
+	/// @return Number of threads used for encoding
+	int GetNofThreads() const { return m_macroBlockLen; }
+
 	/////////////////////////////////////////////////////////////////////
 	/// Pad buffer with zeros and encode buffer.
 	/// It might throw an IOException.
@@ -135,7 +151,7 @@ public:
 	UINT32 WriteLevelLength(UINT32*& levelLength) THROW_;
 
 	/////////////////////////////////////////////////////////////////////
-	/// Write new levelLength into stream.
+	/// Write new levelLength into stream. A tile index is written behind the encoded levels before.
 	/// It might throw an IOException.
 	/// @return Written image bytes.
 	UINT32 UpdateLevelLength() THROW_;
@@ -143,14 +159,16 @@ public:
 	/////////////////////////////////////////////////////////////////////
 	/// Partitions a rectangular region of a given subband.
 	/// Partitioning scheme: The plane is partitioned in squares of side length LinBlockSize.
-	/// Write wavelet coefficients from subband into the input buffer of a macro block.
+	/// Write quantized wavelet coefficients from subband into the input buffer of a macro block.
+	/// The subband itself is not changed, hence the same subband can be encoded with different quantization parameters.
 	/// It might throw an IOException.
 	/// @param band A subband
+	/// @param quantParam The quantization parameter of this subband (0: the coefficients are written unchanged)
 	/// @param width The width of the rectangle
 	/// @param height The height of the rectangle
 	/// @param startPos The absolute subband position of the top left corner of the rectangular region
 	/// @param pitch The number of bytes in row of the subband
-	void Partition(CSubband* band, int width, int height, int startPos, int pitch) THROW_;
+	void Partition(CSubband* band, int quantParam, int width, int height, int startPos, int pitch) THROW_;
 
 	/////////////////////////////////////////////////////////////////////
 	/// Informs the encoder about the encoded level. 
@@ -158,11 +176,13 @@ public:
 	void SetEncodedLevel(int currentLevel) { ASSERT(currentLevel >= 0); m_currentBlock->m_lastLevelIndex = m_nLevels - currentLevel - 1; m_forceWriting = true; }
 
 	/////////////////////////////////////////////////////////////////////
-	/// Write a single value into subband at given position.
+	/// Quantization of a single value at given position in subband. The quantized value is written into the input buffer of a macro block.
 	/// It might throw an IOException.
 	/// @param band A subband
 	/// @param bandPos A valid position in subband band
-	void WriteValue(CSubband* band, int bandPos) THROW_;
+	/// @param quantParam The quantization parameter
+	/// @param threshold The dead-zone threshold of the quantization
+	void QuantizeValue(CSubband* band, int bandPos, int quantParam, DataT threshold) THROW_;
 
 	/////////////////////////////////////////////////////////////////////
 	/// Compute stream length of header.
@@ -192,6 +212,32 @@ public:
 	/////////////////////////////////////////////////////////////////////
 	/// Enables region of interest (ROI) status.
 	void SetROI()					{ m_roi = true; }
+
+	/////////////////////////////////////////////////////////////////////
+	/// Makes sure that the next call of EncodeTileBuffer writes all buffered macro blocks into the stream.
+	void ForceWriting()				{ m_forceWriting = true; }
+
+	/////////////////////////////////////////////////////////////////////
+	/// Enables the tile index: the stream offset of each written tile relative to the beginning of its level 
+	/// is stored and written behind the encoded levels in UpdateLevelLength().
+	/// Call this method before the first tile is encoded.
+	/// It might throw an IOException.
+	/// @param nTiles Number of tiles of all levels and channels
+	void SetTileIndex(UINT32 nTiles) THROW_;
+
+	/////////////////////////////////////////////////////////////////////
+	/// Return current stream position.
+	/// @return Stream position
+	UINT64 GetStreamPos() const		{ return m_stream->GetPos(); }
+
+	/////////////////////////////////////////////////////////////////////
+	/// Copy already encoded macro blocks from a spool stream into stream.
+	/// It might throw an IOException.
+	/// @param spool A stream containing encoded macro blocks
+	/// @param pos Stream position of the first macro block in spool
+	/// @param len Number of bytes to copy
+	/// @param levelEnd True if the copied macro blocks are the last ones of the current level
+	void CopyMacroBlocks(CPGFStream* spool, UINT64 pos, UINT32 len, bool levelEnd) THROW_;
 #endif
 
 #ifdef TRACE
@@ -199,17 +245,23 @@ public:
 #endif
 
 private:
+	void InitMacroBlocks(int nThreads) THROW_; // throws IOException
 	void EncodeBuffer(ROIBlockHeader h) THROW_; // throws IOException
 	void WriteMacroBlock(CMacroBlock* block) THROW_; // throws IOException
+	void WriteMacroBlocks(int batch, int nBlocks) THROW_; // throws IOException
 
 	CPGFStream *m_stream;						///< output PMF stream
 	UINT64	m_startPosition;					///< stream position of PGF start (PreHeader)
 	UINT64  m_levelLengthPos;					///< stream position of Metadata
 	UINT64  m_bufferStartPos;					///< stream position of encoded buffer
 
-	CMacroBlock **m_macroBlocks;				///< array of macroblocks
-	int		m_macroBlockLen;					///< array length
-	int		m_lastMacroBlock;					///< array index of the last created macro block
+	CMacroBlock **m_macroBlocks;				///< array of MacroBlockBatches batches of macroblocks
+	int		m_macroBlockLen;					///< number of macro blocks in a batch
+	int		m_lastMacroBlock;					///< batch index of the last created macro block
+	int		m_batch;							///< batch of the current macro block
+	int		m_pendingBatch;						///< batch of already encoded, but not yet written macro blocks
+	int		m_pendingBlocks;					///< number of macro blocks in m_pendingBatch
+	OSError	m_writeError;						///< error of an asynchronous write
 	CMacroBlock *m_currentBlock;				///< current macro block (used by main thread)
 
 	UINT32* m_levelLength;						///< temporary saves the level index
@@ -219,6 +271,10 @@ private:
 	bool	m_forceWriting;						///< all macro blocks have to be written into the stream
 #ifdef __PGFROISUPPORT__
 	bool	m_roi;								///< true: ensures region of interest (ROI) encoding
+	UINT32*	m_tileIndex;						///< stream offsets of the written tiles relative to the beginning of their levels, or NULL
+	UINT32	m_tileIndexLen;						///< number of tiles of all levels and channels
+	UINT32	m_indexedTiles;						///< number of tiles stored in m_tileIndex
+	bool	m_tileStart;						///< the next written macro block is the first one of a tile
 #endif
 };
 
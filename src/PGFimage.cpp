@@ -38,6 +38,8 @@
 #define YUVoffset16		32768			// 2^15
 //#define YUVoffset31		1073741824		// 2^30
 
+#define CopyBufferLen	65536			// buffer size used in copying encoded data
+
 //////////////////////////////////////////////////////////////////////
 // global methods and variables
 #ifdef NEXCEPTIONS
@@ -55,16 +57,29 @@
 CPGFImage::CPGFImage() 
 : m_decoder(0)
 , m_encoder(0)
+, m_cursor(0)
 , m_levelLength(0)
 , m_quant(0)
 , m_userDataPos(0)
+, m_decodedChannels(0)
 , m_downsample(false)
 , m_favorSpeedOverSize(false)
 , m_useOMPinEncoder(true)
 , m_useOMPinDecoder(true)
 , m_skipUserData(false)
+, m_maxThreads(0)
+, m_maxDecodedPlanes(0)
+, m_skipFinestDetails(false)
 #ifdef __PGFROISUPPORT__
 , m_streamReinitialized(false)
+, m_spoolEncoder(0)
+, m_spool(0)
+, m_memSpool(0)
+, m_lineRow(0)
+, m_useTileIndex(false)
+, m_seekTile(false)
+, m_parallelTiles(false)
+, m_tileCacheSize(0)
 #endif
 , m_cb(0)
 , m_cbArg(0)
@@ -111,15 +126,63 @@ void CPGFImage::Destroy() {
 	delete[] m_postHeader.userData; m_postHeader.userData = 0; m_postHeader.userDataLen = 0;
 	delete[] m_levelLength; m_levelLength = 0;
 	delete m_encoder; m_encoder = NULL;
+#ifdef __PGFROISUPPORT__
+	delete m_spoolEncoder; m_spoolEncoder = NULL;
+	delete m_memSpool; m_memSpool = NULL; m_spool = NULL;
+#endif
 	
 	m_userDataPos = 0;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Returns the number of threads used in a new encoder or decoder.
+// @param useOMP Use parallel threading with Open MP
+// @return Number of threads (1: no multi-threading)
+int CPGFImage::NumberOfThreads(bool useOMP) const {
+#ifdef LIBPGF_USE_OPENMP
+	if (useOMP) return (m_maxThreads > 0) ? m_maxThreads : omp_get_num_procs();
+#endif
+	(void)useOMP;
+	return 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Configures fast decoding of a lower-fidelity image.
+// @param maxPlanes Maximum number of decoded bit planes per macro block (0: all bit planes)
+// @param skipFinestDetails If true, the finest detail subbands are treated as zero instead of being decoded
+void CPGFImage::ConfigureFastDecoding(int maxPlanes /*= 0*/, bool skipFinestDetails /*= false*/) {
+	maxPlanes = __max(0, maxPlanes);
+#ifdef __PGFROISUPPORT__
+	if (maxPlanes != m_maxDecodedPlanes) {
+		// cached tiles have been decoded with a different number of bit planes
+		for (int i=0; i < m_header.channels; i++) {
+			if (m_wtChannel[i]) m_wtChannel[i]->ClearTileCache();
+		}
+	}
+#endif
+	m_maxDecodedPlanes = maxPlanes;
+	m_skipFinestDetails = skipFinestDetails;
+	if (m_decoder) m_decoder->SetMaxPlanes(m_maxDecodedPlanes);
+}
+
+#ifdef __PGFROISUPPORT__
+//////////////////////////////////////////////////////////////////////
+// Configures the decoding of images using the ROI encoding scheme.
+// @param parallelTiles Decode the tiles of a level in parallel
+// @param cacheSize Memory budget of the tile cache in bytes, shared by all channels (0: no tile cache)
+void CPGFImage::ConfigureTileDecoding(bool parallelTiles /*= false*/, UINT64 cacheSize /*= 0*/) {
+	m_parallelTiles = parallelTiles;
+	m_tileCacheSize = cacheSize;
+	InitTileCache();
+}
+#endif
+
 //////////////////////////////////////////////////////////////////////
 // Close PGF image after opening and reading.
 // Destructor calls this method during destruction.
 void CPGFImage::Close() {
 	delete m_decoder; m_decoder = 0;
+	delete m_cursor; m_cursor = 0;
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -132,12 +195,64 @@ void CPGFImage::Open(CPGFStream *stream) THROW_ {
 
 	// create decoder and read PGFPreHeader PGFHeader PGFPostHeader LevelLengths
 	m_decoder = new CDecoder(stream, m_preHeader, m_header, m_postHeader, m_levelLength, 
-		m_userDataPos, m_useOMPinDecoder, m_skipUserData);
+		m_userDataPos, NumberOfThreads(m_useOMPinDecoder), m_skipUserData);
+	m_decoder->SetMaxPlanes(m_maxDecodedPlanes);
+
+	InitDecoding();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Open a shared PGF image without reading its headers again.
+// The image gets its own cursor stream, hence several images of the same shared image can be read concurrently.
+// It might throw an IOException.
+// @param image An opened shared image
+void CPGFImage::Open(const CPGFSharedImage& image) THROW_ {
+	ASSERT(image.IsOpen());
+
+	// copy headers, but skip user data
+	m_preHeader = image.m_preHeader;
+	m_header = image.m_header;
+	m_postHeader = image.m_postHeader;
+	m_postHeader.userData = 0;
+	m_userDataPos = image.m_userDataPos;
+
+	// copy level lengths
+	if (image.m_levelLength) {
+		m_levelLength = new(std::nothrow) UINT32[m_header.nLevels];
+		if (!m_levelLength) ReturnWithError(InsufficientMemory);
+		memcpy(m_levelLength, image.m_levelLength, m_header.nLevels*WordBytes);
+	}
+
+	// create decoder reading at its own stream position
+	m_cursor = new CPGFCursorStream(image.m_stream, image.m_startPos);
+	m_decoder = new CDecoder(m_cursor, image.m_startPos, image.m_encodedHeaderLength, m_levelLength, 
+		(m_levelLength) ? m_header.nLevels : 0, NumberOfThreads(m_useOMPinDecoder));
+	m_decoder->SetMaxPlanes(m_maxDecodedPlanes);
+
+	InitDecoding();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Initialize the image data structures after the headers have been read.
+// Precondition: The decoder has been created.
+// It might throw an IOException.
+void CPGFImage::InitDecoding() THROW_ {
+	ASSERT(m_decoder);
 
 	if (m_header.nLevels > MaxLevel) ReturnWithError(FormatCannotRead);
 
 	// set current level
 	m_currentLevel = m_header.nLevels;
+	m_decodedChannels = 0;
+
+#ifdef __PGFROISUPPORT__
+	// the tile index can only be used if the level lengths have been written
+	m_useTileIndex = (m_preHeader.version & PGFTileIndex) && ROIisSupported() && m_header.nLevels > 0;
+	for (int l=0; m_useTileIndex && l < m_header.nLevels; l++) {
+		if (!m_levelLength[l]) m_useTileIndex = false;
+	}
+	m_seekTile = false;
+#endif
 
 	// set image width and height
 	m_width[0] = m_header.width;
@@ -147,14 +262,7 @@ void CPGFImage::Open(CPGFStream *stream) THROW_ {
 	CompleteHeader();
 
 	// interpret quant parameter
-	if (m_header.quality > DownsampleThreshold && 
-		(m_header.mode == ImageModeRGBColor || 
-		 m_header.mode == ImageModeRGBA || 
-		 m_header.mode == ImageModeRGB48 || 
-		 m_header.mode == ImageModeCMYKColor || 
-		 m_header.mode == ImageModeCMYK64 || 
-		 m_header.mode == ImageModeLabColor || 
-		 m_header.mode == ImageModeLab48)) {
+	if (m_header.quality > DownsampleThreshold && DownsampleSupported()) {
 		m_downsample = true;
 		m_quant = m_header.quality - 1;
 	} else {
@@ -180,6 +288,9 @@ void CPGFImage::Open(CPGFStream *stream) THROW_ {
 		for (int i=0; i < m_header.channels; i++) {
 			m_wtChannel[i] = new CWaveletTransform(m_width[i], m_height[i], m_header.nLevels);
 		}
+	#ifdef __PGFROISUPPORT__
+		InitTileCache();
+	#endif
 
 		// used in Read when PM_Absolute
 		m_percent = pow(0.25, m_header.nLevels);
@@ -196,7 +307,7 @@ void CPGFImage::Open(CPGFStream *stream) THROW_ {
 			// read channel data from stream
 			for (UINT32 i=0; i < size; i++) {
 				int count = DataTSize;
-				stream->Read(&count, &m_channel[c][i]);
+				m_decoder->GetStream()->Read(&count, &m_channel[c][i]);
 				if (count != DataTSize) ReturnWithError(MissingData);
 			}
 		}
@@ -357,7 +468,7 @@ void CPGFImage::Reconstruct(int level /*= 0*/) THROW_ {
 				m_wtChannel[i]->GetSubband(currentLevel, HH)->Dequantize(m_quant);
 
 				// inverse transform from m_wtChannel to m_channel
-				OSError err = m_wtChannel[i]->InverseTransform(currentLevel, &m_width[i], &m_height[i], &m_channel[i]);
+				OSError err = m_wtChannel[i]->InverseTransform(currentLevel, &m_width[i], &m_height[i], &m_channel[i], NumberOfThreads(m_useOMPinEncoder));
 				if (err != NoError) ReturnWithError(err);
 				ASSERT(m_channel[i]);
 			}
@@ -405,54 +516,201 @@ void CPGFImage::Read(int level /*= 0*/, CallbackPtr cb /*= NULL*/, void *data /*
 		double percent = (m_progressMode == PM_Relative) ? pow(0.25, levelDiff) : m_percent;
 
 		// encoding scheme without ROI
-		while (m_currentLevel > level) {
-			for (int i=0; i < m_header.channels; i++) {
-				ASSERT(m_wtChannel[i]);
-				// decode file and write stream to m_wtChannel
-				if (m_currentLevel == m_header.nLevels) { 
-					// last level also has LL band
-					m_wtChannel[i]->GetSubband(m_currentLevel, LL)->PlaceTile(*m_decoder, m_quant);
-				}
-				if (m_preHeader.version & Version5) {
-					// since version 5
-					m_wtChannel[i]->GetSubband(m_currentLevel, HL)->PlaceTile(*m_decoder, m_quant);
-					m_wtChannel[i]->GetSubband(m_currentLevel, LH)->PlaceTile(*m_decoder, m_quant);
+		if (levelDiff > 0) ReadLevels(level, percent, cb, data);
+	}
+
+	// automatically closing
+	if (m_currentLevel == 0) Close();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Decodes all subbands of a given channel and level from the stream and places them in the wavelet transform.
+// With ROI support only the tiles of the current ROI are decoded; all other tiles are skipped.
+// It might throw an IOException.
+// @param i Channel index
+// @param level Level of the subbands
+void CPGFImage::DecodeChannel(int i, int level) THROW_ {
+	ASSERT(m_wtChannel[i]);
+	ASSERT(level > 0 && level <= m_header.nLevels);
+
+	if (level == 1 && level < m_header.nLevels && m_skipFinestDetails) {
+		// fast decoding: the finest detail subbands are the last data of the stream, hence they are 
+		// not decoded, and the stream is not read any further
+		m_wtChannel[i]->GetSubband(level, HL)->PlaceZeros();
+		m_wtChannel[i]->GetSubband(level, LH)->PlaceZeros();
+		m_wtChannel[i]->GetSubband(level, HH)->PlaceZeros();
+		return;
+	}
+
+#ifdef __PGFROISUPPORT__
+	if (ROIisSupported()) {
+		// get number of tiles and tile indices
+		const UINT32 nTiles = m_wtChannel[i]->GetNofTiles(level);
+		const PGFRect& tileIndices = m_wtChannel[i]->GetTileIndices(level);
+
+		// first tile of this channel and level in the tile index
+		UINT32 entry = (m_useTileIndex) ? TileIndexEntry(level, i) : 0;
+
+		// decode file and write stream to m_wtChannel
+		if (level == m_header.nLevels) { // last level also has LL band
+			ASSERT(nTiles == 1);
+			if (m_tileCacheSize && m_wtChannel[i]->LoadTile(level, LL, 0, 0)) {
+				// skip cached tile
+				if (m_useTileIndex) m_seekTile = true;
+				else m_decoder->SkipTileBuffer();
+			} else {
+				if (m_seekTile) SeekTile(level, entry);
+				m_decoder->DecodeTileBuffer();
+				m_wtChannel[i]->GetSubband(level, LL)->PlaceTile(*m_decoder, m_quant);
+				if (m_tileCacheSize) m_wtChannel[i]->StoreTile(level, LL, 0, 0);
+			}
+			entry++;
+		}
+		for (UINT32 tileY=0; tileY < nTiles; tileY++) {
+			for (UINT32 tileX=0; tileX < nTiles; tileX++, entry++) {
+				// check relevance of tile: cached tiles are skipped like irrelevant tiles
+				if (tileIndices.IsInside(tileX, tileY) && !LoadCachedTile(level, i, tileX, tileY)) {
+					if (m_seekTile) SeekTile(level, entry);
+					m_decoder->DecodeTileBuffer();
+					m_wtChannel[i]->GetSubband(level, HL)->PlaceTile(*m_decoder, m_quant, true, tileX, tileY);
+					m_wtChannel[i]->GetSubband(level, LH)->PlaceTile(*m_decoder, m_quant, true, tileX, tileY);
+					m_wtChannel[i]->GetSubband(level, HH)->PlaceTile(*m_decoder, m_quant, true, tileX, tileY);
+					StoreCachedTile(level, i, tileX, tileY);
+				} else if (m_useTileIndex) {
+					// skip tile without reading the stream
+					m_seekTile = true;
 				} else {
-					// until version 4
-					m_decoder->DecodeInterleaved(m_wtChannel[i], m_currentLevel, m_quant);
+					// skip tile
+					m_decoder->SkipTileBuffer();
 				}
-				m_wtChannel[i]->GetSubband(m_currentLevel, HH)->PlaceTile(*m_decoder, m_quant);
 			}
+		}
+		return;
+	}
+#endif
 
-			volatile OSError error = NoError; // volatile prevents optimizations
-			#pragma omp parallel for default(shared) 
-			for (int i=0; i < m_header.channels; i++) {
-				// inverse transform from m_wtChannel to m_channel
-				if (error == NoError) {
-					OSError err = m_wtChannel[i]->InverseTransform(m_currentLevel, &m_width[i], &m_height[i], &m_channel[i]);	
-					if (err != NoError) error = err;
+	// decode file and write stream to m_wtChannel
+	if (level == m_header.nLevels) { 
+		// last level also has LL band
+		m_wtChannel[i]->GetSubband(level, LL)->PlaceTile(*m_decoder, m_quant);
+	}
+	if (m_preHeader.version & Version5) {
+		// since version 5
+		m_wtChannel[i]->GetSubband(level, HL)->PlaceTile(*m_decoder, m_quant);
+		m_wtChannel[i]->GetSubband(level, LH)->PlaceTile(*m_decoder, m_quant);
+	} else {
+		// until version 4
+		m_decoder->DecodeInterleaved(m_wtChannel[i], level, m_quant);
+	}
+	m_wtChannel[i]->GetSubband(level, HH)->PlaceTile(*m_decoder, m_quant);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Decodes and inverse transforms all levels between the current level and the given level.
+// Decoding and inverse transform are pipelined: as soon as the subbands of a channel are placed,
+// its inverse transform runs as a task, while the decoder proceeds with the next channel.
+// The first channel of the next level is decoded ahead while the last inverse transforms of a level are running.
+// The callbacks are called in the calling thread, after all channels of a level have been transformed.
+// It might throw an IOException.
+// @param level The image level of the resulting image in the internal image buffer.
+// @param percent Progress before reading the next level
+// @param cb A pointer to a callback procedure. The procedure is called after reading a single level. If cb returns true, then it stops proceeding.
+// @param data Data Pointer to C++ class container to host callback procedure.
+void CPGFImage::ReadLevels(int level, double percent, CallbackPtr cb, void *data) THROW_ {
+	ASSERT(level >= 0 && level < m_currentLevel);
+	OSError error = NoError;
+	OSError transformError[MaxChannels];
+	const int nThreads = m_decoder->GetNofThreads();
+
+	// the levels are read in sequence, unless tiles are sought with the tile index
+#ifdef __PGFROISUPPORT__
+	if (!m_useTileIndex)
+#endif
+	{
+		UINT64 levelOffset = 0, len = 0;
+
+		for (int l=m_header.nLevels; l > level; l--) {
+			if (l > m_currentLevel) levelOffset += m_levelLength[m_header.nLevels - l];
+			else len += m_levelLength[m_header.nLevels - l];
+		}
+		if (len) m_decoder->WillReadLevels(levelOffset, len);
+	}
+
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	#pragma omp parallel default(shared) num_threads(nThreads) if(nThreads > 1)
+	#pragma omp master
+#endif
+	{
+		try {
+			while (m_currentLevel > level) {
+				const int srcLevel = m_currentLevel;
+
+				for (int i=0; i < m_header.channels; i++) {
+					// decode file and write stream to m_wtChannel, unless the channel has been decoded ahead
+					if (i >= m_decodedChannels) {
+					#ifdef __PGFROISUPPORT__
+						if (UseParallelTiles(srcLevel)) {
+							// the tiles of all channels are decoded at once
+							DecodeTiles(srcLevel);
+							m_decodedChannels = m_header.channels;
+						} else
+					#endif
+						DecodeChannel(i, srcLevel);
+					}
+
+					// inverse transform from m_wtChannel to m_channel
+					transformError[i] = NoError;
+#ifdef LIBPGF_USE_OPENMP_TASKS
+					#pragma omp task default(shared) firstprivate(i, srcLevel)
+#endif
+					transformError[i] = m_wtChannel[i]->InverseTransform(srcLevel, &m_width[i], &m_height[i], &m_channel[i], nThreads);
 				}
-				ASSERT(m_channel[i]);
-			}
-			if (error != NoError) ReturnWithError(error);
+				m_decodedChannels = 0;
+
+				// decode ahead
+				if (srcLevel - 1 > level) {
+				#ifdef __PGFROISUPPORT__
+					if (UseParallelTiles(srcLevel - 1)) {
+						DecodeTiles(srcLevel - 1);
+						m_decodedChannels = m_header.channels;
+					} else
+				#endif
+					{
+						DecodeChannel(0, srcLevel - 1);
+						m_decodedChannels = 1;
+					}
+				}
+#ifdef LIBPGF_USE_OPENMP_TASKS
+				#pragma omp taskwait
+#endif
+				for (int i=0; i < m_header.channels; i++) {
+					if (transformError[i] != NoError) error = transformError[i];
+					ASSERT(m_channel[i]);
+				}
+				if (error != NoError) break;
 
-			// set new level: must be done before refresh callback
-			m_currentLevel--;
+				// set new level: must be done before refresh callback
+				m_currentLevel--;
 
-			// now we have to refresh the display
-			if (m_cb) m_cb(m_cbArg);
+				// now we have to refresh the display
+				if (m_cb) m_cb(m_cbArg);
 
-			// now update progress
-			if (cb) {
-				percent *= 4;
-				if (m_progressMode == PM_Absolute) m_percent = percent;
-				if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
+				// now update progress
+				if (cb) {
+					percent *= 4;
+					if (m_progressMode == PM_Absolute) m_percent = percent;
+					if ((*cb)(percent, true, data)) {
+						error = EscapePressed;
+						break;
+					}
+				}
 			}
+		} catch(IOException& ex) {
+			// exceptions must not leave the parallel region
+			error = ex.error;
 		}
 	}
-
-	// automatically closing
-	if (m_currentLevel == 0) Close();
+	if (error != NoError) ReturnWithError(error);
 }
 
 #ifdef __PGFROISUPPORT__
@@ -485,7 +743,9 @@ void CPGFImage::Read(PGFRect& rect, int level /*= 0*/, CallbackPtr cb /*= NULL*/
 		if (levelDiff <= 0) {
 			// it is a new read call, probably with a new ROI
 			m_currentLevel = m_header.nLevels;
+			m_decodedChannels = 0;
 			m_decoder->SetStreamPosToData();
+			m_seekTile = false;
 		}
 
 		// check rectangle
@@ -495,65 +755,11 @@ void CPGFImage::Read(PGFRect& rect, int level /*= 0*/, CallbackPtr cb /*= NULL*/
 		// enable ROI decoding and reading
 		SetROI(rect);
 
-		while (m_currentLevel > level) {
-			for (int i=0; i < m_header.channels; i++) {
-				ASSERT(m_wtChannel[i]);
-
-				// get number of tiles and tile indices
-				const UINT32 nTiles = m_wtChannel[i]->GetNofTiles(m_currentLevel);
-				const PGFRect& tileIndices = m_wtChannel[i]->GetTileIndices(m_currentLevel);
-
-				// decode file and write stream to m_wtChannel
-				if (m_currentLevel == m_header.nLevels) { // last level also has LL band
-					ASSERT(nTiles == 1);
-					m_decoder->DecodeTileBuffer();
-					m_wtChannel[i]->GetSubband(m_currentLevel, LL)->PlaceTile(*m_decoder, m_quant);
-				}
-				for (UINT32 tileY=0; tileY < nTiles; tileY++) {
-					for (UINT32 tileX=0; tileX < nTiles; tileX++) {
-						// check relevance of tile
-						if (tileIndices.IsInside(tileX, tileY)) {
-							m_decoder->DecodeTileBuffer();
-							m_wtChannel[i]->GetSubband(m_currentLevel, HL)->PlaceTile(*m_decoder, m_quant, true, tileX, tileY);
-							m_wtChannel[i]->GetSubband(m_currentLevel, LH)->PlaceTile(*m_decoder, m_quant, true, tileX, tileY);
-							m_wtChannel[i]->GetSubband(m_currentLevel, HH)->PlaceTile(*m_decoder, m_quant, true, tileX, tileY);
-						} else {
-							// skip tile
-							m_decoder->SkipTileBuffer();
-						}
-					}
-				}
-			}
-
-			volatile OSError error = NoError; // volatile prevents optimizations
-			#pragma omp parallel for default(shared) 
-			for (int i=0; i < m_header.channels; i++) {
-				// inverse transform from m_wtChannel to m_channel
-				if (error == NoError) {
-					OSError err = m_wtChannel[i]->InverseTransform(m_currentLevel, &m_width[i], &m_height[i], &m_channel[i]);
-					if (err != NoError) error = err;
-				}
-				ASSERT(m_channel[i]);
-			}
-			if (error != NoError) ReturnWithError(error);
-
-			// set new level: must be done before refresh callback
-			m_currentLevel--;
-
-			// now we have to refresh the display
-			if (m_cb) m_cb(m_cbArg);
-
-			// now update progress
-			if (cb) {
-				percent *= 4;
-				if (m_progressMode == PM_Absolute) m_percent = percent;
-				if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
-			}
-		}
+		if (m_currentLevel > level) ReadLevels(level, percent, cb, data);
 	}
 
-	// automatically closing
-	if (m_currentLevel == 0) Close();
+	// automatically closing, unless further regions are read with the tile cache
+	if (m_currentLevel == 0 && !m_tileCacheSize) Close();
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -598,8 +804,463 @@ void CPGFImage::SetROI(PGFRect rect) {
 	}
 }
 
+//////////////////////////////////////////////////////////////////////
+// Return the index of the first tile of a channel at a given level in the tile index.
+// The tile index contains the tiles in the order of the encoded stream: higher levels first, 
+// color channels are interleaved, the LL tile of the highest level precedes the other tiles, and tiles are in row-major order.
+// @param level A level in [0, nLevels]: level 0 and channel 0 return the number of all tiles
+// @param i A channel index
+// @return Index of the first tile
+UINT32 CPGFImage::TileIndexEntry(int level, int i) const {
+	ASSERT(level >= 0 && level <= m_header.nLevels);
+	UINT32 entry = 0;
+
+	for (int l=m_header.nLevels; l >= level && l > 0; l--) {
+		const UINT32 nTiles = 1 << (m_header.nLevels - l);
+		const UINT32 channelTiles = nTiles*nTiles + ((l == m_header.nLevels) ? 1 : 0);
+
+		entry += ((l == level) ? i : m_header.channels)*channelTiles;
+	}
+	return entry;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set the stream position to the beginning of an encoded tile found in the tile index.
+// It might throw an IOException.
+// @param level The level of the tile
+// @param entry Index of the tile in the tile index
+void CPGFImage::SeekTile(int level, UINT32 entry) THROW_ {
+	ASSERT(m_useTileIndex);
+	ASSERT(level > 0 && level <= m_header.nLevels);
+	UINT64 levelOffset = 0;
+
+	for (int l=m_header.nLevels; l > level; l--) {
+		levelOffset += m_levelLength[m_header.nLevels - l];
+	}
+	m_decoder->SetStreamPosToTile(entry, levelOffset, m_levelLength[m_header.nLevels - level]);
+	m_seekTile = false;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return true if the tiles of a given level are decoded in parallel.
+// The highest level is always decoded sequentially, and the level lengths must be known to find the beginning of a level.
+// @param level Level of the subbands
+bool CPGFImage::UseParallelTiles(int level) const {
+	ASSERT(m_decoder);
+	if (!m_parallelTiles || !ROIisSupported() || level >= m_header.nLevels || m_decoder->GetNofThreads() < 2) return false;
+	if (level == 1 && m_skipFinestDetails) return false;
+
+	for (int l=0; l < m_header.nLevels; l++) {
+		if (!m_levelLength[l]) return false;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Decodes the needed tiles of all channels of a given level in parallel and places them in the wavelet transform.
+// The block headers of the level are scanned to find the extents of the needed tiles (unneeded tiles are sought over 
+// with the tile index if available), then the encoded tiles are read into one buffer and decoded concurrently.
+// It might throw an IOException.
+// @param level Level of the subbands
+void CPGFImage::DecodeTiles(int level) THROW_ {
+	ASSERT(UseParallelTiles(level));
+
+	struct EncodedTile {
+		int channel;		// channel index
+		UINT32 tileX;		// tile index in x-direction
+		UINT32 tileY;		// tile index in y-direction
+		UINT64 pos;			// stream position of the first block
+		UINT32 offset;		// position in the tile buffer
+		UINT32 len;			// encoded length in bytes
+		OSError error;		// decoding error
+	};
+	const UINT32 nTiles = m_wtChannel[0]->GetNofTiles(level);
+	EncodedTile* tiles = new(std::nothrow) EncodedTile[m_header.channels*nTiles*nTiles];
+	if (!tiles) ReturnWithError(InsufficientMemory);
+	UINT8* buffer = NULL;
+	UINT32 bufferLen = 0;
+	int n = 0;
+	OSError error = NoError;
+
+	try {
+		// macro blocks might have been read ahead, hence the stream position is set to the beginning of the level
+		UINT64 levelOffset = 0;
+		for (int l=m_header.nLevels; l > level; l--) {
+			levelOffset += m_levelLength[m_header.nLevels - l];
+		}
+		m_decoder->SetStreamPosToData();
+		m_decoder->Skip(levelOffset);
+		m_seekTile = false;
+
+		// find extents of needed tiles
+		for (int i=0; i < m_header.channels; i++) {
+			const PGFRect& tileIndices = m_wtChannel[i]->GetTileIndices(level);
+			UINT32 entry = (m_useTileIndex) ? TileIndexEntry(level, i) : 0;
+
+			for (UINT32 tileY=0; tileY < nTiles; tileY++) {
+				for (UINT32 tileX=0; tileX < nTiles; tileX++, entry++) {
+					if (tileIndices.IsInside(tileX, tileY) && !LoadCachedTile(level, i, tileX, tileY)) {
+						if (m_seekTile) SeekTile(level, entry);
+						EncodedTile& tile = tiles[n++];
+						tile.channel = i;
+						tile.tileX = tileX;
+						tile.tileY = tileY;
+						tile.pos = m_decoder->GetStream()->GetPos();
+						m_decoder->SkipTile();
+						tile.len = UINT32(m_decoder->GetStream()->GetPos() - tile.pos);
+						tile.offset = bufferLen;
+						tile.error = NoError;
+						bufferLen += tile.len;
+					} else if (m_useTileIndex) {
+						m_seekTile = true;
+					} else {
+						m_decoder->SkipTile();
+					}
+				}
+			}
+		}
+
+		// read encoded tiles: adjacent tiles are read at once
+		buffer = new(std::nothrow) UINT8[bufferLen];
+		if (!buffer) ReturnWithError(InsufficientMemory);
+		for (int t=0; t < n; ) {
+			int u = t + 1;
+			while (u < n && tiles[u].pos == tiles[u - 1].pos + tiles[u - 1].len) u++;
+			const UINT32 len = tiles[u - 1].offset + tiles[u - 1].len - tiles[t].offset;
+
+			m_decoder->SetStreamPos(tiles[t].pos);
+			if (m_decoder->ReadEncodedData(buffer + tiles[t].offset, len) != len) ReturnWithError(MissingData);
+			t = u;
+		}
+
+		// tiles of the same subband are placed concurrently, hence the subbands are allocated beforehand
+		for (int i=0; i < m_header.channels; i++) {
+			if (!m_wtChannel[i]->GetSubband(level, HL)->AllocMemory() ||
+				!m_wtChannel[i]->GetSubband(level, LH)->AllocMemory() ||
+				!m_wtChannel[i]->GetSubband(level, HH)->AllocMemory()) ReturnWithError(InsufficientMemory);
+		}
+
+		// decode tiles in parallel
+	#ifdef LIBPGF_USE_OPENMP_TASKS
+		if (omp_in_parallel()) {
+			for (int t=0; t < n; t++) {
+				#pragma omp task default(shared) firstprivate(t)
+				tiles[t].error = DecodeTile(level, tiles[t].channel, tiles[t].tileX, tiles[t].tileY, buffer + tiles[t].offset, tiles[t].len);
+			}
+			#pragma omp taskwait
+		} else
+	#endif
+		{
+			#pragma omp parallel for default(shared) num_threads(m_decoder->GetNofThreads()) schedule(dynamic)
+			for (int t=0; t < n; t++) {
+				tiles[t].error = DecodeTile(level, tiles[t].channel, tiles[t].tileX, tiles[t].tileY, buffer + tiles[t].offset, tiles[t].len);
+			}
+		}
+		for (int t=0; t < n; t++) {
+			if (tiles[t].error != NoError) error = tiles[t].error;
+			else StoreCachedTile(level, tiles[t].channel, tiles[t].tileX, tiles[t].tileY);
+		}
+	} catch(IOException& ex) {
+		error = ex.error;
+	}
+	delete[] buffer;
+	delete[] tiles;
+	if (error != NoError) ReturnWithError(error);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Decodes an encoded tile with its own decoder and places it in the HL, LH, and HH subbands.
+// Several tiles can be decoded concurrently, if their subbands have already been allocated.
+// @param level Level of the subbands
+// @param i Channel index
+// @param tileX Tile index in x-direction
+// @param tileY Tile index in y-direction
+// @param encodedTile Buffer containing all blocks of the encoded tile
+// @param len Length of the encoded tile in bytes
+// @return Error code
+OSError CPGFImage::DecodeTile(int level, int i, UINT32 tileX, UINT32 tileY, UINT8* encodedTile, UINT32 len) {
+	try {
+		CPGFMemoryStream stream(encodedTile, len);
+		CDecoder decoder(&stream);
+		decoder.SetMaxPlanes(m_maxDecodedPlanes);
+
+		decoder.DecodeTileBuffer();
+		m_wtChannel[i]->GetSubband(level, HL)->PlaceTile(decoder, m_quant, true, tileX, tileY);
+		m_wtChannel[i]->GetSubband(level, LH)->PlaceTile(decoder, m_quant, true, tileX, tileY);
+		m_wtChannel[i]->GetSubband(level, HH)->PlaceTile(decoder, m_quant, true, tileX, tileY);
+	} catch(IOException& ex) {
+		return ex.error;
+	}
+	return NoError;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Distributes the memory budget of the tile cache among the channels in proportion to their sizes.
+void CPGFImage::InitTileCache() {
+	double size = 0;
+
+	for (int i=0; i < m_header.channels; i++) {
+		size += double(m_width[i])*m_height[i];
+	}
+	for (int i=0; i < m_header.channels; i++) {
+		if (m_wtChannel[i]) m_wtChannel[i]->SetTileCacheSize(UINT64(m_tileCacheSize*(double(m_width[i])*m_height[i]/size)));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Places a cached tile in the HL, LH, and HH subbands.
+// @param level Level of the subbands
+// @param i Channel index
+// @param tileX Tile index in x-direction
+// @param tileY Tile index in y-direction
+// @return true if the tile has been cached in all three subbands
+bool CPGFImage::LoadCachedTile(int level, int i, UINT32 tileX, UINT32 tileY) {
+	return m_tileCacheSize 
+		&& m_wtChannel[i]->LoadTile(level, HL, tileX, tileY)
+		&& m_wtChannel[i]->LoadTile(level, LH, tileX, tileY)
+		&& m_wtChannel[i]->LoadTile(level, HH, tileX, tileY);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Stores a decoded tile of the HL, LH, and HH subbands in the tile cache.
+// @param level Level of the subbands
+// @param i Channel index
+// @param tileX Tile index in x-direction
+// @param tileY Tile index in y-direction
+void CPGFImage::StoreCachedTile(int level, int i, UINT32 tileX, UINT32 tileY) {
+	if (m_tileCacheSize) {
+		m_wtChannel[i]->StoreTile(level, HL, tileX, tileY);
+		m_wtChannel[i]->StoreTile(level, LH, tileX, tileY);
+		m_wtChannel[i]->StoreTile(level, HH, tileX, tileY);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Read and decode a PGF image at given level and pass it row by row to a scanline sink.
+/// The rows are passed from top to bottom. They are already converted in the same way as in GetBitmap(...).
+/// Images using the ROI encoding scheme are inverse transformed row by row: only a few rows of each level 
+/// and the currently needed tile rows are held in memory, hence the image is never completely buffered.
+/// Other images are completely decoded with Read(...), but the bitmap is not buffered.
+/// Afterwards, the image can be read again with Read(...).
+/// Precondition: The PGF image has been opened with a call of Open(...).
+/// It might throw an IOException.
+/// @param level [0, nLevels) The image level of the resulting rows.
+/// @param bpp The number of bits per pixel used in the rows.
+/// @param channelMap A integer array containing the mapping of PGF channel ordering to expected channel ordering.
+/// @param sink A pointer to a scanline procedure. It receives each row and its row index. The row is only valid during the call. If sink returns true, then it stops proceeding.
+/// @param data Data Pointer to C++ class container to host the scanline procedure.
+void CPGFImage::ReadScanlines(int level, BYTE bpp, int channelMap[], ScanlineCB sink, void *data /*= NULL*/) THROW_ {
+	ASSERT((level >= 0 && level < m_header.nLevels) || m_header.nLevels == 0); // m_header.nLevels == 0: image didn't use wavelet transform
+	ASSERT(m_decoder);
+	ASSERT(sink);
+
+	const bool lineBased = m_header.nLevels > 0 && ROIisSupported();
+	DataT* channel[MaxChannels];
+	UINT32 w, h;
+
+	if (lineBased) {
+		w = m_wtChannel[0]->GetSubband(level, LL)->GetWidth();
+		h = m_wtChannel[0]->GetSubband(level, LL)->GetHeight();
+
+		// a following Read starts again at the highest level
+		m_currentLevel = m_header.nLevels;
+		m_decodedChannels = 0;
+
+		// enable ROI decoding
+		m_decoder->SetROI();
+		for (int i=0; i < m_header.channels; i++) {
+			ASSERT(m_wtChannel[i]);
+			OSError err = m_wtChannel[i]->InitInverseLineTransform(level, m_quant);
+			if (err != NoError) ReturnWithError(err);
+		}
+
+		// collect stream positions of all needed tile rows: higher levels first, color channels are interleaved
+		m_decoder->SetStreamPosToData();
+		m_seekTile = false;
+		for (int l=m_header.nLevels; l > level; l--) {
+			for (int i=0; i < m_header.channels; i++) {
+				const UINT32 nTiles = m_wtChannel[i]->GetNofTiles(l);
+
+				for (UINT32 tileY=0; tileY < nTiles; tileY++) {
+					if (m_useTileIndex) {
+						// a tile row starts with its first tile, the only tile row of the highest level with the LL tile
+						SeekTile(l, TileIndexEntry(l, i) + tileY*nTiles);
+						m_wtChannel[i]->SetTileRowPos(l, tileY, m_decoder->GetStream()->GetPos());
+						continue;
+					}
+					m_wtChannel[i]->SetTileRowPos(l, tileY, m_decoder->GetStream()->GetPos());
+					if (l == m_header.nLevels) {
+						// last level also has LL band
+						m_decoder->SkipTile();
+					}
+					for (UINT32 tileX=0; tileX < nTiles; tileX++) {
+						m_decoder->SkipTile();
+					}
+				}
+			}
+		}
+	} else {
+		// the whole image is decoded, only the color transform is done row by row
+		Read(level);
+		w = m_width[0];
+		h = m_height[0];
+		for (int i=0; i < m_header.channels; i++) {
+			channel[i] = m_channel[i];
+		}
+	}
+
+	// two rows are converted at once: downsampled channels contain one row for both
+	const int pitch = AlignWordPos(w*bpp)/8;
+	UINT8* rows = new(std::nothrow) UINT8[2*pitch];
+	DataT* lines = (lineBased) ? new(std::nothrow) DataT[2*w*m_header.channels] : NULL;
+	if (!rows || (lineBased && !lines)) {
+		delete[] rows; delete[] lines;
+		ReturnWithError(InsufficientMemory);
+	}
+
+	try {
+		for (UINT32 y=0; y < h; y += 2) {
+			const UINT32 nRows = __min(2, h - y);
+
+			if (lineBased) {
+				for (int i=0; i < m_header.channels; i++) {
+					channel[i] = lines + 2*w*i;
+					if (m_downsample && i > 0) {
+						memcpy(channel[i], m_wtChannel[i]->InverseLine(level, *m_decoder), m_wtChannel[i]->GetSubband(level, LL)->GetWidth()*DataTSize);
+					} else {
+						for (UINT32 r=0; r < nRows; r++) {
+							memcpy(channel[i] + r*w, m_wtChannel[i]->InverseLine(level, *m_decoder), w*DataTSize);
+						}
+					}
+				}
+			}
+
+			YuvToRgb(channel, w, nRows, pitch, rows, bpp, channelMap, NULL, NULL);
+
+			for (UINT32 r=0; r < nRows; r++) {
+				if ((*sink)(rows + r*pitch, y + r, data)) ReturnWithError(EscapePressed);
+			}
+
+			if (!lineBased) {
+				for (int i=0; i < m_header.channels; i++) {
+					channel[i] += (m_downsample && i > 0) ? m_width[i] : 2*m_width[i];
+				}
+			}
+		}
+	} catch(IOException& ex) {
+		delete[] rows; delete[] lines;
+		if (lineBased && m_decoder) m_decoder->SetStreamPosToData();
+		throw ex;
+	}
+	delete[] rows; delete[] lines;
+
+	if (lineBased) {
+		for (int i=0; i < m_header.channels; i++) {
+			m_wtChannel[i]->FreeLineTransform();
+		}
+		m_decoder->SetStreamPosToData();
+	}
+}
+
 #endif // __PGFROISUPPORT__
 
+//////////////////////////////////////////////////////////////////////
+/// Read and decode all levels of a PGF image in one pass and cut each level into square tiles, e.g., for a web tile server.
+/// The levels are passed from the smallest level to level 0. Each level is inverse transformed from the previous level,
+/// hence the image is decoded only once and the levels are not resampled. The tiles of a level are passed row by row; 
+/// the tiles in the last column and row might be smaller. They are converted in the same way as in GetBitmap(...).
+/// In parallel mode the tile rows of a level are converted concurrently and the sink has to be thread-safe.
+/// Afterwards, the image is closed as after Read(0).
+/// Precondition: The PGF image has been opened with a call of Open(...), but not yet been read.
+/// It might throw an IOException.
+/// @param tileSize The width and height of a tile in pixels. It must be even and tileSize*bpp must be a multiple of 8.
+/// @param bpp The number of bits per pixel used in the tiles.
+/// @param channelMap A integer array containing the mapping of PGF channel ordering to expected channel ordering.
+/// @param sink A pointer to a tile procedure. It receives each tile with its pitch, size, level, and tile indices. The tile is only valid during the call. If sink returns true, then it stops proceeding (in parallel mode after the current tile rows).
+/// @param data Data Pointer to C++ class container to host the tile procedure.
+/// @param parallel Convert and pass the tile rows of a level in parallel.
+void CPGFImage::ExportTiles(UINT32 tileSize, BYTE bpp, int channelMap[], TileCB sink, void *data /*= NULL*/, bool parallel /*= false*/) THROW_ {
+	ASSERT(m_decoder);
+	ASSERT(m_currentLevel == m_header.nLevels || (m_header.nLevels > 0 && ROIisSupported()));
+	ASSERT(tileSize > 0 && tileSize%2 == 0 && (tileSize*bpp)%8 == 0);
+	ASSERT(sink);
+
+	const int nThreads = NumberOfThreads(m_useOMPinDecoder && parallel);
+
+	for (int level = __max(1, Levels()) - 1; level >= 0; level--) {
+		// decoding continues at the previously read level, hence each level is inverse transformed only once
+		Read(level);
+
+		const int nTileRows = (m_height[0] + tileSize - 1)/tileSize;
+		OSError error = NoError;
+
+		if (nThreads > 1) {
+			#pragma omp parallel for default(shared) num_threads(nThreads) schedule(dynamic)
+			for (int tileY=0; tileY < nTileRows; tileY++) {
+				OSError err;
+				#pragma omp critical
+				err = error;
+
+				if (err == NoError) {
+					err = ExportTileRow(level, tileY, tileSize, bpp, channelMap, sink, data);
+					if (err != NoError) {
+						#pragma omp critical
+						error = err;
+					}
+				}
+			}
+		} else {
+			for (int tileY=0; tileY < nTileRows && error == NoError; tileY++) {
+				error = ExportTileRow(level, tileY, tileSize, bpp, channelMap, sink, data);
+			}
+		}
+		if (error != NoError) ReturnWithError(error);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Converts a row of tiles of the current level into a temporary strip and passes its tiles to a tile sink.
+// Several tile rows can be exported concurrently.
+// @param level The current level
+// @param tileY Tile index in y-direction
+// @param tileSize The width and height of a tile in pixels
+// @param bpp The number of bits per pixel used in the tiles.
+// @param channelMap A integer array containing the mapping of PGF channel ordering to expected channel ordering.
+// @param sink A pointer to a tile procedure
+// @param data Data Pointer to C++ class container to host the tile procedure.
+// @return Error code: EscapePressed if the sink has stopped proceeding
+OSError CPGFImage::ExportTileRow(int level, UINT32 tileY, UINT32 tileSize, BYTE bpp, int channelMap[], TileCB sink, void *data) const {
+	const UINT32 w = m_width[0];
+	const UINT32 top = tileY*tileSize;
+	const UINT32 h = __min(tileSize, m_height[0] - top);
+	const int pitch = AlignWordPos(w*bpp)/8;
+	DataT* channel[MaxChannels];
+	OSError error = NoError;
+
+	UINT8* strip = new(std::nothrow) UINT8[pitch*h];
+	if (!strip) return InsufficientMemory;
+
+	for (int i=0; i < m_header.channels; i++) {
+		// downsampled channels contain one row for two rows of the strip
+		channel[i] = m_channel[i] + ((m_downsample && i > 0) ? top/2 : top)*m_width[i];
+	}
+
+	try {
+		YuvToRgb(channel, w, h, pitch, strip, bpp, channelMap, NULL, NULL);
+
+		for (UINT32 x=0, tileX=0; x < w; x += tileSize, tileX++) {
+			if ((*sink)(strip + x*bpp/8, pitch, __min(tileSize, w - x), h, level, tileX, tileY, data)) {
+				error = EscapePressed;
+				break;
+			}
+		}
+	} catch(IOException& ex) {
+		error = ex.error;
+	}
+	delete[] strip;
+	return error;
+}
+
 //////////////////////////////////////////////////////////////////////
 /// Return the length of all encoded headers in bytes.
 /// Precondition: The PGF image has been opened with a call of Open(...).
@@ -677,6 +1338,200 @@ UINT32 CPGFImage::ReadEncodedData(int level, UINT8* target, UINT32 targetLen) co
 	return len;
 }
 
+//////////////////////////////////////////////////////////////////////
+/// Write a new PGF image at current stream position containing only the levels >= level of this PGF image.
+/// The encoded levels are copied without decoding.
+/// Precondition: The PGF image has been opened with a call of Open(...).
+/// It might throw an IOException.
+/// @param stream A PGF stream
+/// @param level The finest level of the new image, in [0, Levels())
+/// @param nWrittenBytes [out] The number of bytes written into stream, or NULL
+void CPGFImage::ExtractLevels(CPGFStream* stream, int level, UINT32* nWrittenBytes /*= NULL*/) const THROW_ {
+	ASSERT(stream);
+	ASSERT(m_decoder);
+	ASSERT(level >= 0 && level < m_header.nLevels);
+
+	// level lengths are stored since version 2
+	if (!m_preHeader.version || m_preHeader.hSize < HeaderSize) ReturnWithError(FormatCannotRead);
+
+	// the quantization parameters of the subbands depend on their levels: 
+	// decreasing all levels and the quantization value by level results in the same dequantization
+	const int quant = __max(0, m_quant - level);
+	const int quality = (m_downsample) ? quant + 1 : quant;
+
+	// downsampled chrominance channels are only recognized by a quality larger than DownsampleThreshold
+	if (m_downsample && quality <= DownsampleThreshold) ReturnWithError(FormatCannotRead);
+
+	// the encoded levels are stored from the coarsest to the finest level: 
+	// the levels of the new image and their level lengths are a prefix of the levels and level lengths of this image
+	const int nLevels = m_header.nLevels - level;
+	const UINT32 headerLen = GetEncodedHeaderLength();
+	const UINT32 buffLen = __max(headerLen, CopyBufferLen);
+	UINT64 dataLen = 0;
+	for (int i=0; i < nLevels; i++) {
+		dataLen += m_levelLength[i];
+	}
+
+	UINT8* buff = new(std::nothrow) UINT8[buffLen];
+	if (!buff) ReturnWithError(InsufficientMemory);
+
+	const UINT64 startPos = stream->GetPos();
+	OSError error = NoError;
+
+	try {
+		// read all headers including level lengths
+		if (ReadEncodedHeader(buff, headerLen) != headerLen) ReturnWithError(MissingData);
+
+		// rewrite header: the header follows magic, version, and header size (16 bits until version 5)
+		PGFHeader header;
+		UINT8* headerPtr = buff + MagicVersionSize + ((m_preHeader.version & Version6) ? 4 : 2);
+		memcpy(&header, headerPtr, HeaderSize);
+		header.width = __VAL(Width(level));
+		header.height = __VAL(Height(level));
+		header.nLevels = (UINT8)nLevels;
+		header.quality = (UINT8)quality;
+		memcpy(headerPtr, &header, HeaderSize);
+
+		// the tile index isn't copied
+		((PGFMagicVersion*)buff)->version &= ~PGFTileIndex;
+
+		// write headers and the first nLevels level lengths
+		int count = headerLen - level*WordBytes;
+		stream->Write(&count, buff);
+
+		// copy encoded levels
+		m_decoder->SetStreamPosToData();
+		while (dataLen > 0) {
+			const UINT32 len = (UINT32)__min(dataLen, (UINT64)buffLen);
+			if (m_decoder->ReadEncodedData(buff, len) != len) ReturnWithError(MissingData);
+			count = len;
+			stream->Write(&count, buff);
+			dataLen -= len;
+		}
+	} catch(IOException& ex) {
+		error = ex.error;
+	}
+
+	delete[] buff;
+	if (error != NoError) ReturnWithError(error);
+
+	if (nWrittenBytes) *nWrittenBytes = (UINT32)(stream->GetPos() - startPos);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Recompress this PGF image with another quality and write it at current stream position.
+// Each level is decoded into dequantized wavelet coefficients, which are requantized and encoded, 
+// before the next level is decoded. The subbands of a level are deleted after encoding.
+// Afterwards, the PGF image is closed.
+// It might throw an IOException.
+// @param stream A PGF stream
+// @param quality The quality of the new image
+// @param nWrittenBytes [out] The number of bytes written into stream, or NULL
+// @param cb A pointer to a callback procedure. The procedure is called after writing a single level. If cb returns true, then it stops proceeding.
+// @param data Data Pointer to C++ class container to host callback procedure.
+// @return The quality of the new image
+BYTE CPGFImage::Recompress(CPGFStream* stream, BYTE quality, UINT32* nWrittenBytes /*= NULL*/, CallbackPtr cb /*= NULL*/, void *data /*= NULL*/) THROW_ {
+	ASSERT(stream);
+	ASSERT(m_decoder);
+
+	// user data are copied into the new image
+	if (m_postHeader.userDataLen && !m_postHeader.userData) ReturnWithError2(MissingData, m_header.quality);
+
+	const UINT64 startPos = stream->GetPos();
+	const BYTE srcQuant = m_quant;
+
+	if (m_header.nLevels > 0) {
+		// decode all levels from the beginning
+		m_currentLevel = m_header.nLevels;
+		m_decodedChannels = 0;
+		m_decoder->SetStreamPosToData();
+
+	#ifdef __PGFROISUPPORT__
+		m_seekTile = false;
+		if (ROIisSupported()) {
+			// all tiles are decoded and encoded
+			SetROI(PGFRect(0, 0, m_header.width, m_header.height));
+		}
+	#endif
+	}
+
+	// the new image uses the current coding scheme
+	m_preHeader.version = PGFVersion | (m_preHeader.version & (PGFROI | PGFTileIndex));
+	SetQuality(CorrectQuality(quality));
+	const BYTE quant = m_quant;
+
+	// write headers
+	CreateEncoder(stream);
+
+	if (m_header.nLevels == 0) {
+		// very small image: the channels have been read in Open
+		WriteImage(stream, cb, data);
+	} else {
+		double percent = pow(0.25, m_header.nLevels);
+		OSError error = NoError;
+
+		// update post-header size, rewrite pre-header, and write dummy levelLength
+		UpdatePostHeaderSize();
+
+		// macro blocks are decoded and encoded by tasks
+#ifdef LIBPGF_USE_OPENMP_TASKS
+		const int nThreads = m_encoder->GetNofThreads();
+		#pragma omp parallel default(shared) num_threads(nThreads) if(nThreads > 1)
+		#pragma omp master
+#endif
+		{
+			try {
+				while (m_currentLevel > 0) {
+					const int level = m_currentLevel;
+
+					// decode and dequantize the subbands of all channels with the current quantization
+					m_quant = srcQuant;
+					for (int i=0; i < m_header.channels; i++) {
+						DecodeChannel(i, level);
+					}
+
+					// requantize and encode the subbands with the new quantization
+					m_quant = quant;
+					WriteLevel(); // decrements m_currentLevel
+
+					// the encoder has copied all subbands of this level into its macro blocks
+					for (int i=0; i < m_header.channels; i++) {
+						if (level == m_header.nLevels) m_wtChannel[i]->GetSubband(level, LL)->FreeMemory();
+						m_wtChannel[i]->GetSubband(level, HL)->FreeMemory();
+						m_wtChannel[i]->GetSubband(level, LH)->FreeMemory();
+						m_wtChannel[i]->GetSubband(level, HH)->FreeMemory();
+					}
+
+					// now update progress
+					if (cb) {
+						percent *= 4;
+						if ((*cb)(percent, true, data)) {
+							error = EscapePressed;
+							break;
+						}
+					}
+				}
+
+				// flush encoder
+				if (error == NoError) m_encoder->Flush();
+			} catch(IOException& ex) {
+				// exceptions must not leave the parallel region
+				error = ex.error;
+			}
+		}
+		m_quant = quant;
+		if (error != NoError) ReturnWithError2(error, m_header.quality);
+
+		// update level lengths
+		m_encoder->UpdateLevelLength();
+		delete m_encoder; m_encoder = NULL;
+	}
+	Close();
+
+	if (nWrittenBytes) *nWrittenBytes = (UINT32)(stream->GetPos() - startPos);
+	return m_header.quality;
+}
+
 //////////////////////////////////////////////////////////////////////
 /// Set maximum intensity value for image modes with more than eight bits per channel.
 /// Call this method after SetHeader, but before ImportBitmap.
@@ -739,7 +1594,7 @@ void CPGFImage::ImportBitmap(int pitch, UINT8 *buff, BYTE bpp, int channelMap[]
 	ASSERT(m_channel[0]);
 
 	// color transform
-	RgbToYuv(pitch, buff, bpp, channelMap, cb, data);
+	RgbToYuv(pitch, buff, bpp, channelMap, m_header.height, cb, data);
 
 	if (m_downsample) {
 		// Subsampling of the chrominance and alpha channels
@@ -836,6 +1691,21 @@ void CPGFImage::ComputeLevels() {
 /// @param userData A user-defined memory block containing any kind of cached metadata.
 /// @param userDataLength The size of user-defined memory block in bytes
 void CPGFImage::SetHeader(const PGFHeader& header, BYTE flags /*=0*/, UINT8* userData /*= 0*/, UINT32 userDataLength /*= 0*/) THROW_ {
+	// set header
+	InitHeader(header, flags, userData, userDataLength);
+
+	// allocate channels
+	AllocChannels();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set PGF header and user data without allocating channels.
+// It might throw an IOException.
+// @param header A valid and already filled in PGF header structure
+// @param flags A combination of additional version flags
+// @param userData A user-defined memory block containing any kind of cached metadata.
+// @param userDataLength The size of user-defined memory block in bytes
+void CPGFImage::InitHeader(const PGFHeader& header, BYTE flags, UINT8* userData, UINT32 userDataLength) THROW_ {
 	ASSERT(!m_decoder);	// current image must be closed
 	ASSERT(header.quality <= MaxQuality);
 
@@ -844,6 +1714,9 @@ void CPGFImage::SetHeader(const PGFHeader& header, BYTE flags /*=0*/, UINT8* use
 	m_streamReinitialized = false;
 #endif
 
+	// the tile index requires the ROI encoding scheme
+	if (flags & PGFTileIndex) flags |= PGFROI;
+
 	// init preHeader
 	memcpy(m_preHeader.magic, Magic, 3);
 	m_preHeader.version = PGFVersion | flags;
@@ -859,13 +1732,7 @@ void CPGFImage::SetHeader(const PGFHeader& header, BYTE flags /*=0*/, UINT8* use
 	ComputeLevels();
 
 	// check for downsample
-	if (m_header.quality > DownsampleThreshold &&  (m_header.mode == ImageModeRGBColor || 
-													m_header.mode == ImageModeRGBA || 
-													m_header.mode == ImageModeRGB48 || 
-													m_header.mode == ImageModeCMYKColor || 
-													m_header.mode == ImageModeCMYK64 || 
-													m_header.mode == ImageModeLabColor || 
-													m_header.mode == ImageModeLab48)) {
+	if (m_header.quality > DownsampleThreshold && DownsampleSupported()) {
 		m_downsample = true;
 		m_quant = m_header.quality - 1;
 	} else {
@@ -886,8 +1753,24 @@ void CPGFImage::SetHeader(const PGFHeader& header, BYTE flags /*=0*/, UINT8* use
 		// update header size
 		m_preHeader.hSize += userDataLength;
 	}
+}
 
-	// allocate channels
+//////////////////////////////////////////////////////////////////////
+// Returns true if the chrominance channels of the current image mode are downsampled at qualities above DownsampleThreshold.
+bool CPGFImage::DownsampleSupported() const {
+	return m_header.mode == ImageModeRGBColor || 
+		   m_header.mode == ImageModeRGBA || 
+		   m_header.mode == ImageModeRGB48 || 
+		   m_header.mode == ImageModeCMYKColor || 
+		   m_header.mode == ImageModeCMYK64 || 
+		   m_header.mode == ImageModeLabColor || 
+		   m_header.mode == ImageModeLab48;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Allocate channels of the whole image size.
+// It might throw an IOException.
+void CPGFImage::AllocChannels() THROW_ {
 	for (int i=0; i < m_header.channels; i++) {
 		// set current width and height
 		m_width[i] = m_header.width;
@@ -919,60 +1802,78 @@ UINT32 CPGFImage::WriteHeader(CPGFStream* stream) THROW_ {
 	ASSERT(m_header.quality <= MaxQuality); // quality is already initialized
 
 	if (m_header.nLevels > 0) {
-		volatile OSError error = NoError; // volatile prevents optimizations
-		// create new wt channels
-		#pragma omp parallel for default(shared)
-		for (int i=0; i < m_header.channels; i++) {
-			DataT *temp = NULL;
-			if (error == NoError) {
-				if (m_wtChannel[i]) {
-					ASSERT(m_channel[i]);
-					// copy m_channel to temp
-					int size = m_height[i]*m_width[i];
-					temp = new(std::nothrow) DataT[size];
-					if (temp) {
-						memcpy(temp, m_channel[i], size*DataTSize);
-						delete m_wtChannel[i];	// also deletes m_channel
-					} else {
-						error = InsufficientMemory;
-					}
+		// create new wt channels and compute the wavelet subband decomposition
+		TransformChannels();
+		m_currentLevel = m_header.nLevels;
+	}
+
+	// create encoder and eventually write headers and levelLength
+	return CreateEncoder(stream);
+}
+
+//////////////////////////////////////////////////////////////////
+// Create wavelet transform channels and compute the forward transform of all levels.
+// The forward transform of a channel is parallelized in horizontal bands, hence the number of threads depends on the image size.
+// The wavelet coefficients are not quantized: quantization is done during encoding, hence 
+// the transformed image can be encoded with several qualities.
+// It might throw an IOException.
+void CPGFImage::TransformChannels() THROW_ {
+	ASSERT(m_header.nLevels > 0);
+	OSError error = NoError;
+
+	for (int i=0; i < m_header.channels; i++) {
+		DataT *temp = NULL;
+		if (error == NoError) {
+			if (m_wtChannel[i]) {
+				ASSERT(m_channel[i]);
+				// copy m_channel to temp
+				int size = m_height[i]*m_width[i];
+				temp = new(std::nothrow) DataT[size];
+				if (temp) {
+					memcpy(temp, m_channel[i], size*DataTSize);
+					delete m_wtChannel[i];	// also deletes m_channel
+				} else {
+					error = InsufficientMemory;
 				}
-				if (error == NoError) {
-					if (temp) m_channel[i] = temp;
-					m_wtChannel[i] = new CWaveletTransform(m_width[i], m_height[i], m_header.nLevels, m_channel[i]);
-				#ifdef __PGFROISUPPORT__
-					m_wtChannel[i]->SetROI(PGFRect(0, 0, m_header.width, m_header.height));
-				#endif
-					
-					// wavelet subband decomposition 
-					for (int l=0; error == NoError && l < m_header.nLevels; l++) {
-						OSError err = m_wtChannel[i]->ForwardTransform(l, m_quant);
-						if (err != NoError) error = err;
-					}
+			}
+			if (error == NoError) {
+				if (temp) m_channel[i] = temp;
+				m_wtChannel[i] = new CWaveletTransform(m_width[i], m_height[i], m_header.nLevels, m_channel[i]);
+			#ifdef __PGFROISUPPORT__
+				m_wtChannel[i]->SetROI(PGFRect(0, 0, m_header.width, m_header.height));
+			#endif
+				
+				// wavelet subband decomposition 
+				for (int l=0; error == NoError && l < m_header.nLevels; l++) {
+					OSError err = m_wtChannel[i]->ForwardTransform(l, 0, NumberOfThreads(m_useOMPinEncoder));
+					if (err != NoError) error = err;
 				}
 			}
 		}
-		if (error != NoError) ReturnWithError(error);
+	}
+	if (error != NoError) ReturnWithError(error);
+}
 
-		m_currentLevel = m_header.nLevels;
+//////////////////////////////////////////////////////////////////
+// Create encoder and write headers at current stream position.
+// It might throw an IOException.
+// @param stream A PGF stream
+// @return The number of bytes written into stream.
+UINT32 CPGFImage::CreateEncoder(CPGFStream* stream) THROW_ {
+	m_encoder = new CEncoder(stream, m_preHeader, m_header, m_postHeader, m_userDataPos, NumberOfThreads(m_useOMPinEncoder));
 
-		// create encoder and eventually write headers and levelLength
-		m_encoder = new CEncoder(stream, m_preHeader, m_header, m_postHeader, m_userDataPos, m_useOMPinEncoder);
+	if (m_header.nLevels > 0) {
 		if (m_favorSpeedOverSize) m_encoder->FavorSpeedOverSize();
 
 	#ifdef __PGFROISUPPORT__
 		if (ROIisSupported()) {
 			// new encoding scheme supporting ROI
 			m_encoder->SetROI();
+			if (m_preHeader.version & PGFTileIndex) m_encoder->SetTileIndex(TileIndexEntry(0, 0));
 		}
 	#endif
-
-	} else {
-		// very small image: we don't use DWT and encoding
-
-		// create encoder and eventually write headers and levelLength
-		m_encoder = new CEncoder(stream, m_preHeader, m_header, m_postHeader, m_userDataPos, m_useOMPinEncoder);
 	}
+	// else very small image: we don't use DWT and encoding
 
 	INT64 nBytes = m_encoder->ComputeHeaderLength();
 	return (nBytes > 0) ? (UINT32)nBytes : 0;
@@ -1003,14 +1904,14 @@ void CPGFImage::WriteLevel() THROW_ {
 			if (m_currentLevel == m_header.nLevels) {
 				// last level also has LL band
 				ASSERT(nTiles == 1);
-				m_wtChannel[i]->GetSubband(m_currentLevel, LL)->ExtractTile(*m_encoder);
+				m_wtChannel[i]->GetSubband(m_currentLevel, LL)->ExtractTile(*m_encoder, m_quant);
 				m_encoder->EncodeTileBuffer();
 			}
 			for (UINT32 tileY=0; tileY < nTiles; tileY++) {
 				for (UINT32 tileX=0; tileX < nTiles; tileX++) {
-					m_wtChannel[i]->GetSubband(m_currentLevel, HL)->ExtractTile(*m_encoder, true, tileX, tileY);
-					m_wtChannel[i]->GetSubband(m_currentLevel, LH)->ExtractTile(*m_encoder, true, tileX, tileY);
-					m_wtChannel[i]->GetSubband(m_currentLevel, HH)->ExtractTile(*m_encoder, true, tileX, tileY);
+					m_wtChannel[i]->GetSubband(m_currentLevel, HL)->ExtractTile(*m_encoder, m_quant, true, tileX, tileY);
+					m_wtChannel[i]->GetSubband(m_currentLevel, LH)->ExtractTile(*m_encoder, m_quant, true, tileX, tileY);
+					m_wtChannel[i]->GetSubband(m_currentLevel, HH)->ExtractTile(*m_encoder, m_quant, true, tileX, tileY);
 					if (i == lastChannel && tileY == lastTile && tileX == lastTile) {
 						// all necessary data are buffered. next call of EncodeBuffer will write the last piece of data of the current level.
 						m_encoder->SetEncodedLevel(--m_currentLevel);
@@ -1026,12 +1927,12 @@ void CPGFImage::WriteLevel() THROW_ {
 			ASSERT(m_wtChannel[i]);
 			if (m_currentLevel == m_header.nLevels) { 
 				// last level also has LL band
-				m_wtChannel[i]->GetSubband(m_currentLevel, LL)->ExtractTile(*m_encoder);
+				m_wtChannel[i]->GetSubband(m_currentLevel, LL)->ExtractTile(*m_encoder, m_quant);
 			}
 			//encoder.EncodeInterleaved(m_wtChannel[i], m_currentLevel, m_quant); // until version 4
-			m_wtChannel[i]->GetSubband(m_currentLevel, HL)->ExtractTile(*m_encoder); // since version 5
-			m_wtChannel[i]->GetSubband(m_currentLevel, LH)->ExtractTile(*m_encoder); // since version 5
-			m_wtChannel[i]->GetSubband(m_currentLevel, HH)->ExtractTile(*m_encoder);
+			m_wtChannel[i]->GetSubband(m_currentLevel, HL)->ExtractTile(*m_encoder, m_quant); // since version 5
+			m_wtChannel[i]->GetSubband(m_currentLevel, LH)->ExtractTile(*m_encoder, m_quant); // since version 5
+			m_wtChannel[i]->GetSubband(m_currentLevel, HH)->ExtractTile(*m_encoder, m_quant);
 		}
 
 		// all necessary data are buffered. next call of EncodeBuffer will write the last piece of data of the current level.
@@ -1098,19 +1999,36 @@ UINT32 CPGFImage::WriteImage(CPGFStream* stream, CallbackPtr cb /*= NULL*/, void
 		// encode subbands, higher levels first
 		// color channels are interleaved
 
-		// encode all levels
-		for (m_currentLevel = levels; m_currentLevel > 0; ) {
-			WriteLevel(); // decrements m_currentLevel
+		// encode all levels: macro blocks are encoded and written by tasks, while the next macro blocks are filled
+		OSError error = NoError;
+#ifdef LIBPGF_USE_OPENMP_TASKS
+		const int nThreads = m_encoder->GetNofThreads();
+		#pragma omp parallel default(shared) num_threads(nThreads) if(nThreads > 1)
+		#pragma omp master
+#endif
+		{
+			try {
+				for (m_currentLevel = levels; m_currentLevel > 0; ) {
+					WriteLevel(); // decrements m_currentLevel
 
-			// now update progress
-			if (cb) {
-				percent *= 4;
-				if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
+					// now update progress
+					if (cb) {
+						percent *= 4;
+						if ((*cb)(percent, true, data)) {
+							error = EscapePressed;
+							break;
+						}
+					}
+				}
+
+				// flush encoder and write level lengths
+				if (error == NoError) m_encoder->Flush();
+			} catch(IOException& ex) {
+				// exceptions must not leave the parallel region
+				error = ex.error;
 			}
 		}
-
-		// flush encoder and write level lengths
-		m_encoder->Flush();
+		if (error != NoError) ReturnWithError(error);
 	}
 
 	// update level lengths
@@ -1141,14 +2059,296 @@ void CPGFImage::Write(CPGFStream* stream, UINT32* nWrittenBytes /*= NULL*/, Call
 	ASSERT(stream);
 	ASSERT(m_preHeader.hSize);
 
-	// create wavelet transform channels and encoder
-	UINT32 nBytes = WriteHeader(stream);
+	// create wavelet transform channels and encoder
+	UINT32 nBytes = WriteHeader(stream);
+
+	// write image
+	nBytes += WriteImage(stream, cb, data);
+
+	// return written bytes
+	if (nWrittenBytes) *nWrittenBytes += nBytes;
+}
+
+//////////////////////////////////////////////////////////////////
+// Encode and write an entire PGF image (header and image) into several streams with different qualities.
+// The forward transform is computed only once; the wavelet coefficients are quantized for each stream during encoding.
+// It might throw an IOException.
+// @param n Number of streams
+// @param streams PGF streams
+// @param qualities [inout] Quality of each stream, eventually corrected with respect to the chrominance downsampling
+// @param nWrittenBytes [out] The number of bytes written into each stream, or NULL
+void CPGFImage::WriteQualities(int n, CPGFStream* streams[], BYTE qualities[], UINT32 nWrittenBytes[] /*= NULL*/) THROW_ {
+	ASSERT(n > 0);
+	ASSERT(streams && qualities);
+	ASSERT(m_preHeader.hSize);
+
+	const PGFPreHeader preHeader = m_preHeader;
+	const BYTE quality = m_header.quality;
+
+	// create wavelet transform channels without quantization
+	if (m_header.nLevels > 0) TransformChannels();
+
+	for (int k=0; k < n; k++) {
+		ASSERT(streams[k]);
+		const UINT64 startPos = streams[k]->GetPos();
+
+		SetQuality(CorrectQuality(qualities[k]));
+		qualities[k] = m_header.quality;
+
+		// encode and write image
+		m_preHeader = preHeader;
+		m_currentLevel = m_header.nLevels;
+		CreateEncoder(streams[k]);
+		WriteImage(streams[k]);
+
+		if (nWrittenBytes) nWrittenBytes[k] = (UINT32)(streams[k]->GetPos() - startPos);
+	}
+	SetQuality(quality);
+}
+
+//////////////////////////////////////////////////////////////////
+// Encode and write an entire PGF image (header and image) at current stream position with the best quality 
+// whose encoded size doesn't exceed a byte budget.
+// The quality is searched by encoding the wavelet coefficients into memory streams.
+// It might throw an IOException.
+// @param stream A PGF stream
+// @param maxBytes Maximum number of written bytes
+// @param nWrittenBytes [in-out] The number of bytes written into stream are added to the input value.
+// @return The quality of the written image
+BYTE CPGFImage::WriteToSize(CPGFStream* stream, UINT32 maxBytes, UINT32* nWrittenBytes /*= NULL*/) THROW_ {
+	ASSERT(stream);
+	ASSERT(m_preHeader.hSize);
+
+	if (m_header.nLevels == 0) {
+		// very small image: quantization isn't used
+		Write(stream, nWrittenBytes);
+		return m_header.quality;
+	}
+
+	const PGFPreHeader preHeader = m_preHeader;
+	const UINT64 startPos = stream->GetPos();
+	const BYTE minQuality = m_header.quality;
+	const BYTE maxQuality = PrepareRateControl(NULL);
+	UINT32 levelLength[MaxLevel];
+	CPGFMemoryStream streamA(__max(maxBytes, 0x10000)), streamB(__max(maxBytes, 0x10000));
+	CPGFMemoryStream *trial = &streamA, *best = &streamB;
+	BYTE bestQuality = minQuality;
+	UINT32 bestLen = 0;
+
+	// the encoded size decreases with increasing quality value: 
+	// search the smallest quality value passing the budget between a failing and a passing trial
+	int quality = minQuality;
+	int failed = -1, passed = -1;
+	double failedLen = 0, passedLen = 0;
+
+	for (;;) {
+		// encode into memory
+		SetQuality((BYTE)quality);
+		m_preHeader = preHeader;
+		m_currentLevel = m_header.nLevels;
+		trial->SetPos(FSFromStart, 0);
+		CreateEncoder(trial);
+		WriteImage(trial);
+		const UINT32 len = (UINT32)trial->GetPos();
+
+		if (len <= maxBytes || quality == maxQuality) {
+			// keep trial
+			CPGFMemoryStream* tmp = best; best = trial; trial = tmp;
+			bestQuality = (BYTE)quality;
+			bestLen = len;
+			memcpy(levelLength, m_levelLength, m_header.nLevels*WordBytes);
+		}
+		if (len <= maxBytes) {
+			passed = quality; passedLen = len;
+		} else {
+			failed = quality; failedLen = len;
+		}
+		if (passed == minQuality || passed == failed + 1 || failed == maxQuality) break;
+
+		if (passed < 0) {
+			// assume that the encoded size halves with each quality step
+			quality = failed + __max(1, (int)ceil(log(failedLen/__max(maxBytes, 1U))/log(2.0)));
+			quality = __min(quality, (int)maxQuality);
+		} else {
+			// interpolate the logarithm of the encoded size
+			quality = failed + (int)ceil((passed - failed)*log(failedLen/maxBytes)/log(failedLen/passedLen));
+			quality = __max(failed + 1, __min(passed - 1, quality));
+		}
+	}
+
+	// restore the state of the best trial
+	SetQuality(bestQuality);
+	memcpy(m_levelLength, levelLength, m_header.nLevels*WordBytes);
+	m_userDataPos += startPos;
+
+	// copy best trial into stream
+	int count = bestLen;
+	stream->Write(&count, best->GetBuffer());
+
+	// return written bytes
+	if (nWrittenBytes) *nWrittenBytes += bestLen;
+	return bestQuality;
+}
+
+//////////////////////////////////////////////////////////////////
+// Encode and write an entire PGF image (header and image) at current stream position with the worst quality 
+// whose PSNR isn't below a target.
+// The quality is searched by inverse transforming the dequantized wavelet coefficients.
+// It might throw an IOException.
+// @param stream A PGF stream
+// @param minPSNR Minimum PSNR in dB
+// @param nWrittenBytes [in-out] The number of bytes written into stream are added to the input value.
+// @return The quality of the written image
+BYTE CPGFImage::WriteToPSNR(CPGFStream* stream, double minPSNR, UINT32* nWrittenBytes /*= NULL*/) THROW_ {
+	ASSERT(stream);
+	ASSERT(m_preHeader.hSize);
+
+	if (m_header.nLevels == 0) {
+		// very small image: quantization isn't used
+		Write(stream, nWrittenBytes);
+		return m_header.quality;
+	}
+
+	DataT* channels[MaxChannels] = { 0 };
+	int lo = m_header.quality;
+	OSError error = NoError;
+
+	try {
+		int hi = PrepareRateControl(channels);
+
+		// the PSNR decreases with increasing quality value: binary search of the largest quality value reaching minPSNR
+		while (lo < hi) {
+			const int quality = (lo + hi + 1)/2;
+			if (ComputePSNR((BYTE)quality, channels) >= minPSNR) {
+				lo = quality;
+			} else {
+				hi = quality - 1;
+			}
+		}
+	} catch(IOException& ex) {
+		error = ex.error;
+	}
+
+	for (int i=0; i < m_header.channels; i++) {
+		delete[] channels[i];
+	}
+	if (error != NoError) ReturnWithError2(error, (BYTE)lo);
+
+	// encode and write the image once
+	const UINT64 startPos = stream->GetPos();
+	SetQuality((BYTE)lo);
+	m_currentLevel = m_header.nLevels;
+	CreateEncoder(stream);
+	WriteImage(stream);
+
+	// return written bytes
+	if (nWrittenBytes) *nWrittenBytes += (UINT32)(stream->GetPos() - startPos);
+	return (BYTE)lo;
+}
+
+//////////////////////////////////////////////////////////////////
+// Compute the forward transform of all channels for rate control.
+// It might throw an IOException.
+// @param channels [out] Copies of the untransformed channels, or NULL if they are not needed
+// @return The worst quality of the rate control: beyond this value all coefficients are quantized to zero
+BYTE CPGFImage::PrepareRateControl(DataT* channels[]) THROW_ {
+	ASSERT(m_header.nLevels > 0);
+
+	if (channels) {
+		for (int i=0; i < m_header.channels; i++) {
+			const UINT32 size = m_width[i]*m_height[i];
+
+			channels[i] = new(std::nothrow) DataT[size];
+			if (!channels[i]) ReturnWithError2(InsufficientMemory, 0);
+			memcpy(channels[i], m_channel[i], size*DataTSize);
+		}
+	}
+
+	TransformChannels();
+
+	UINT32 maxAbs = 0;
+	for (int i=0; i < m_header.channels; i++) {
+		for (int level=1; level <= m_header.nLevels; level++) {
+			for (int o=(level == m_header.nLevels) ? LL : HL; o < NSubbands; o++) {
+				CSubband* band = m_wtChannel[i]->GetSubband(level, (Orientation)o);
+				const DataT* data = band->GetBuffer();
+				const UINT32 size = band->GetWidth()*band->GetHeight();
+
+				for (UINT32 j=0; j < size; j++) {
+					const UINT32 a = (data[j] < 0) ? -data[j] : data[j];
+					if (a > maxAbs) maxAbs = a;
+				}
+			}
+		}
+	}
+
+	// the chrominance downsampling is kept, hence the quality must stay on the same side of DownsampleThreshold
+	int bits = 0;
+	while (maxAbs >> bits) bits++;
+	int maxQuality = (m_downsample || !DownsampleSupported()) ? MaxQuality : DownsampleThreshold;
+	maxQuality = __min(maxQuality, m_header.nLevels + bits + 2 + (m_downsample ? 1 : 0));
+	return (BYTE)__max(maxQuality, (int)m_header.quality);
+}
 
-	// write image
-	nBytes += WriteImage(stream, cb, data);
+//////////////////////////////////////////////////////////////////
+// Set the quality of the next encoding without changing the chrominance downsampling.
+// @param quality A quality value
+void CPGFImage::SetQuality(BYTE quality) {
+	ASSERT(quality <= MaxQuality);
+	ASSERT(!m_downsample || quality > DownsampleThreshold);
+
+	m_header.quality = quality;
+	m_quant = (m_downsample) ? quality - 1 : quality;
+}
 
-	// return written bytes
-	if (nWrittenBytes) *nWrittenBytes += nBytes;
+//////////////////////////////////////////////////////////////////
+// Correct a quality value: the chrominance downsampling is decided in SetHeader or Open and cannot be changed, 
+// hence the quality must remain on the same side of DownsampleThreshold.
+// @param quality A quality value
+// @return The corrected quality value
+BYTE CPGFImage::CorrectQuality(BYTE quality) const {
+	if (m_downsample) {
+		quality = __max(quality, DownsampleThreshold + 1);
+	} else if (DownsampleSupported()) {
+		quality = __min(quality, DownsampleThreshold);
+	}
+	return __min(quality, MaxQuality);
+}
+
+//////////////////////////////////////////////////////////////////
+// Compute the PSNR of all channels at the given quality: the dequantized wavelet coefficients are inverse transformed
+// and compared with the untransformed channels.
+// It might throw an IOException.
+// @param quality A quality value
+// @param channels Untransformed channels saved by PrepareRateControl
+// @return PSNR in dB
+double CPGFImage::ComputePSNR(BYTE quality, DataT* const channels[]) THROW_ {
+	const int quant = (m_downsample) ? quality - 1 : quality;
+	const double peak = ldexp(1.0, UsedBitsPerChannel()) - 1;
+	double sse = 0, n = 0;
+
+	for (int i=0; i < m_header.channels; i++) {
+		CWaveletTransform wt(m_width[i], m_height[i], m_header.nLevels);
+	#ifdef __PGFROISUPPORT__
+		wt.SetROI(PGFRect(0, 0, m_width[i], m_height[i]));
+	#endif
+		OSError err = wt.CopyCoefficients(*m_wtChannel[i], quant);
+		UINT32 w, h;
+		DataT* data = NULL;
+
+		for (int l=m_header.nLevels; err == NoError && l > 0; l--) {
+			err = wt.InverseTransform(l, &w, &h, &data, NumberOfThreads(m_useOMPinEncoder));
+		}
+		if (err != NoError) ReturnWithError2(err, 0);
+
+		const UINT32 size = m_width[i]*m_height[i];
+		for (UINT32 j=0; j < size; j++) {
+			const double d = data[j] - channels[i][j];
+			sse += d*d;
+		}
+		n += size;
+	}
+	return (sse > 0) ? 10*log10(peak*peak*n/sse) : HUGE_VAL;
 }
 
 #ifdef __PGFROISUPPORT__
@@ -1186,21 +2386,38 @@ UINT32 CPGFImage::Write(int level, CallbackPtr cb /*= NULL*/, void *data /*=NULL
 		}
 	}
 
-	// encoding scheme with ROI
-	while (m_currentLevel > level) {
-		WriteLevel();	// decrements m_currentLevel
+	// encoding scheme with ROI: macro blocks are encoded and written by tasks, while the next macro blocks are filled
+	OSError error = NoError;
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	const int nThreads = m_encoder->GetNofThreads();
+	#pragma omp parallel default(shared) num_threads(nThreads) if(nThreads > 1)
+	#pragma omp master
+#endif
+	{
+		try {
+			while (m_currentLevel > level) {
+				WriteLevel();	// decrements m_currentLevel
 
-		if (m_levelLength) {
-			nWrittenBytes += m_levelLength[m_header.nLevels - m_currentLevel - 1];
-		}
+				if (m_levelLength) {
+					nWrittenBytes += m_levelLength[m_header.nLevels - m_currentLevel - 1];
+				}
 
-		// now update progress
-		if (cb) {
-			percent *= 4;
-			if (m_progressMode == PM_Absolute) m_percent = percent;
-			if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
+				// now update progress
+				if (cb) {
+					percent *= 4;
+					if (m_progressMode == PM_Absolute) m_percent = percent;
+					if ((*cb)(percent, true, data)) {
+						error = EscapePressed;
+						break;
+					}
+				}
+			}
+		} catch(IOException& ex) {
+			// exceptions must not leave the parallel region
+			error = ex.error;
 		}
 	}
+	if (error != NoError) ReturnWithError(error);
 
 	// automatically closing
 	if (m_currentLevel == 0) {
@@ -1214,6 +2431,235 @@ UINT32 CPGFImage::Write(int level, CallbackPtr cb /*= NULL*/, void *data /*=NULL
 
 	return nWrittenBytes;
 }
+
+//////////////////////////////////////////////////////////////////
+/// Set PGF header and user data, write header at current stream position, and prepare line based encoding.
+/// Line based encoding is an alternative to SetHeader(...), ImportBitmap(...), and Write(...) for very large images:
+/// the image is imported in parts of a few rows with ImportScanlines(...) and immediately transformed and encoded.
+/// Only a few rows of each level are held in memory, hence the image is never completely buffered.
+/// Encoded tiles are spooled into a memory stream or into the given spool stream until FinishLineEncoding(...)
+/// copies them in the order of the PGF format into stream. The ROI encoding scheme is always used.
+/// Precondition: The PGF image has been closed with Close(...) or never opened with Open(...).
+/// It might throw an IOException.
+/// @param stream A PGF stream
+/// @param header A valid and already filled in PGF header structure
+/// @param flags A combination of additional version flags. PGFROI is always added.
+/// @param userData A user-defined memory block containing any kind of cached metadata.
+/// @param userDataLength The size of user-defined memory block in bytes
+/// @param spool A readable and writable stream (e.g. a temporary file) for encoded tiles, or NULL if a memory stream should be used
+/// @return The number of bytes written into stream.
+UINT32 CPGFImage::StartLineEncoding(CPGFStream* stream, const PGFHeader& header, BYTE flags /*= 0*/, UINT8* userData /*= 0*/, UINT32 userDataLength /*= 0*/, CPGFStream* spool /*= NULL*/) THROW_ {
+	ASSERT(stream);
+	ASSERT(stream != spool);
+	ASSERT(!m_encoder && !m_spoolEncoder);
+
+	// the ROI encoding scheme allows encoding tile row by tile row; tile rows are copied without knowing their tiles
+	InitHeader(header, (flags | PGFROI) & ~PGFTileIndex, userData, userDataLength);
+	m_lineRow = 0;
+
+	if (m_header.nLevels == 0) {
+		// very small image: we don't use DWT and encoding, hence channels are buffered completely
+		AllocChannels();
+		return WriteHeader(stream);
+	}
+
+	// create new wt channels: the imported rows are buffered in subband LL at level 0
+	for (int i=0; i < m_header.channels; i++) {
+		// downsampled channels buffer two rows of the original size
+		DataT* rows = new(std::nothrow) DataT[2*m_header.width];
+		if (!rows) ReturnWithError(InsufficientMemory);
+
+		m_width[i] = m_header.width;
+		m_height[i] = m_header.height;
+		if (m_downsample && i > 0) {
+			m_width[i] = (m_width[i] + 1)/2;
+			m_height[i] = (m_height[i] + 1)/2;
+		}
+		ASSERT(!m_wtChannel[i]);
+		m_channel[i] = rows;
+		m_wtChannel[i] = new CWaveletTransform(m_width[i], m_height[i], m_header.nLevels, rows);
+
+		OSError err = m_wtChannel[i]->InitLineTransform(m_quant);
+		if (err != NoError) ReturnWithError(err);
+	}
+	m_currentLevel = m_header.nLevels;
+
+	// create encoder and write headers
+	m_encoder = new CEncoder(stream, m_preHeader, m_header, m_postHeader, m_userDataPos, NumberOfThreads(m_useOMPinEncoder));
+	if (m_favorSpeedOverSize) m_encoder->FavorSpeedOverSize();
+	m_encoder->SetROI();
+
+	// create encoder of spooled tiles
+	if (spool) {
+		m_spool = spool;
+	} else {
+		m_memSpool = new CPGFMemoryStream(BufferSize*DataTSize);
+		m_spool = m_memSpool;
+	}
+	m_spoolEncoder = new CEncoder(m_spool, NumberOfThreads(m_useOMPinEncoder));
+	if (m_favorSpeedOverSize) m_spoolEncoder->FavorSpeedOverSize();
+	m_spoolEncoder->SetROI();
+
+	INT64 nBytes = m_encoder->ComputeHeaderLength();
+	return (nBytes > 0) ? (UINT32)nBytes : 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Import the next rows of an image from a specified image buffer and transform and encode them as far as possible.
+/// Rows have to be imported from top to bottom. Call this method after StartLineEncoding(...) and before FinishLineEncoding(...).
+/// The absolute value of pitch is the number of bytes of an image row.
+/// If pitch is negative, then the rows are stored in bottom-up order and buff points to the topmost of the imported rows.
+/// If pitch is positive, then buff points to the first byte of the topmost of the imported rows.
+/// The channelMap is used in the same way as in ImportBitmap(...).
+/// It might throw an IOException.
+/// @param pitch The number of bytes of a row of the image buffer.
+/// @param buff An image buffer containing nRows rows.
+/// @param bpp The number of bits per pixel used in image buffer.
+/// @param nRows The number of imported rows.
+/// @param channelMap A integer array containing the mapping of input channel ordering to expected channel ordering.
+void CPGFImage::ImportScanlines(int pitch, UINT8 *buff, BYTE bpp, UINT32 nRows, int channelMap[] /*= NULL*/) THROW_ {
+	ASSERT(buff);
+	ASSERT(m_lineRow + nRows <= m_header.height);
+
+	if (m_header.nLevels == 0) {
+		// very small image: color transform into the completely buffered channels
+		DataT* channel[MaxChannels];
+		for (int c=0; c < m_header.channels; c++) {
+			channel[c] = m_channel[c];
+			m_channel[c] += m_lineRow*m_header.width;
+		}
+		RgbToYuv(pitch, buff, bpp, channelMap, nRows, NULL, NULL);
+		for (int c=0; c < m_header.channels; c++) {
+			m_channel[c] = channel[c];
+		}
+		m_lineRow += nRows;
+		return;
+	}
+	ASSERT(m_spoolEncoder);
+
+	for (UINT32 r=0; r < nRows; r++, m_lineRow++) {
+		if (m_downsample) {
+			// even and odd rows of downsampled channels are buffered in two separate rows
+			for (int c=1; c < m_header.channels; c++) {
+				m_channel[c] = m_wtChannel[c]->GetSubband(0, LL)->GetBuffer() + (m_lineRow & 1)*m_header.width;
+			}
+		}
+
+		// color transform
+		RgbToYuv(pitch, buff, bpp, channelMap, 1, NULL, NULL);
+		buff += pitch;
+
+		// transform and encode
+		for (int c=0; c < m_header.channels; c++) {
+			if (m_downsample && c > 0) {
+				// subsampling of the chrominance and alpha channels
+				DataT* rows = m_wtChannel[c]->GetSubband(0, LL)->GetBuffer();
+				if (m_lineRow & 1) {
+					DownsampleRows(rows, rows + m_header.width);
+				} else if (m_lineRow == m_header.height - 1) {
+					DownsampleRows(rows, NULL);
+				} else {
+					continue;
+				}
+				m_wtChannel[c]->ForwardLine(rows, *m_spoolEncoder);
+			} else {
+				m_wtChannel[c]->ForwardLine(m_channel[c], *m_spoolEncoder);
+			}
+		}
+	}
+}
+
+/////////////////////////////////////////////////////////////////
+// Bilinear subsampling of two rows by a factor 2. 
+// The result is stored at the beginning of the even row.
+// @param loRow Even row
+// @param hiRow Odd row or NULL if loRow is the last row of an image with odd height
+void CPGFImage::DownsampleRows(DataT* loRow, const DataT* hiRow) const {
+	const int w2 = m_header.width/2;
+	const int oddW = m_header.width%2;
+	int pos = 0;
+
+	if (hiRow) {
+		for (int j=0; j < w2; j++) {
+			// compute average of pixel block
+			loRow[j] = (loRow[pos] + loRow[pos + 1] + hiRow[pos] + hiRow[pos + 1]) >> 2;
+			pos += 2;
+		}
+		if (oddW) {
+			loRow[w2] = (loRow[pos] + hiRow[pos]) >> 1;
+		}
+	} else {
+		for (int j=0; j < w2; j++) {
+			loRow[j] = (loRow[pos] + loRow[pos + 1]) >> 1;
+			pos += 2;
+		}
+		if (oddW) {
+			loRow[w2] = loRow[pos];
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+/// Write the encoded image at current stream position after all rows have been imported with ImportScanlines(...).
+/// It might throw an IOException.
+/// @param stream The PGF stream used in StartLineEncoding(...)
+/// @param cb A pointer to a callback procedure. The procedure is called after writing a single level. If cb returns true, then it stops proceeding.
+/// @param data Data Pointer to C++ class container to host callback procedure.
+/// @return The number of bytes written into stream.
+UINT32 CPGFImage::FinishLineEncoding(CPGFStream* stream, CallbackPtr cb /*= NULL*/, void *data /*= NULL*/) THROW_ {
+	ASSERT(stream);
+	ASSERT(m_encoder);
+	ASSERT(m_lineRow == m_header.height);
+
+	if (m_header.nLevels == 0) {
+		if (m_downsample) {
+			// Subsampling of the chrominance and alpha channels
+			for (int i=1; i < m_header.channels; i++) {
+				Downsample(i);
+			}
+		}
+		return WriteImage(stream, cb, data);
+	}
+	ASSERT(m_spoolEncoder);
+
+	const int lastChannel = m_header.channels - 1;
+	double percent = pow(0.25, m_header.nLevels);
+	UINT64 pos;
+	UINT32 len;
+
+	// all encoded tiles are already in the spool stream
+	delete m_spoolEncoder; m_spoolEncoder = NULL;
+
+	// update post-header size, rewrite pre-header, and write dummy levelLength
+	UpdatePostHeaderSize();
+
+	// copy encoded tile rows: higher levels first, color channels are interleaved
+	for (m_currentLevel = m_header.nLevels; m_currentLevel > 0; m_currentLevel--) {
+		for (int i=0; i < m_header.channels; i++) {
+			const UINT32 nTiles = m_wtChannel[i]->GetNofTiles(m_currentLevel);
+
+			for (UINT32 tileY=0; tileY < nTiles; tileY++) {
+				m_wtChannel[i]->GetEncodedTileRow(m_currentLevel, tileY, pos, len);
+				m_encoder->CopyMacroBlocks(m_spool, pos, len, i == lastChannel && tileY == nTiles - 1);
+			}
+		}
+
+		// now update progress
+		if (cb) {
+			percent *= 4;
+			if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
+		}
+	}
+
+	// update level lengths
+	UINT32 nWrittenBytes = m_encoder->UpdateLevelLength(); // return written image bytes 
+
+	// delete encoder and spool stream
+	delete m_encoder; m_encoder = NULL;
+	delete m_memSpool; m_memSpool = NULL; m_spool = NULL;
+
+	return nWrittenBytes;
+}
 #endif // __PGFROISUPPORT__
 
 
@@ -1294,6 +2740,7 @@ void CPGFImage::SetColorTable(UINT32 iFirstColor, UINT32 nColors, const RGBQUAD*
 // if pitch is negative, then buff points to the last row of a bottom-up image (first byte on last row)
 // if pitch is positive, then buff points to the first row of a top-down image (first byte)
 // bpp is the number of bits per pixel used in image buffer buff
+// nRows is the number of rows in image buffer buff
 //
 // RGB is transformed into YUV format (ordering of buffer data is BGR[A])
 // Y = (R + 2*G + B)/4 -128
@@ -1305,11 +2752,11 @@ void CPGFImage::SetColorTable(UINT32 iFirstColor, UINT32 nColors, const RGBQUAD*
 // The sequence of input channels in the input image buffer does not need to be the same as expected from PGF. In case of different sequences you have to
 // provide a channelMap of size of expected channels (depending on image mode). For example, PGF expects in RGB color mode a channel sequence BGR.
 // If your provided image buffer contains a channel sequence ARGB, then the channelMap looks like { 3, 2, 1 }.
-void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], CallbackPtr cb, void *data /*=NULL*/) THROW_ {
+void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], UINT32 nRows, CallbackPtr cb, void *data /*=NULL*/) THROW_ {
 	ASSERT(buff);
 	int yPos = 0, cnt = 0;
 	double percent = 0;
-	const double dP = 1.0/m_header.height;
+	const double dP = 1.0/nRows;
 	int defMap[] = { 0, 1, 2, 3, 4, 5, 6, 7 }; ASSERT(sizeof(defMap)/sizeof(defMap[0]) == MaxChannels);
 
 	if (channelMap == NULL) channelMap = defMap;
@@ -1325,7 +2772,7 @@ void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], Cal
 			const UINT32 w2 = (m_header.width + 7)/8;
 			DataT* y = m_channel[0]; ASSERT(y);
 
-			for (UINT32 h=0; h < m_header.height; h++) {
+			for (UINT32 h=0; h < nRows; h++) {
 				if (cb) {
 					if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
 					percent += dP;
@@ -1362,7 +2809,7 @@ void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], Cal
 			ASSERT(bpp%8 == 0);
 			const int channels = bpp/8; ASSERT(channels >= m_header.channels);
 
-			for (UINT32 h=0; h < m_header.height; h++) {
+			for (UINT32 h=0; h < nRows; h++) {
 				if (cb) {
 					if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
 					percent += dP;
@@ -1393,7 +2840,7 @@ void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], Cal
 			const int shift = 16 - UsedBitsPerChannel(); ASSERT(shift >= 0);
 			const DataT yuvOffset16 = 1 << (UsedBitsPerChannel() - 1);
 
-			for (UINT32 h=0; h < m_header.height; h++) {
+			for (UINT32 h=0; h < nRows; h++) {
 				if (cb) {
 					if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
 					percent += dP;
@@ -1423,7 +2870,7 @@ void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], Cal
 			const int channels = bpp/8; ASSERT(channels >= m_header.channels);
 			UINT8 b, g, r;
 
-			for (UINT32 h=0; h < m_header.height; h++) {
+			for (UINT32 h=0; h < nRows; h++) {
 				if (cb) {
 					if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
 					percent += dP;
@@ -1462,7 +2909,7 @@ void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], Cal
 			DataT* v = m_channel[2]; ASSERT(v);
 			UINT16 b, g, r;
 
-			for (UINT32 h=0; h < m_header.height; h++) {
+			for (UINT32 h=0; h < nRows; h++) {
 				if (cb) {
 					if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
 					percent += dP;
@@ -1498,7 +2945,7 @@ void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], Cal
 			DataT* a = m_channel[3]; ASSERT(a);
 			UINT8 b, g, r;
 
-			for (UINT32 h=0; h < m_header.height; h++) {
+			for (UINT32 h=0; h < nRows; h++) {
 				if (cb) {
 					if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
 					percent += dP;
@@ -1538,7 +2985,7 @@ void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], Cal
 			DataT* a = m_channel[3]; ASSERT(a);
 			UINT16 b, g, r;
 
-			for (UINT32 h=0; h < m_header.height; h++) {
+			for (UINT32 h=0; h < nRows; h++) {
 				if (cb) {
 					if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
 					percent += dP;
@@ -1575,7 +3022,7 @@ void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], Cal
 			const int shift = 31 - UsedBitsPerChannel(); ASSERT(shift >= 0);
 			const DataT yuvOffset31 = 1 << (UsedBitsPerChannel() - 1);
 
-			for (UINT32 h=0; h < m_header.height; h++) {
+			for (UINT32 h=0; h < nRows; h++) {
 				if (cb) {
 					if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
 					percent += dP;
@@ -1601,7 +3048,7 @@ void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], Cal
 
 			UINT8 rgb = 0, b, g, r;
 
-			for (UINT32 h=0; h < m_header.height; h++) {
+			for (UINT32 h=0; h < nRows; h++) {
 				if (cb) {
 					if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
 					percent += dP;
@@ -1651,7 +3098,7 @@ void CPGFImage::RgbToYuv(int pitch, UINT8* buff, BYTE bpp, int channelMap[], Cal
 			UINT16 rgb, b, g, r;
 			const int pitch16 = pitch/2;
 
-			for (UINT32 h=0; h < m_header.height; h++) {
+			for (UINT32 h=0; h < nRows; h++) {
 				if (cb) {
 					if ((*cb)(percent, true, data)) ReturnWithError(EscapePressed);
 					percent += dP;
@@ -1722,6 +3169,49 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 	}
 #endif
 
+	YuvToRgb(m_channel, w, h, pitch, buff, bpp, channelMap, cb, data);
+
+#ifdef __PGFROISUPPORT__
+	if (targetBuff) {
+		// copy valid ROI (m_roi) from temporary buffer (roi) to target buffer
+		if (bpp%8 == 0) {
+			BYTE bypp = bpp/8;
+			UINT32 i, j;
+			buff = buffStart + (levelRoi.top - roi.top)*pitch + (levelRoi.left - roi.left)*bypp;
+			w = levelRoi.Width()*bypp;
+			h = levelRoi.Height();
+
+			for (i=0; i < h; i++) {
+				for (j=0; j < w; j++) {
+					targetBuff[j] = buff[j];
+				}
+				targetBuff += targetPitch;
+				buff += pitch;
+			}
+		} else {
+			// to do
+		}
+
+		delete[] buffStart;
+	}
+#endif
+}			
+
+//////////////////////////////////////////////////////////////////////
+// Upsampling, YUV to RGB transform and interleaving of h rows of the given channels into an image buffer.
+// The rows of channel 0 have width w. Downsampled channels contain (h + 1)/2 rows of width (w + 1)/2.
+// It might throw an IOException.
+// @param channel Pointers to the first row of each channel
+// @param w The number of pixels of a row
+// @param h The number of rows
+// @param pitch The number of bytes of a row of the image buffer.
+// @param buff An image buffer.
+// @param bpp The number of bits per pixel used in image buffer.
+// @param channelMap A integer array containing the mapping of PGF channel ordering to expected channel ordering or NULL.
+// @param cb A pointer to a callback procedure. The procedure is called after each copied buffer row. If cb returns true, then it stops proceeding.
+// @param data Data Pointer to C++ class container to host callback procedure.
+void CPGFImage::YuvToRgb(DataT* const channel[], UINT32 w, UINT32 h, int pitch, UINT8* buff, BYTE bpp, int channelMap[], CallbackPtr cb, void *data) const THROW_ {
+	ASSERT(buff);
 	const bool wOdd = (1 == w%2);
 
 	const double dP = 1.0/h;
@@ -1740,7 +3230,7 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 			ASSERT(bpp == 1);
 
 			const UINT32 w2 = (w + 7)/8;
-			DataT* y = m_channel[0]; ASSERT(y);
+			DataT* y = channel[0]; ASSERT(y);
 
 			for (i=0; i < h; i++) {
 				
@@ -1784,7 +3274,7 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 				cnt = 0;
 				for (j=0; j < w; j++) {
 					for (int c=0; c < m_header.channels; c++) {
-						buff[cnt + channelMap[c]] = Clamp8(m_channel[c][yPos] + YUVoffset8);
+						buff[cnt + channelMap[c]] = Clamp8(channel[c][yPos] + YUVoffset8);
 					}
 					cnt += channels;
 					yPos++;
@@ -1816,7 +3306,7 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 					cnt = 0;
 					for (j=0; j < w; j++) {
 						for (int c=0; c < m_header.channels; c++) {
-							buff16[cnt + channelMap[c]] = Clamp16((m_channel[c][yPos] + yuvOffset16) << shift);
+							buff16[cnt + channelMap[c]] = Clamp16((channel[c][yPos] + yuvOffset16) << shift);
 						}
 						cnt += channels;
 						yPos++;
@@ -1837,7 +3327,7 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 					cnt = 0;
 					for (j=0; j < w; j++) {
 						for (int c=0; c < m_header.channels; c++) {
-							buff[cnt + channelMap[c]] = Clamp8((m_channel[c][yPos] + yuvOffset16) >> shift);
+							buff[cnt + channelMap[c]] = Clamp8((channel[c][yPos] + yuvOffset16) >> shift);
 						}
 						cnt += channels;
 						yPos++;
@@ -1859,9 +3349,9 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 			ASSERT(bpp%8 == 0);
 			ASSERT(bpp >= m_header.bpp);
 
-			DataT* y = m_channel[0]; ASSERT(y);
-			DataT* u = m_channel[1]; ASSERT(u);
-			DataT* v = m_channel[2]; ASSERT(v);
+			DataT* y = channel[0]; ASSERT(y);
+			DataT* u = channel[1]; ASSERT(u);
+			DataT* v = channel[2]; ASSERT(v);
 			UINT8 *buffg = &buff[channelMap[1]],
 				  *buffr = &buff[channelMap[2]],
 				  *buffb = &buff[channelMap[0]];
@@ -1924,9 +3414,9 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 
 			const DataT yuvOffset16 = 1 << (UsedBitsPerChannel() - 1);
 
-			DataT* y = m_channel[0]; ASSERT(y);
-			DataT* u = m_channel[1]; ASSERT(u);
-			DataT* v = m_channel[2]; ASSERT(v);
+			DataT* y = channel[0]; ASSERT(y);
+			DataT* u = channel[1]; ASSERT(u);
+			DataT* v = channel[2]; ASSERT(v);
 			int cnt, channels;
 			DataT g;
 
@@ -2008,9 +3498,9 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 			ASSERT(m_header.bpp == m_header.channels*8);
 			ASSERT(bpp%8 == 0);
 
-			DataT* l = m_channel[0]; ASSERT(l);
-			DataT* a = m_channel[1]; ASSERT(a);
-			DataT* b = m_channel[2]; ASSERT(b);
+			DataT* l = channel[0]; ASSERT(l);
+			DataT* a = channel[1]; ASSERT(a);
+			DataT* b = channel[2]; ASSERT(b);
 			int cnt, channels = bpp/8; ASSERT(channels >= m_header.channels);
 
 			for (i=0; i < h; i++) {
@@ -2049,9 +3539,9 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 
 			const DataT yuvOffset16 = 1 << (UsedBitsPerChannel() - 1);
 
-			DataT* l = m_channel[0]; ASSERT(l);
-			DataT* a = m_channel[1]; ASSERT(a);
-			DataT* b = m_channel[2]; ASSERT(b);
+			DataT* l = channel[0]; ASSERT(l);
+			DataT* a = channel[1]; ASSERT(a);
+			DataT* b = channel[2]; ASSERT(b);
 			int cnt, channels;
 
 			if (bpp%16 == 0) {
@@ -2129,10 +3619,10 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 			ASSERT(m_header.bpp == m_header.channels*8);
 			ASSERT(bpp%8 == 0);
 
-			DataT* y = m_channel[0]; ASSERT(y);
-			DataT* u = m_channel[1]; ASSERT(u);
-			DataT* v = m_channel[2]; ASSERT(v);
-			DataT* a = m_channel[3]; ASSERT(a);
+			DataT* y = channel[0]; ASSERT(y);
+			DataT* u = channel[1]; ASSERT(u);
+			DataT* v = channel[2]; ASSERT(v);
+			DataT* a = channel[3]; ASSERT(a);
 			UINT8 g, aAvg;
 			int cnt, channels = bpp/8; ASSERT(channels >= m_header.channels);
 
@@ -2176,10 +3666,10 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 
 			const DataT yuvOffset16 = 1 << (UsedBitsPerChannel() - 1);
 
-			DataT* y = m_channel[0]; ASSERT(y);
-			DataT* u = m_channel[1]; ASSERT(u);
-			DataT* v = m_channel[2]; ASSERT(v);
-			DataT* a = m_channel[3]; ASSERT(a);
+			DataT* y = channel[0]; ASSERT(y);
+			DataT* u = channel[1]; ASSERT(u);
+			DataT* v = channel[2]; ASSERT(v);
+			DataT* a = channel[3]; ASSERT(a);
 			DataT g, aAvg;
 			int cnt, channels;
 
@@ -2269,7 +3759,7 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 
 			const int yuvOffset31 = 1 << (UsedBitsPerChannel() - 1);
 
-			DataT* y = m_channel[0]; ASSERT(y);
+			DataT* y = channel[0]; ASSERT(y);
 
 			if (bpp == 32) {
 				const int shift = 31 - UsedBitsPerChannel(); ASSERT(shift >= 0);
@@ -2345,9 +3835,9 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 			ASSERT(bpp == m_header.channels*4);
 			ASSERT(!m_downsample);
 
-			DataT* y = m_channel[0]; ASSERT(y);
-			DataT* u = m_channel[1]; ASSERT(u);
-			DataT* v = m_channel[2]; ASSERT(v);
+			DataT* y = channel[0]; ASSERT(y);
+			DataT* u = channel[1]; ASSERT(u);
+			DataT* v = channel[2]; ASSERT(v);
 			UINT16 yval;
 			int cnt;
 
@@ -2385,9 +3875,9 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 			ASSERT(bpp == 16);
 			ASSERT(!m_downsample);
 
-			DataT* y = m_channel[0]; ASSERT(y);
-			DataT* u = m_channel[1]; ASSERT(u);
-			DataT* v = m_channel[2]; ASSERT(v);
+			DataT* y = channel[0]; ASSERT(y);
+			DataT* u = channel[1]; ASSERT(u);
+			DataT* v = channel[2]; ASSERT(v);
 			UINT16 yval;
 			UINT16 *buff16 = (UINT16 *)buff;
 			int pitch16 = pitch/2;
@@ -2412,31 +3902,7 @@ void CPGFImage::GetBitmap(int pitch, UINT8* buff, BYTE bpp, int channelMap[] /*=
 	default:
 		ASSERT(false);
 	}
-
-#ifdef __PGFROISUPPORT__
-	if (targetBuff) {
-		// copy valid ROI (m_roi) from temporary buffer (roi) to target buffer
-		if (bpp%8 == 0) {
-			BYTE bypp = bpp/8;
-			buff = buffStart + (levelRoi.top - roi.top)*pitch + (levelRoi.left - roi.left)*bypp;
-			w = levelRoi.Width()*bypp;
-			h = levelRoi.Height();
-
-			for (i=0; i < h; i++) {
-				for (j=0; j < w; j++) {
-					targetBuff[j] = buff[j];
-				}
-				targetBuff += targetPitch;
-				buff += pitch;
-			}
-		} else {
-			// to do
-		}
-
-		delete[] buffStart;
-	}
-#endif
-}			
+}
 
 //////////////////////////////////////////////////////////////////////
 /// Get YUV image data in interleaved format: (ordering is YUV[A])
@@ -2636,3 +4102,46 @@ void CPGFImage::ImportYUV(int pitch, DataT *buff, BYTE bpp, int channelMap[] /*=
 	}
 }
 
+//////////////////////////////////////////////////////////////////////
+// Standard constructor
+CPGFSharedImage::CPGFSharedImage()
+: m_stream(0)
+, m_startPos(0)
+, m_encodedHeaderLength(0)
+, m_levelLength(0)
+, m_userDataPos(0)
+{
+	m_postHeader.userData = 0;
+	m_postHeader.userDataLen = 0;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Open a PGF image at given stream position: read pre-header, header, post-header, and level lengths.
+// It might throw an IOException.
+// @param stream A positional stream
+// @param startPos Stream position of the PGF pre-header
+void CPGFSharedImage::Open(const CPGFPositionalStream* stream, UINT64 startPos /*= 0*/) THROW_ {
+	ASSERT(stream && stream->IsValid());
+	Close();
+
+	// read headers with a temporary decoder
+	CPGFCursorStream cursor(stream, startPos);
+	CDecoder decoder(&cursor, m_preHeader, m_header, m_postHeader, m_levelLength, m_userDataPos, 1, false);
+
+	if (m_header.nLevels > MaxLevel) ReturnWithError(FormatCannotRead);
+
+	m_stream = stream;
+	m_startPos = startPos;
+	m_encodedHeaderLength = decoder.GetEncodedHeaderLength();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Release the parsed headers.
+void CPGFSharedImage::Close() {
+	delete[] m_postHeader.userData; m_postHeader.userData = 0; m_postHeader.userDataLen = 0;
+	delete[] m_levelLength; m_levelLength = 0;
+	m_stream = 0;
+	m_startPos = 0;
+	m_encodedHeaderLength = 0;
+	m_userDataPos = 0;
+}
@@ -70,6 +70,148 @@ UINT64 CPGFFileStream::GetPos() const THROW_ {
 }
 
 
+//////////////////////////////////////////////////////////////////////
+// CPGFBufferedFileStream
+//////////////////////////////////////////////////////////////////////
+/// Constructor
+/// @param hFile File handle
+/// @param maxBufferSize Maximum size of the read buffer in bytes
+CPGFBufferedFileStream::CPGFBufferedFileStream(HANDLE hFile, size_t maxBufferSize /*= 4194304*/) THROW_
+: CPGFFileStream(hFile)
+, m_buffer(0)
+, m_bufferSize(__min((size_t)65536, maxBufferSize))
+, m_maxBufferSize(maxBufferSize)
+, m_bufferPos(0)
+, m_bufferLen(0)
+, m_pos(0)
+{
+	ASSERT(IsValid());
+	ASSERT(maxBufferSize > 0);
+	OSError err;
+	if ((err = GetFPos(m_hFile, &m_pos)) != NoError) ReturnWithError(err);
+	m_buffer = new(std::nothrow) UINT8[m_bufferSize];
+	if (!m_buffer) ReturnWithError(InsufficientMemory);
+}
+
+//////////////////////////////////////////////////////////////////////
+CPGFBufferedFileStream::~CPGFBufferedFileStream() {
+	// leave the file position of the handle at the stream position
+	if (m_hFile) SetFPos(m_hFile, FSFromStart, m_pos);
+	delete[] m_buffer; m_buffer = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+void CPGFBufferedFileStream::Write(int *count, void *buffPtr) THROW_ {
+	ASSERT(count);
+	ASSERT(buffPtr);
+	ASSERT(IsValid());
+	OSError err;
+
+	// writing is unbuffered and invalidates the read buffer
+	m_bufferLen = 0;
+	if ((err = SetFPos(m_hFile, FSFromStart, m_pos)) != NoError) ReturnWithError(err);
+	if ((err = FileWrite(m_hFile, count, buffPtr)) != NoError) ReturnWithError(err);
+	m_pos += *count;
+}
+
+//////////////////////////////////////////////////////////////////////
+void CPGFBufferedFileStream::Read(int *count, void *buffPtr) THROW_ {
+	ASSERT(count);
+	ASSERT(buffPtr);
+	ASSERT(IsValid());
+	UINT8 *dst = (UINT8 *)buffPtr;
+	size_t remaining = *count;
+
+	*count = 0;
+	while (remaining > 0) {
+		if (m_pos >= m_bufferPos && m_pos < m_bufferPos + m_bufferLen) {
+			// copy from read buffer
+			const size_t offset = size_t(m_pos - m_bufferPos);
+			const size_t n = __min(remaining, m_bufferLen - offset);
+			memcpy(dst, m_buffer + offset, n);
+			dst += n;
+			remaining -= n;
+			m_pos += n;
+			*count += (int)n;
+		} else if (remaining >= m_bufferSize) {
+			// large reads bypass the read buffer
+			int n = (int)remaining;
+			OSError err;
+			if ((err = FileReadAt(m_hFile, m_pos, &n, dst)) != NoError) ReturnWithError(err);
+			m_pos += n;
+			*count += n;
+			return;
+		} else {
+			Fill();
+			if (!m_bufferLen) return; // end of file
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fill the read buffer at the current stream position.
+void CPGFBufferedFileStream::Fill() THROW_ {
+	int n = (int)m_bufferSize;
+	OSError err;
+
+	m_bufferLen = 0;
+	if ((err = FileReadAt(m_hFile, m_pos, &n, m_buffer)) != NoError) ReturnWithError(err);
+	m_bufferPos = m_pos;
+	m_bufferLen = n;
+}
+
+//////////////////////////////////////////////////////////////////////
+void CPGFBufferedFileStream::SetPos(short posMode, INT64 posOff) THROW_ {
+	ASSERT(IsValid());
+	INT64 pos;
+
+	switch(posMode) {
+	case FSFromStart:
+		pos = posOff;
+		break;
+	case FSFromCurrent:
+		// skipping inside of the read buffer doesn't need any system calls
+		pos = INT64(m_pos) + posOff;
+		break;
+	case FSFromEnd:
+		{
+			OSError err;
+			UINT64 size = 0;
+			if ((err = SetFPos(m_hFile, FSFromEnd, 0)) != NoError) ReturnWithError(err);
+			if ((err = GetFPos(m_hFile, &size)) != NoError) ReturnWithError(err);
+			pos = INT64(size) + posOff;
+		}
+		break;
+	default:
+		ASSERT(false);
+		pos = INT64(m_pos);
+	}
+	if (pos < 0) ReturnWithError(InvalidStreamPos);
+	m_pos = pos;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Access hint: prefetch the given range and let the read buffer grow with its length.
+// @param pos Stream position of the first byte
+// @param len Length of the range in bytes
+void CPGFBufferedFileStream::WillRead(UINT64 pos, UINT64 len) {
+	ASSERT(IsValid());
+	FileAdvise(m_hFile, pos, len);
+
+	const size_t size = (size_t)__min(len, (UINT64)m_maxBufferSize);
+	if (size > m_bufferSize) {
+		// keep the current buffer if there isn't enough memory: it is just a hint
+		UINT8 *buffer = new(std::nothrow) UINT8[size];
+		if (buffer) {
+			memcpy(buffer, m_buffer, m_bufferLen);
+			delete[] m_buffer;
+			m_buffer = buffer;
+			m_bufferSize = size;
+		}
+	}
+}
+
+
 //////////////////////////////////////////////////////////////////////
 // CPGFMemoryStream
 //////////////////////////////////////////////////////////////////////
@@ -121,6 +263,7 @@ void CPGFMemoryStream::Write(int *count, void *buffPtr) THROW_ {
 	} else if (m_allocated) {
 		// memory block is too small -> reallocate a deltaSize larger block
 		size_t offset = m_pos - m_buffer;
+		size_t eosOffset = m_eos - m_buffer;
 		UINT8 *buf_tmp = (UINT8 *)realloc(m_buffer, m_size + deltaSize);
 		if (!buf_tmp) {
 			delete[] m_buffer;
@@ -131,8 +274,9 @@ void CPGFMemoryStream::Write(int *count, void *buffPtr) THROW_ {
 		}
 		m_size += deltaSize;
 
-		// reposition m_pos
+		// reposition m_pos and m_eos
 		m_pos = m_buffer + offset;
+		m_eos = m_buffer + eosOffset;
 
 		// write block
 		memcpy(m_pos, buffPtr, *count);
@@ -184,6 +328,142 @@ void CPGFMemoryStream::SetPos(short posMode, INT64 posOff) THROW_ {
 		ReturnWithError(InvalidStreamPos);
 }
 
+//////////////////////////////////////////////////////////////////////
+// CPGFMappedStream
+//////////////////////////////////////////////////////////////////////
+/// Constructor. Maps the whole file into memory.
+/// @param hFile File handle
+/// @param sequential Access hint: true if the file is mainly read sequentially
+CPGFMappedStream::CPGFMappedStream(HANDLE hFile, bool sequential /*= true*/) THROW_
+: m_view(0)
+, m_buffer(0)
+, m_pos(0)
+, m_size(0)
+{
+	OSError err;
+	if ((err = FileMap(hFile, sequential, &m_view, &m_size)) != NoError) ReturnWithError(err);
+	m_buffer = m_pos = (const UINT8 *)m_view;
+}
+
+//////////////////////////////////////////////////////////////////////
+CPGFMappedStream::~CPGFMappedStream() {
+	if (m_view) FileUnmap(m_view, m_size);
+	m_view = 0; m_buffer = m_pos = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+void CPGFMappedStream::Write(int *count, void *) THROW_ {
+	ASSERT(count);
+	// a mapped stream is read-only
+	*count = 0;
+	ReturnWithError(InvalidStreamPos);
+}
+
+//////////////////////////////////////////////////////////////////////
+void CPGFMappedStream::Read(int *count, void *buffPtr) {
+	ASSERT(IsValid());
+	ASSERT(count);
+	ASSERT(buffPtr);
+	const UINT64 pos = m_pos - m_buffer;
+
+	if (pos + *count > m_size) {
+		// end of file reached -> read only until end
+		*count = (pos < m_size) ? (int)(m_size - pos) : 0;
+	}
+	memcpy(buffPtr, m_pos, *count);
+	m_pos += *count;
+}
+
+//////////////////////////////////////////////////////////////////////
+void CPGFMappedStream::SetPos(short posMode, INT64 posOff) THROW_ {
+	ASSERT(IsValid());
+	INT64 pos;
+	switch(posMode) {
+	case FSFromStart:
+		pos = posOff;
+		break;
+	case FSFromCurrent:
+		pos = (m_pos - m_buffer) + posOff;
+		break;
+	case FSFromEnd:
+		pos = m_size + posOff;
+		break;
+	default:
+		ASSERT(false);
+		pos = m_pos - m_buffer;
+	}
+	if (pos < 0 || (UINT64)pos > m_size) 
+		ReturnWithError(InvalidStreamPos);
+	m_pos = m_buffer + pos;
+}
+
+//////////////////////////////////////////////////////////////////////
+// CPGFPositionalFileStream
+//////////////////////////////////////////////////////////////////////
+void CPGFPositionalFileStream::ReadAt(UINT64 pos, int *count, void *buffPtr) const THROW_ {
+	ASSERT(count);
+	ASSERT(buffPtr);
+	ASSERT(IsValid());
+	OSError err;
+	if ((err = FileReadAt(m_hFile, pos, count, buffPtr)) != NoError) ReturnWithError(err);
+}
+
+//////////////////////////////////////////////////////////////////////
+// CPGFPositionalMemoryStream
+//////////////////////////////////////////////////////////////////////
+void CPGFPositionalMemoryStream::ReadAt(UINT64 pos, int *count, void *buffPtr) const {
+	ASSERT(IsValid());
+	ASSERT(count);
+	ASSERT(buffPtr);
+
+	if (pos >= m_size) {
+		*count = 0;
+		return;
+	}
+	if (pos + *count > m_size) {
+		// end of memory block reached -> read only until end
+		*count = (int)(m_size - pos);
+	}
+	memcpy(buffPtr, m_buffer + pos, *count);
+}
+
+//////////////////////////////////////////////////////////////////////
+// CPGFCursorStream
+//////////////////////////////////////////////////////////////////////
+void CPGFCursorStream::Write(int *count, void *) THROW_ {
+	ASSERT(count);
+	// a cursor stream is read-only
+	*count = 0;
+	ReturnWithError(InvalidStreamPos);
+}
+
+//////////////////////////////////////////////////////////////////////
+void CPGFCursorStream::Read(int *count, void *buffPtr) THROW_ {
+	ASSERT(count);
+	ASSERT(buffPtr);
+	ASSERT(IsValid());
+	m_source->ReadAt(m_pos, count, buffPtr);
+	m_pos += *count;
+}
+
+//////////////////////////////////////////////////////////////////////
+void CPGFCursorStream::SetPos(short posMode, INT64 posOff) THROW_ {
+	ASSERT(IsValid());
+	switch(posMode) {
+	case FSFromStart:
+		if (posOff < 0) ReturnWithError(InvalidStreamPos);
+		m_pos = posOff;
+		break;
+	case FSFromCurrent:
+		if (posOff < 0 && UINT64(-posOff) > m_pos) ReturnWithError(InvalidStreamPos);
+		m_pos += posOff;
+		break;
+	default:
+		// the length of a positional stream is unknown
+		ReturnWithError(InvalidStreamPos);
+	}
+}
+
 
 //////////////////////////////////////////////////////////////////////
 // CPGFMemFileStream
@@ -0,0 +1,107 @@
+/*
+ * The Progressive Graphics File; http://www.libpgf.org
+ * 
+ * $Date$
+ * $Revision$
+ * 
+ * This file Copyright (C) 2026 xeraina GmbH, Switzerland
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU LESSER GENERAL PUBLIC LICENSE
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+//////////////////////////////////////////////////////////////////////
+/// @file SIMD.cpp
+/// @brief PGF SIMD support: runtime CPU dispatch
+/// @author C. Stamm
+
+#include "SIMD.h"
+
+#ifdef __PGFSIMDSUPPORT__
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+//////////////////////////////////////////////////////////////////////
+// Executes cpuid instruction
+static void CpuId(int info[4], int leaf, int subleaf) {
+#ifdef _MSC_VER
+	__cpuidex(info, leaf, subleaf);
+#else
+	unsigned int a, b, c, d;
+	__cpuid_count(leaf, subleaf, a, b, c, d);
+	info[0] = a; info[1] = b; info[2] = c; info[3] = d;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// Returns the register states the operating system saves on context switches
+static UINT32 XGetBV() {
+#ifdef _MSC_VER
+	return (UINT32)_xgetbv(0);
+#else
+	UINT32 eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return eax;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// Determines the best instruction set level supported by CPU, operating system, and compiler
+static SIMDLevel DetectSIMDLevel() {
+	int info[4];
+
+	CpuId(info, 0, 0);
+	const int maxLeaf = info[0];
+	if (maxLeaf < 1) return SIMD_None;
+
+	CpuId(info, 1, 0);
+	if (!(info[3] & (1 << 26))) return SIMD_None;			// SSE2
+	SIMDLevel level = SIMD_SSE2;
+
+#ifdef __PGFAVX2SUPPORT__
+	// AVX2 needs OS support of xmm/ymm state (osxsave)
+	if (maxLeaf < 7 || !(info[2] & (1 << 27))) return level;
+	const UINT32 xcr0 = XGetBV();
+	if ((xcr0 & 0x06) != 0x06) return level;
+
+	CpuId(info, 7, 0);
+	if (!(info[1] & (1 << 5))) return level;				// AVX2
+	level = SIMD_AVX2;
+
+	#ifdef __PGFAVX512SUPPORT__
+	// AVX-512 needs OS support of opmask and zmm state
+	if ((xcr0 & 0xE6) == 0xE6 && (info[1] & (1 << 16))) {	// AVX512F
+		level = SIMD_AVX512;
+	}
+	#endif
+#endif
+	return level;
+}
+
+// determined once during static initialization
+static const SIMDLevel s_simdLevel = DetectSIMDLevel();
+
+//////////////////////////////////////////////////////////////////////
+// Returns the best instruction set level supported by CPU, operating system, and compiler.
+// The level is determined once at program start.
+// @return Instruction set level
+SIMDLevel GetSIMDLevel() {
+	return s_simdLevel;
+}
+
+#endif //__PGFSIMDSUPPORT__
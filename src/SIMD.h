@@ -0,0 +1,73 @@
+/*
+ * The Progressive Graphics File; http://www.libpgf.org
+ * 
+ * $Date$
+ * $Revision$
+ * 
+ * This file Copyright (C) 2026 xeraina GmbH, Switzerland
+ * 
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU LESSER GENERAL PUBLIC LICENSE
+ * as published by the Free Software Foundation; either version 2.1
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ */
+
+//////////////////////////////////////////////////////////////////////
+/// @file SIMD.h
+/// @brief PGF SIMD support: compiler settings and runtime CPU dispatch
+/// @author C. Stamm
+
+#ifndef PGF_SIMD_H
+#define PGF_SIMD_H
+
+#include "PGFtypes.h"
+
+//-------------------------------------------------------------------------------
+// Compiler support of SIMD intrinsics.
+// Functions using a certain instruction set are compiled with PGF_SIMD_TARGET
+// and must only be called if GetSIMDLevel() reports that instruction set.
+//-------------------------------------------------------------------------------
+#ifdef __PGFSIMDSUPPORT__
+	#if defined(_MSC_VER)
+		#define PGF_SIMD_TARGET(isa)
+		#if _MSC_VER >= 1700
+			#define __PGFAVX2SUPPORT__
+		#endif
+		#if _MSC_VER >= 1911
+			#define __PGFAVX512SUPPORT__
+		#endif
+	#elif defined(__clang__) || (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+		#define PGF_SIMD_TARGET(isa) __attribute__((target(isa)))
+		#define __PGFAVX2SUPPORT__
+		#define __PGFAVX512SUPPORT__
+	#else
+		#undef __PGFSIMDSUPPORT__	// compiler doesn't support instruction set selection per function
+	#endif
+#endif
+
+#ifdef __PGFSIMDSUPPORT__
+#include <immintrin.h>
+
+//-------------------------------------------------------------------------------
+// Instruction set levels: a higher level includes all lower levels
+//-------------------------------------------------------------------------------
+enum SIMDLevel { SIMD_None, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512 };
+
+//////////////////////////////////////////////////////////////////////
+/// Returns the best instruction set level supported by CPU, operating system, and compiler.
+/// The level is determined once at program start.
+/// @return Instruction set level
+SIMDLevel GetSIMDLevel();
+
+#endif //__PGFSIMDSUPPORT__
+
+#endif //PGF_SIMD_H
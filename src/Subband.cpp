@@ -100,17 +100,22 @@ void CSubband::FreeMemory() {
 }
 
 /////////////////////////////////////////////////////////////////////
-// Perform subband quantization with given quantization parameter.
+// Perform quantization of a part of the subband buffer with given quantization parameter.
 // A scalar quantization (with dead-zone) is used. A large quantization value
 // results in strong quantization and therefore in big quality loss.
 // @param quantParam A quantization parameter (larger or equal to 0)
-void CSubband::Quantize(int quantParam) {
+// @param pos First buffer position
+// @param len Number of quantized wavelet coefficients
+void CSubband::Quantize(int quantParam, UINT32 pos, UINT32 len) {
+	const UINT32 end = pos + len;
+	ASSERT(end <= m_size);
+
 	if (m_orientation == LL) {
 		quantParam -= (m_level + 1);
 		// uniform rounding quantization
 		if (quantParam > 0) {
 			quantParam--;
-			for (UINT32 i=0; i < m_size; i++) {
+			for (UINT32 i=pos; i < end; i++) {
 				if (m_data[i] < 0) {
 					m_data[i] = -(((-m_data[i] >> quantParam) + 1) >> 1);
 				} else {
@@ -128,7 +133,7 @@ void CSubband::Quantize(int quantParam) {
 		if (quantParam > 0) {
 			int threshold = ((1 << quantParam) * 7)/5;	// good value
 			quantParam--;
-			for (UINT32 i=0; i < m_size; i++) {
+			for (UINT32 i=pos; i < end; i++) {
 				if (m_data[i] < -threshold) {
 					m_data[i] = -(((-m_data[i] >> quantParam) + 1) >> 1);
 				} else if (m_data[i] > threshold) {
@@ -163,13 +168,24 @@ void CSubband::Dequantize(int quantParam) {
 
 /////////////////////////////////////////////////////////////////////
 /// Extracts a rectangular subregion of this subband.
-/// Write wavelet coefficients into buffer.
+/// Write quantized wavelet coefficients into buffer. The subband itself is not quantized.
 /// It might throw an IOException.
 /// @param encoder An encoder instance
+/// @param quantParam Quantization value (0: the wavelet coefficients are already quantized)
 /// @param tile True if just a rectangular region is extracted, false if the entire subband is extracted.
 /// @param tileX Tile index in x-direction
 /// @param tileY Tile index in y-direction
-void CSubband::ExtractTile(CEncoder& encoder, bool tile /*= false*/, UINT32 tileX /*= 0*/, UINT32 tileY /*= 0*/) THROW_ {
+void CSubband::ExtractTile(CEncoder& encoder, int quantParam, bool tile /*= false*/, UINT32 tileX /*= 0*/, UINT32 tileY /*= 0*/) THROW_ {
+	// correct quantParam with normalization factor
+	if (m_orientation == LL) {
+		quantParam -= m_level + 1;
+	} else if (m_orientation == HH) {
+		quantParam -= m_level - 1;
+	} else {
+		quantParam -= m_level;
+	}
+	if (quantParam < 0) quantParam = 0;
+
 #ifdef __PGFROISUPPORT__
 	if (tile) {
 		// compute tile position and size
@@ -177,12 +193,13 @@ void CSubband::ExtractTile(CEncoder& encoder, bool tile /*= false*/, UINT32 tile
 		TilePosition(tileX, tileY, xPos, yPos, w, h);
 
 		// write values into buffer using partitiong scheme
-		encoder.Partition(this, w, h, xPos + yPos*m_width, m_width);
+		ASSERT(xPos >= m_ROI.left && yPos >= m_ROI.top);
+		encoder.Partition(this, quantParam, w, h, (xPos - m_ROI.left) + (yPos - m_ROI.top)*BufferWidth(), BufferWidth());
 	} else 
 #endif
 	{
 		// write values into buffer using partitiong scheme
-		encoder.Partition(this, m_width, m_height, 0, m_width);
+		encoder.Partition(this, quantParam, m_width, m_height, 0, m_width);
 	}
 }
 
@@ -225,6 +242,16 @@ void CSubband::PlaceTile(CDecoder& decoder, int quantParam, bool tile /*= false*
 	}
 }
 
+/////////////////////////////////////////////////////////////////////
+/// Sets all wavelet coefficients of this subband to zero instead of decoding them.
+/// It might throw an IOException.
+void CSubband::PlaceZeros() THROW_ {
+	// allocate memory
+	if (!AllocMemory()) ReturnWithError(InsufficientMemory);
+
+	memset(m_data, 0, m_size*DataTSize);
+}
+
 
 
 #ifdef __PGFROISUPPORT__
@@ -62,13 +62,14 @@ public:
 
 	/////////////////////////////////////////////////////////////////////
 	/// Extracts a rectangular subregion of this subband.
-	/// Write wavelet coefficients into buffer.
+	/// Write quantized wavelet coefficients into buffer. The subband itself is not quantized.
 	/// It might throw an IOException.
 	/// @param encoder An encoder instance
+	/// @param quantParam Quantization value (0: the wavelet coefficients are already quantized)
 	/// @param tile True if just a rectangular region is extracted, false if the entire subband is extracted.
 	/// @param tileX Tile index in x-direction
 	/// @param tileY Tile index in y-direction
-	void ExtractTile(CEncoder& encoder, bool tile = false, UINT32 tileX = 0, UINT32 tileY = 0) THROW_;
+	void ExtractTile(CEncoder& encoder, int quantParam, bool tile = false, UINT32 tileX = 0, UINT32 tileY = 0) THROW_;
 
 	/////////////////////////////////////////////////////////////////////
 	/// Decoding and dequantization of this subband.
@@ -80,12 +81,24 @@ public:
 	/// @param tileY Tile index in y-direction
 	void PlaceTile(CDecoder& decoder, int quantParam, bool tile = false, UINT32 tileX = 0, UINT32 tileY = 0) THROW_;
 
+	/////////////////////////////////////////////////////////////////////
+	/// Sets all wavelet coefficients of this subband to zero instead of decoding them.
+	/// It might throw an IOException.
+	void PlaceZeros() THROW_;
+
 	//////////////////////////////////////////////////////////////////////
 	/// Perform subband quantization with given quantization parameter.
 	/// A scalar quantization (with dead-zone) is used. A large quantization value
 	/// results in strong quantization and therefore in big quality loss.
 	/// @param quantParam A quantization parameter (larger or equal to 0)
-	void Quantize(int quantParam);
+	void Quantize(int quantParam)		{ Quantize(quantParam, 0, m_size); }
+
+	//////////////////////////////////////////////////////////////////////
+	/// Perform quantization of a part of the subband buffer with given quantization parameter.
+	/// @param quantParam A quantization parameter (larger or equal to 0)
+	/// @param pos First buffer position
+	/// @param len Number of quantized wavelet coefficients
+	void Quantize(int quantParam, UINT32 pos, UINT32 len);
 
 	//////////////////////////////////////////////////////////////////////
 	/// Perform subband dequantization with given quantization parameter.
@@ -150,6 +163,7 @@ private:
 	UINT32 GetBuffPos() const			{ return m_dataPos; }
 
 #ifdef __PGFROISUPPORT__
+	DataT* GetBuffRow(UINT32 row, UINT32 len) const	{ ASSERT(len <= BufferWidth()); const UINT32 pos = m_dataPos + row*BufferWidth(); ASSERT(pos + len <= m_size); (void)len; return m_data + pos; }
 	UINT32 BufferWidth() const			{ return m_ROI.Width(); }
 	void TilePosition(UINT32 tileX, UINT32 tileY, UINT32& left, UINT32& top, UINT32& w, UINT32& h) const;
 	const PGFRect& GetROI() const		{ return m_ROI; }
@@ -157,6 +171,7 @@ private:
 	void SetROI(const PGFRect& roi)		{ ASSERT(roi.right <= m_width); ASSERT(roi.bottom <= m_height); m_ROI = roi; }
 	void InitBuffPos(UINT32 left = 0, UINT32 top = 0)	{ m_dataPos = top*BufferWidth() + left; ASSERT(m_dataPos < m_size); }
 #else
+	DataT* GetBuffRow(UINT32 row, UINT32 len) const	{ const UINT32 pos = m_dataPos + row*len; ASSERT(pos + len <= m_size); return m_data + pos; }
 	void InitBuffPos()					{ m_dataPos = 0; }
 #endif
 
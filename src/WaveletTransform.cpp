@@ -27,10 +27,434 @@
 /// @author C. Stamm
 
 #include "WaveletTransform.h"
+#include "Encoder.h"
+#include "Decoder.h"
+#include "SIMD.h"
+#include <cstring>
+#include <new>
 
 #define c1 1	// best value 1
 #define c2 2	// best value 2
 
+#if defined(__PGFSIMDSUPPORT__) && defined(__PGF32SUPPORT__)
+// The SIMD lifting kernels work on 32 bit integers. In 16 bit mode the scalar code computes intermediate
+// results with int precision, hence the scalar code is used there.
+#define __PGFSIMDLIFTING__
+
+//////////////////////////////////////////////////////////////
+// SIMD lifting kernels of the middle part of ForwardRow and InverseRow.
+// The row is processed in blocks of n pairs (even, odd). Each block is loaded, split into a vector of 
+// even and a vector of odd samples, lifted, interleaved again and stored. The lifting steps need the 
+// last lifted value of the previous block, which is kept in a register (carry).
+// Every kernel processes the pairs j with jStart <= j < jEnd in blocks and returns the index of the
+// first pair not processed. The remaining pairs are processed by the scalar code.
+
+//////////////////////////////////////////////////////////////
+// Forward lifting of 4 pairs at a time (SSE2)
+PGF_SIMD_TARGET("sse2")
+static UINT32 ForwardRowSSE2(DataT* src, UINT32 j, UINT32 jEnd) {
+	__m128i prevOdd = _mm_cvtsi32_si128(src[2*j - 1]);	// lifted odd sample of pair j - 1 in lane 0
+	prevOdd = _mm_slli_si128(prevOdd, 12);				// ... moved to lane 3
+
+	for (; j + 4 <= jEnd; j += 4) {
+		DataT* p = src + 2*j;
+		const __m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)p));
+		const __m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(p + 4)));
+		__m128i even = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i odd = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		const __m128i nextEven = _mm_or_si128(_mm_srli_si128(even, 4), _mm_slli_si128(_mm_cvtsi32_si128(p[8]), 12));
+
+		// odd -= (even + nextEven + c1) >> 1
+		odd = _mm_sub_epi32(odd, _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(even, nextEven), _mm_set1_epi32(c1)), 1));
+		// even += (prevOdd + odd + c2) >> 2
+		const __m128i leftOdd = _mm_or_si128(_mm_slli_si128(odd, 4), _mm_srli_si128(prevOdd, 12));
+		even = _mm_add_epi32(even, _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(leftOdd, odd), _mm_set1_epi32(c2)), 2));
+		prevOdd = odd;
+
+		_mm_storeu_si128((__m128i*)p, _mm_unpacklo_epi32(even, odd));
+		_mm_storeu_si128((__m128i*)(p + 4), _mm_unpackhi_epi32(even, odd));
+	}
+	return j;
+}
+
+//////////////////////////////////////////////////////////////
+// Inverse lifting of 4 pairs at a time (SSE2)
+// In contrast to the forward lifting, a block stores the lifted even samples of pairs j..j+3 
+// and the lifted odd samples of pairs j-1..j+2.
+PGF_SIMD_TARGET("sse2")
+static UINT32 InverseRowSSE2(DataT* dest, UINT32 j, UINT32 jEnd) {
+	__m128i prevOdd = _mm_slli_si128(_mm_cvtsi32_si128(dest[2*j - 1]), 12);	// unlifted odd sample of pair j - 1 in lane 3
+	__m128i prevEven = _mm_slli_si128(_mm_cvtsi32_si128(dest[2*j - 2]), 12);	// lifted even sample of pair j - 1 in lane 3
+
+	for (; j + 4 <= jEnd; j += 4) {
+		DataT* p = dest + 2*j;
+		const __m128 a = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)p));
+		const __m128 b = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*)(p + 4)));
+		__m128i even = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		const __m128i odd = _mm_castps_si128(_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		__m128i leftOdd = _mm_or_si128(_mm_slli_si128(odd, 4), _mm_srli_si128(prevOdd, 12));
+
+		// even -= (leftOdd + odd + c2) >> 2
+		even = _mm_sub_epi32(even, _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(leftOdd, odd), _mm_set1_epi32(c2)), 2));
+		// leftOdd += (leftEven + even + c1) >> 1
+		const __m128i leftEven = _mm_or_si128(_mm_slli_si128(even, 4), _mm_srli_si128(prevEven, 12));
+		leftOdd = _mm_add_epi32(leftOdd, _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(leftEven, even), _mm_set1_epi32(c1)), 1));
+		prevOdd = odd;
+		prevEven = even;
+
+		_mm_storeu_si128((__m128i*)(p - 1), _mm_unpacklo_epi32(leftOdd, even));
+		_mm_storeu_si128((__m128i*)(p + 3), _mm_unpackhi_epi32(leftOdd, even));
+	}
+	return j;
+}
+
+#ifdef __PGFAVX2SUPPORT__
+//////////////////////////////////////////////////////////////
+// Forward lifting of 8 pairs at a time (AVX2)
+PGF_SIMD_TARGET("avx2")
+static UINT32 ForwardRowAVX2(DataT* src, UINT32 j, UINT32 jEnd) {
+	const __m256i shiftLeft = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);	// lane i gets lane i - 1
+	const __m256i shiftRight = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 7);	// lane i gets lane i + 1
+	__m256i prevOdd = _mm256_set1_epi32(src[2*j - 1]);
+
+	for (; j + 8 <= jEnd; j += 8) {
+		DataT* p = src + 2*j;
+		const __m256 a = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)p));
+		const __m256 b = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(p + 8)));
+		__m256i even = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i odd = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0));
+		const __m256i nextEven = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(even, shiftRight), _mm256_set1_epi32(p[16]), 0x80);
+
+		// odd -= (even + nextEven + c1) >> 1
+		odd = _mm256_sub_epi32(odd, _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(even, nextEven), _mm256_set1_epi32(c1)), 1));
+		// even += (prevOdd + odd + c2) >> 2
+		const __m256i leftOdd = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(odd, shiftLeft), _mm256_permutevar8x32_epi32(prevOdd, shiftLeft), 0x01);
+		even = _mm256_add_epi32(even, _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(leftOdd, odd), _mm256_set1_epi32(c2)), 2));
+		prevOdd = odd;
+
+		const __m256i lo = _mm256_unpacklo_epi32(even, odd), hi = _mm256_unpackhi_epi32(even, odd);
+		_mm256_storeu_si256((__m256i*)p, _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(p + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	return j;
+}
+
+//////////////////////////////////////////////////////////////
+// Inverse lifting of 8 pairs at a time (AVX2)
+PGF_SIMD_TARGET("avx2")
+static UINT32 InverseRowAVX2(DataT* dest, UINT32 j, UINT32 jEnd) {
+	const __m256i shiftLeft = _mm256_setr_epi32(7, 0, 1, 2, 3, 4, 5, 6);	// lane i gets lane i - 1
+	__m256i prevOdd = _mm256_set1_epi32(dest[2*j - 1]);
+	__m256i prevEven = _mm256_set1_epi32(dest[2*j - 2]);
+
+	for (; j + 8 <= jEnd; j += 8) {
+		DataT* p = dest + 2*j;
+		const __m256 a = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)p));
+		const __m256 b = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*)(p + 8)));
+		__m256i even = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))), _MM_SHUFFLE(3, 1, 2, 0));
+		const __m256i odd = _mm256_permute4x64_epi64(_mm256_castps_si256(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1))), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i leftOdd = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(odd, shiftLeft), _mm256_permutevar8x32_epi32(prevOdd, shiftLeft), 0x01);
+
+		// even -= (leftOdd + odd + c2) >> 2
+		even = _mm256_sub_epi32(even, _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(leftOdd, odd), _mm256_set1_epi32(c2)), 2));
+		// leftOdd += (leftEven + even + c1) >> 1
+		const __m256i leftEven = _mm256_blend_epi32(_mm256_permutevar8x32_epi32(even, shiftLeft), _mm256_permutevar8x32_epi32(prevEven, shiftLeft), 0x01);
+		leftOdd = _mm256_add_epi32(leftOdd, _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(leftEven, even), _mm256_set1_epi32(c1)), 1));
+		prevOdd = odd;
+		prevEven = even;
+
+		const __m256i lo = _mm256_unpacklo_epi32(leftOdd, even), hi = _mm256_unpackhi_epi32(leftOdd, even);
+		_mm256_storeu_si256((__m256i*)(p - 1), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i*)(p + 7), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+	return j;
+}
+#endif //__PGFAVX2SUPPORT__
+
+#ifdef __PGFAVX512SUPPORT__
+// arithmetic right shift of 16 values: the unmasked _mm512_srai_epi32 merges into an undefined vector (GCC warns about it)
+#define SRAI512(a, n) _mm512_maskz_srai_epi32(0xFFFF, (a), (n))
+
+//////////////////////////////////////////////////////////////
+// Forward lifting of 16 pairs at a time (AVX-512)
+PGF_SIMD_TARGET("avx512f")
+static UINT32 ForwardRowAVX512(DataT* src, UINT32 j, UINT32 jEnd) {
+	const __m512i evenIdx = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+	const __m512i oddIdx = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+	const __m512i loIdx = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+	const __m512i hiIdx = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+	const __m512i leftIdx = _mm512_setr_epi32(31, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14);	// lane 0 from 2nd operand
+	const __m512i rightIdx = _mm512_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16);	// lane 15 from 2nd operand
+	__m512i prevOdd = _mm512_set1_epi32(src[2*j - 1]);
+
+	for (; j + 16 <= jEnd; j += 16) {
+		DataT* p = src + 2*j;
+		const __m512i a = _mm512_loadu_si512(p);
+		const __m512i b = _mm512_loadu_si512(p + 16);
+		__m512i even = _mm512_permutex2var_epi32(a, evenIdx, b);
+		__m512i odd = _mm512_permutex2var_epi32(a, oddIdx, b);
+		const __m512i nextEven = _mm512_permutex2var_epi32(even, rightIdx, _mm512_set1_epi32(p[32]));
+
+		// odd -= (even + nextEven + c1) >> 1
+		odd = _mm512_sub_epi32(odd, SRAI512(_mm512_add_epi32(_mm512_add_epi32(even, nextEven), _mm512_set1_epi32(c1)), 1));
+		// even += (prevOdd + odd + c2) >> 2
+		const __m512i leftOdd = _mm512_permutex2var_epi32(odd, leftIdx, prevOdd);
+		even = _mm512_add_epi32(even, SRAI512(_mm512_add_epi32(_mm512_add_epi32(leftOdd, odd), _mm512_set1_epi32(c2)), 2));
+		prevOdd = odd;
+
+		_mm512_storeu_si512(p, _mm512_permutex2var_epi32(even, loIdx, odd));
+		_mm512_storeu_si512(p + 16, _mm512_permutex2var_epi32(even, hiIdx, odd));
+	}
+	return j;
+}
+
+//////////////////////////////////////////////////////////////
+// Inverse lifting of 16 pairs at a time (AVX-512)
+PGF_SIMD_TARGET("avx512f")
+static UINT32 InverseRowAVX512(DataT* dest, UINT32 j, UINT32 jEnd) {
+	const __m512i evenIdx = _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+	const __m512i oddIdx = _mm512_setr_epi32(1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+	const __m512i loIdx = _mm512_setr_epi32(0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+	const __m512i hiIdx = _mm512_setr_epi32(8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+	const __m512i leftIdx = _mm512_setr_epi32(31, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14);	// lane 0 from 2nd operand
+	__m512i prevOdd = _mm512_set1_epi32(dest[2*j - 1]);
+	__m512i prevEven = _mm512_set1_epi32(dest[2*j - 2]);
+
+	for (; j + 16 <= jEnd; j += 16) {
+		DataT* p = dest + 2*j;
+		const __m512i a = _mm512_loadu_si512(p);
+		const __m512i b = _mm512_loadu_si512(p + 16);
+		__m512i even = _mm512_permutex2var_epi32(a, evenIdx, b);
+		const __m512i odd = _mm512_permutex2var_epi32(a, oddIdx, b);
+		__m512i leftOdd = _mm512_permutex2var_epi32(odd, leftIdx, prevOdd);
+
+		// even -= (leftOdd + odd + c2) >> 2
+		even = _mm512_sub_epi32(even, SRAI512(_mm512_add_epi32(_mm512_add_epi32(leftOdd, odd), _mm512_set1_epi32(c2)), 2));
+		// leftOdd += (leftEven + even + c1) >> 1
+		const __m512i leftEven = _mm512_permutex2var_epi32(even, leftIdx, prevEven);
+		leftOdd = _mm512_add_epi32(leftOdd, SRAI512(_mm512_add_epi32(_mm512_add_epi32(leftEven, even), _mm512_set1_epi32(c1)), 1));
+		prevOdd = odd;
+		prevEven = even;
+
+		_mm512_storeu_si512(p - 1, _mm512_permutex2var_epi32(leftOdd, loIdx, even));
+		_mm512_storeu_si512(p + 15, _mm512_permutex2var_epi32(leftOdd, hiIdx, even));
+	}
+	return j;
+}
+#endif //__PGFAVX512SUPPORT__
+
+//////////////////////////////////////////////////////////////
+// Forward lifting of the middle part of a row with the best available instruction set.
+// @param src Row
+// @param j Index of the first pair (even, odd) to process
+// @param jEnd Index of the pair after the last pair of the middle part
+// @return Index of the first unprocessed pair
+static UINT32 ForwardRowSIMD(DataT* src, UINT32 j, UINT32 jEnd) {
+	// the rest of a wider instruction set is processed with smaller blocks
+	const SIMDLevel level = GetSIMDLevel();
+#ifdef __PGFAVX512SUPPORT__
+	if (level >= SIMD_AVX512) j = ForwardRowAVX512(src, j, jEnd);
+#endif
+#ifdef __PGFAVX2SUPPORT__
+	if (level >= SIMD_AVX2) j = ForwardRowAVX2(src, j, jEnd);
+#endif
+	if (level >= SIMD_SSE2) j = ForwardRowSSE2(src, j, jEnd);
+	return j;
+}
+
+//////////////////////////////////////////////////////////////
+// Inverse lifting of the middle part of a row with the best available instruction set.
+// @param dest Row
+// @param j Index of the first pair (even, odd) to process
+// @param jEnd Index of the pair after the last pair of the middle part
+// @return Index of the first unprocessed pair
+static UINT32 InverseRowSIMD(DataT* dest, UINT32 j, UINT32 jEnd) {
+	// the rest of a wider instruction set is processed with smaller blocks
+	const SIMDLevel level = GetSIMDLevel();
+#ifdef __PGFAVX512SUPPORT__
+	if (level >= SIMD_AVX512) j = InverseRowAVX512(dest, j, jEnd);
+#endif
+#ifdef __PGFAVX2SUPPORT__
+	if (level >= SIMD_AVX2) j = InverseRowAVX2(dest, j, jEnd);
+#endif
+	if (level >= SIMD_SSE2) j = InverseRowSSE2(dest, j, jEnd);
+	return j;
+}
+//////////////////////////////////////////////////////////////
+// Forward vertical lifting of 4 columns at a time (SSE2)
+PGF_SIMD_TARGET("sse2")
+static UINT32 ForwardColumnsSSE2(DataT* row0, DataT* row1, DataT* row2, const DataT* row3, UINT32 k, UINT32 kEnd) {
+	for (; k + 4 <= kEnd; k += 4) {
+		const __m128i r1 = _mm_loadu_si128((const __m128i*)(row1 + k));
+		// row2 -= (row1 + row3 + c1) >> 1
+		const __m128i r2 = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(row2 + k)), _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(r1, _mm_loadu_si128((const __m128i*)(row3 + k))), _mm_set1_epi32(c1)), 1));
+		_mm_storeu_si128((__m128i*)(row2 + k), r2);
+		// row1 += (row0 + row2 + c2) >> 2
+		_mm_storeu_si128((__m128i*)(row1 + k), _mm_add_epi32(r1, _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(row0 + k)), r2), _mm_set1_epi32(c2)), 2)));
+	}
+	return k;
+}
+
+//////////////////////////////////////////////////////////////
+// Inverse vertical lifting of 4 columns at a time (SSE2)
+PGF_SIMD_TARGET("sse2")
+static UINT32 InverseColumnsSSE2(DataT* row0, DataT* row1, DataT* row2, const DataT* row3, UINT32 k, UINT32 kEnd) {
+	for (; k + 4 <= kEnd; k += 4) {
+		const __m128i r1 = _mm_loadu_si128((const __m128i*)(row1 + k));
+		// row2 -= (row1 + row3 + c2) >> 2
+		const __m128i r2 = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(row2 + k)), _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(r1, _mm_loadu_si128((const __m128i*)(row3 + k))), _mm_set1_epi32(c2)), 2));
+		_mm_storeu_si128((__m128i*)(row2 + k), r2);
+		// row1 += (row0 + row2 + c1) >> 1
+		_mm_storeu_si128((__m128i*)(row1 + k), _mm_add_epi32(r1, _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_loadu_si128((const __m128i*)(row0 + k)), r2), _mm_set1_epi32(c1)), 1)));
+	}
+	return k;
+}
+
+#ifdef __PGFAVX2SUPPORT__
+//////////////////////////////////////////////////////////////
+// Forward vertical lifting of 8 columns at a time (AVX2)
+PGF_SIMD_TARGET("avx2")
+static UINT32 ForwardColumnsAVX2(DataT* row0, DataT* row1, DataT* row2, const DataT* row3, UINT32 k, UINT32 kEnd) {
+	for (; k + 8 <= kEnd; k += 8) {
+		const __m256i r1 = _mm256_loadu_si256((const __m256i*)(row1 + k));
+		// row2 -= (row1 + row3 + c1) >> 1
+		const __m256i r2 = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(row2 + k)), _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(r1, _mm256_loadu_si256((const __m256i*)(row3 + k))), _mm256_set1_epi32(c1)), 1));
+		_mm256_storeu_si256((__m256i*)(row2 + k), r2);
+		// row1 += (row0 + row2 + c2) >> 2
+		_mm256_storeu_si256((__m256i*)(row1 + k), _mm256_add_epi32(r1, _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(row0 + k)), r2), _mm256_set1_epi32(c2)), 2)));
+	}
+	return k;
+}
+
+//////////////////////////////////////////////////////////////
+// Inverse vertical lifting of 8 columns at a time (AVX2)
+PGF_SIMD_TARGET("avx2")
+static UINT32 InverseColumnsAVX2(DataT* row0, DataT* row1, DataT* row2, const DataT* row3, UINT32 k, UINT32 kEnd) {
+	for (; k + 8 <= kEnd; k += 8) {
+		const __m256i r1 = _mm256_loadu_si256((const __m256i*)(row1 + k));
+		// row2 -= (row1 + row3 + c2) >> 2
+		const __m256i r2 = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(row2 + k)), _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(r1, _mm256_loadu_si256((const __m256i*)(row3 + k))), _mm256_set1_epi32(c2)), 2));
+		_mm256_storeu_si256((__m256i*)(row2 + k), r2);
+		// row1 += (row0 + row2 + c1) >> 1
+		_mm256_storeu_si256((__m256i*)(row1 + k), _mm256_add_epi32(r1, _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(row0 + k)), r2), _mm256_set1_epi32(c1)), 1)));
+	}
+	return k;
+}
+
+#endif //__PGFAVX2SUPPORT__
+
+#ifdef __PGFAVX512SUPPORT__
+//////////////////////////////////////////////////////////////
+// Forward vertical lifting of 16 columns at a time (AVX-512)
+PGF_SIMD_TARGET("avx512f")
+static UINT32 ForwardColumnsAVX512(DataT* row0, DataT* row1, DataT* row2, const DataT* row3, UINT32 k, UINT32 kEnd) {
+	for (; k + 16 <= kEnd; k += 16) {
+		const __m512i r1 = _mm512_loadu_si512(row1 + k);
+		// row2 -= (row1 + row3 + c1) >> 1
+		const __m512i r2 = _mm512_sub_epi32(_mm512_loadu_si512(row2 + k), SRAI512(_mm512_add_epi32(_mm512_add_epi32(r1, _mm512_loadu_si512(row3 + k)), _mm512_set1_epi32(c1)), 1));
+		_mm512_storeu_si512(row2 + k, r2);
+		// row1 += (row0 + row2 + c2) >> 2
+		_mm512_storeu_si512(row1 + k, _mm512_add_epi32(r1, SRAI512(_mm512_add_epi32(_mm512_add_epi32(_mm512_loadu_si512(row0 + k), r2), _mm512_set1_epi32(c2)), 2)));
+	}
+	return k;
+}
+
+//////////////////////////////////////////////////////////////
+// Inverse vertical lifting of 16 columns at a time (AVX-512)
+PGF_SIMD_TARGET("avx512f")
+static UINT32 InverseColumnsAVX512(DataT* row0, DataT* row1, DataT* row2, const DataT* row3, UINT32 k, UINT32 kEnd) {
+	for (; k + 16 <= kEnd; k += 16) {
+		const __m512i r1 = _mm512_loadu_si512(row1 + k);
+		// row2 -= (row1 + row3 + c2) >> 2
+		const __m512i r2 = _mm512_sub_epi32(_mm512_loadu_si512(row2 + k), SRAI512(_mm512_add_epi32(_mm512_add_epi32(r1, _mm512_loadu_si512(row3 + k)), _mm512_set1_epi32(c2)), 2));
+		_mm512_storeu_si512(row2 + k, r2);
+		// row1 += (row0 + row2 + c1) >> 1
+		_mm512_storeu_si512(row1 + k, _mm512_add_epi32(r1, SRAI512(_mm512_add_epi32(_mm512_add_epi32(_mm512_loadu_si512(row0 + k), r2), _mm512_set1_epi32(c1)), 1)));
+	}
+	return k;
+}
+
+#endif //__PGFAVX512SUPPORT__
+
+//////////////////////////////////////////////////////////////
+// Forward vertical lifting of the columns [k, kEnd) with the best available instruction set.
+// @param row0 Row above row1
+// @param row1 Row above row2 (lifted with row0 and row2)
+// @param row2 Row above row3 (lifted with row1 and row3)
+// @param row3 Row below row2
+// @param k First column
+// @param kEnd Column after the last column
+// @return First unprocessed column
+static UINT32 ForwardColumnsSIMD(DataT* row0, DataT* row1, DataT* row2, const DataT* row3, UINT32 k, UINT32 kEnd) {
+	// the rest of a wider instruction set is processed with smaller blocks
+	const SIMDLevel level = GetSIMDLevel();
+#ifdef __PGFAVX512SUPPORT__
+	if (level >= SIMD_AVX512) k = ForwardColumnsAVX512(row0, row1, row2, row3, k, kEnd);
+#endif
+#ifdef __PGFAVX2SUPPORT__
+	if (level >= SIMD_AVX2) k = ForwardColumnsAVX2(row0, row1, row2, row3, k, kEnd);
+#endif
+	if (level >= SIMD_SSE2) k = ForwardColumnsSSE2(row0, row1, row2, row3, k, kEnd);
+	return k;
+}
+
+//////////////////////////////////////////////////////////////
+// Inverse vertical lifting of the columns [k, kEnd) with the best available instruction set.
+// @param row0 Row above row1
+// @param row1 Row above row2 (lifted with row0 and row2)
+// @param row2 Row above row3 (lifted with row1 and row3)
+// @param row3 Row below row2
+// @param k First column
+// @param kEnd Column after the last column
+// @return First unprocessed column
+static UINT32 InverseColumnsSIMD(DataT* row0, DataT* row1, DataT* row2, const DataT* row3, UINT32 k, UINT32 kEnd) {
+	// the rest of a wider instruction set is processed with smaller blocks
+	const SIMDLevel level = GetSIMDLevel();
+#ifdef __PGFAVX512SUPPORT__
+	if (level >= SIMD_AVX512) k = InverseColumnsAVX512(row0, row1, row2, row3, k, kEnd);
+#endif
+#ifdef __PGFAVX2SUPPORT__
+	if (level >= SIMD_AVX2) k = InverseColumnsAVX2(row0, row1, row2, row3, k, kEnd);
+#endif
+	if (level >= SIMD_SSE2) k = InverseColumnsSSE2(row0, row1, row2, row3, k, kEnd);
+	return k;
+}
+
+#endif //__PGFSIMDLIFTING__
+
+//////////////////////////////////////////////////////////////////////
+// Returns the number of horizontal bands a transform level is split into.
+// Each band is transformed by its own thread, so the number of threads depends on the size of the level.
+// Inside a parallel region the bands are transformed by tasks of the enclosing team.
+// @param width Level width
+// @param height Level height
+// @param maxThreads Maximum number of threads
+// @return Number of bands
+static int NumberOfBands(UINT32 width, UINT32 height, int maxThreads) {
+#ifdef LIBPGF_USE_OPENMP
+#ifdef LIBPGF_USE_OPENMP_TASKS
+	if (omp_in_parallel()) maxThreads = __min(maxThreads, omp_get_num_threads());
+#else
+	if (omp_in_parallel()) return 1; // no nested parallelism
+#endif
+	const UINT64 nBands = __min((UINT64)width*height/MinBandSize, height/MinBandHeight);
+	return (nBands < (UINT64)maxThreads) ? __max(1, (int)nBands) : maxThreads;
+#else
+	(void)width; (void)height; (void)maxThreads;
+	return 1;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// Returns the first row of a band.
+// @param band Band index (0 <= band <= nBands)
+// @param nBands Number of bands
+// @param height Level height
+// @return First row of the band (even) or height if band == nBands
+static UINT32 BandTop(int band, int nBands, UINT32 height) {
+	return (band == nBands) ? height : (UINT32)((UINT64)(height >> 1)*band/nBands) << 1;
+}
+
 //////////////////////////////////////////////////////////////////////////
 // Constructor: Constructs a wavelet transform pyramid of given size and levels.
 // @param width The width of the original image (at level 0) in pixels
@@ -40,6 +464,10 @@
 CWaveletTransform::CWaveletTransform(UINT32 width, UINT32 height, int levels, DataT* data) 
 : m_nLevels(levels + 1)
 , m_subband(0) 
+#ifdef __PGFROISUPPORT__
+, m_lines(0)
+, m_quant(0)
+#endif
 {
 	ASSERT(m_nLevels > 0 && m_nLevels <= MaxLevel + 1);
 	InitSubbands(width, height, data);
@@ -84,8 +512,9 @@ void CWaveletTransform::InitSubbands(UINT32 width, UINT32 height, DataT* data) {
 // low pass filter at odd positions: 1/8(-1, 2, 6, 2, -1)
 // @param level A wavelet transform pyramid level (>= 0 && < Levels())
 // @param quant A quantization value (linear scalar quantization)
+// @param maxThreads Maximum number of threads used to transform the level
 // @return error in case of a memory allocation problem
-OSError CWaveletTransform::ForwardTransform(int level, int quant) {
+OSError CWaveletTransform::ForwardTransform(int level, int quant, int maxThreads) {
 	ASSERT(level >= 0 && level < m_nLevels - 1);
 	const int destLevel = level + 1;
 	ASSERT(m_subband[destLevel]);
@@ -93,7 +522,6 @@ OSError CWaveletTransform::ForwardTransform(int level, int quant) {
 	const UINT32 width = srcBand->GetWidth();
 	const UINT32 height = srcBand->GetHeight();
 	DataT* src = srcBand->GetBuffer(); ASSERT(src);
-	DataT *row0, *row1, *row2, *row3;
 
 	// Allocate memory for next transform level
 	for (int i=0; i < NSubbands; i++) {
@@ -101,60 +529,54 @@ OSError CWaveletTransform::ForwardTransform(int level, int quant) {
 	}
 
  	if (height >= FilterHeight) {
-		// transform LL subband
-		// top border handling
-		row0 = src; row1 = row0 + width; row2 = row1 + width;
-		ForwardRow(row0, width);
-		ForwardRow(row1, width);
-		ForwardRow(row2, width);
-		for (UINT32 k=0; k < width; k++) {
-			row1[k] -= ((row0[k] + row2[k] + c1) >> 1);
-			row0[k] += ((row1[k] + c1) >> 1);
-		}
-		LinearToMallat(destLevel, row0, row1, width);
-		row0 = row1; row1 = row2; row2 += width; row3 = row2 + width;
+		// transform LL subband in horizontal bands
+		const int nBands = NumberOfBands(width, height, maxThreads);
 
-		// middle part
-		for (UINT32 i=3; i < height-1; i += 2) {
-			ForwardRow(row2, width);
-			ForwardRow(row3, width);
-			for (UINT32 k=0; k < width; k++) {
-				row2[k] -= ((row1[k] + row3[k] + c1) >> 1);
-				row1[k] += ((row0[k] + row2[k] + c2) >> 2);
+		if (nBands > 1) {
+			// the two rows above and the row below a band are transformed in place by the neighbouring bands,
+			// hence each band border gets copies of these rows (halo)
+			DataT* halo = new(std::nothrow) DataT[3*(nBands - 1)*width];
+			if (!halo) return InsufficientMemory;
+			for (int b=1; b < nBands; b++) {
+				memcpy(halo + 3*(b - 1)*width, src + (BandTop(b, nBands, height) - 2)*width, 3*width*DataTSize);
 			}
-			LinearToMallat(destLevel, row1, row2, width);
-			row0 = row2; row1 = row3; row2 = row3 + width; row3 = row2 + width;
-		}
 
-		// bottom border handling
-		if (height & 1) {
-			for (UINT32 k=0; k < width; k++) {
-				row1[k] += ((row0[k] + c1) >> 1);
+#ifdef LIBPGF_USE_OPENMP_TASKS
+			if (omp_in_parallel()) {
+				for (int b=0; b < nBands; b++) {
+					DataT* above = (b > 0) ? halo + 3*(b - 1)*width : NULL;
+					DataT* below = (b < nBands - 1) ? halo + (3*b + 2)*width : NULL;
+					#pragma omp task default(shared) firstprivate(b, above, below)
+					ForwardBand(destLevel, src, width, height, BandTop(b, nBands, height), BandTop(b + 1, nBands, height), above, below);
+				}
+				#pragma omp taskwait
+			} else
+#endif
+			{
+				#pragma omp parallel for default(shared) num_threads(nBands)
+				for (int b=0; b < nBands; b++) {
+					DataT* above = (b > 0) ? halo + 3*(b - 1)*width : NULL;
+					DataT* below = (b < nBands - 1) ? halo + (3*b + 2)*width : NULL;
+					ForwardBand(destLevel, src, width, height, BandTop(b, nBands, height), BandTop(b + 1, nBands, height), above, below);
+				}
 			}
-			LinearToMallat(destLevel, row1, NULL, width);
-			row0 = row1; row1 += width;
+			delete[] halo;
 		} else {
-			ForwardRow(row2, width);
-			for (UINT32 k=0; k < width; k++) {
-				row2[k] -= row1[k];
-				row1[k] += ((row0[k] + row2[k] + c2) >> 2);
-			}
-			LinearToMallat(destLevel, row1, row2, width);
-			row0 = row1; row1 = row2; row2 += width;
+			ForwardBand(destLevel, src, width, height, 0, height, NULL, NULL);
 		}
 	} else {
 		// if height is too small
-		row0 = src; row1 = row0 + width;
+		DataT *row0 = src, *row1 = row0 + width;
 		// first part
 		for (UINT32 k=0; k < height; k += 2) {
 			ForwardRow(row0, width);
 			ForwardRow(row1, width);
-			LinearToMallat(destLevel, row0, row1, width);
+			LinearToMallat(destLevel, k >> 1, row0, row1, 0, width);
 			row0 += width << 1; row1 += width << 1;
 		}
 		// bottom
 		if (height & 1) {
-			LinearToMallat(destLevel, row0, NULL, width);
+			LinearToMallat(destLevel, height >> 1, row0, NULL, 0, width);
 		}
 	}
 
@@ -174,59 +596,177 @@ OSError CWaveletTransform::ForwardTransform(int level, int quant) {
 	return NoError;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Forward transform of the rows [top, bottom) of the LL subband at level destLevel - 1.
+// Stores the result in the subbands of destLevel. Several bands can be transformed in parallel.
+// @param destLevel Destination level
+// @param src LL subband buffer
+// @param width LL subband width
+// @param height LL subband height
+// @param top First row of the band (even)
+// @param bottom Row after the last row of the band (even or height)
+// @param above Copy of the two rows above the band or NULL if top is 0
+// @param below Copy of the row below the band or NULL if bottom is height
+void CWaveletTransform::ForwardBand(int destLevel, DataT* src, UINT32 width, UINT32 height, UINT32 top, UINT32 bottom, DataT* above, DataT* below) {
+	ASSERT(!(top & 1) && top + FilterHeight <= bottom && bottom <= height);
+	ASSERT(!(bottom & 1) || bottom == height);
+	DataT *row0, *row1, *row2, *row3;
+	UINT32 i;
+
+	if (top == 0) {
+		// top border handling
+		row0 = src; row1 = row0 + width; row2 = row1 + width;
+		ForwardRow(row0, width);
+		ForwardRow(row1, width);
+		ForwardRow(row2, width);
+		for (UINT32 k=0; k < width; k++) {
+			row1[k] -= ((row0[k] + row2[k] + c1) >> 1);
+			row0[k] += ((row1[k] + c1) >> 1);
+		}
+		LinearToMallat(destLevel, 0, row0, row1, 0, width);
+		row0 = row1; row1 = row2;
+		i = 3;
+	} else {
+		// halo handling: lift odd row top - 1 in the copy
+		ASSERT(above);
+		row0 = above + width; row1 = src + top*width;
+		ForwardRow(above, width);
+		ForwardRow(row0, width);
+		ForwardRow(row1, width);
+		for (UINT32 k=0; k < width; k++) {
+			row0[k] -= ((above[k] + row1[k] + c1) >> 1);
+		}
+		i = top + 1;
+	}
+
+	// middle part
+	const UINT32 rowEnd = (below) ? bottom : height - 1;
+	for (; i < rowEnd; i += 2) {
+		row2 = row1 + width;
+		row3 = (i + 1 < bottom) ? row2 + width : below;
+
+		// horizontal and vertical lifting in column strips
+		UINT32 left = 0; // first column not yet lifted vertically
+		for (UINT32 x=0; x < width; x += StripWidth) {
+			const UINT32 right = __min(x + StripWidth, width);
+			ForwardRow(row2, width, x, right);
+			ForwardRow(row3, width, x, right);
+			// the last odd column of a strip is still needed by the horizontal lifting of the next strip
+			const UINT32 end = (right < width) ? right - 2 : width;
+			UINT32 k = left;
+		#ifdef __PGFSIMDLIFTING__
+			k = ForwardColumnsSIMD(row0, row1, row2, row3, k, end);
+		#endif
+			for (; k < end; k++) {
+				row2[k] -= ((row1[k] + row3[k] + c1) >> 1);
+				row1[k] += ((row0[k] + row2[k] + c2) >> 2);
+			}
+			LinearToMallat(destLevel, (i - 1) >> 1, row1, row2, left, end);
+			left = end;
+		}
+		row0 = row2; row1 = row3;
+	}
+
+	if (!below) {
+		// bottom border handling
+		if (height & 1) {
+			for (UINT32 k=0; k < width; k++) {
+				row1[k] += ((row0[k] + c1) >> 1);
+			}
+			LinearToMallat(destLevel, (i - 1) >> 1, row1, NULL, 0, width);
+		} else {
+			row2 = row1 + width;
+			ForwardRow(row2, width);
+			for (UINT32 k=0; k < width; k++) {
+				row2[k] -= row1[k];
+				row1[k] += ((row0[k] + row2[k] + c2) >> 2);
+			}
+			LinearToMallat(destLevel, (i - 1) >> 1, row1, row2, 0, width);
+		}
+	}
+}
+
 //////////////////////////////////////////////////////////////
-// Forward transform one row
+// Forward transform of the columns [begin, end) of one row.
+// The columns left of begin must have been transformed before.
 // high pass filter at even positions: 1/4(-2, 4, -2)
 // low pass filter at odd positions: 1/8(-1, 2, 6, 2, -1)
-void CWaveletTransform::ForwardRow(DataT* src, UINT32 width) {
+// @param src Row
+// @param width Row width
+// @param begin First column (even)
+// @param end Column after the last column (even or width)
+void CWaveletTransform::ForwardRow(DataT* src, UINT32 width, UINT32 begin, UINT32 end) {
 	if (width >= FilterWidth) {
-		UINT32 i = 3;
+		ASSERT(!(begin & 1) && begin < end && end <= width);
+		ASSERT(!(end & 1) || end == width);
+		const UINT32 last = __min(end, width - 1);
+		UINT32 i = begin + 1;
 
-		// left border handling
-		src[1] -= ((src[0] + src[2] + c1) >> 1);
-		src[0] += ((src[1] + c1) >> 1);
+		if (begin == 0) {
+			// left border handling
+			src[1] -= ((src[0] + src[2] + c1) >> 1);
+			src[0] += ((src[1] + c1) >> 1);
+			i = 3;
+		}
 		
 		// middle part
-		for (; i < width-1; i += 2) {
+	#ifdef __PGFSIMDLIFTING__
+		i = 2*ForwardRowSIMD(src, i >> 1, last >> 1) + 1;
+	#endif
+		for (; i < last; i += 2) {
 			src[i] -= ((src[i-1] + src[i+1] + c1) >> 1);
 			src[i-1] += ((src[i-2] + src[i] + c2) >> 2);
 		}
 
-		// right border handling
-		if (width & 1) {
-			src[i-1] += ((src[i-2] + c1) >> 1);
-		} else {
-			src[i] -= src[i-1];
-			src[i-1] += ((src[i-2] + src[i] + c2) >> 2);
+		if (end == width) {
+			// right border handling
+			if (width & 1) {
+				src[i-1] += ((src[i-2] + c1) >> 1);
+			} else {
+				src[i] -= src[i-1];
+				src[i-1] += ((src[i-2] + src[i] + c2) >> 2);
+			}
 		}
 	}
 }
 
 /////////////////////////////////////////////////////////////////
-// Copy transformed rows loRow and hiRow to subbands LL,HL,LH,HH
-void CWaveletTransform::LinearToMallat(int destLevel, DataT* loRow, DataT* hiRow, UINT32 width) {
-	const UINT32 wquot = width >> 1;
-	const bool wrem = width & 1;
+// Copy the columns [begin, end) of transformed rows loRow and hiRow to subbands LL,HL,LH,HH
+// @param destLevel Destination level
+// @param row Subband row
+// @param loRow Transformed even row
+// @param hiRow Transformed odd row or NULL
+// @param begin First column (even)
+// @param end Column after the last column
+void CWaveletTransform::LinearToMallat(int destLevel, UINT32 row, DataT* loRow, DataT* hiRow, UINT32 begin, UINT32 end) {
+	const UINT32 wquot = (end - begin) >> 1;
+	const bool wrem = (end - begin) & 1;
 	CSubband &ll = m_subband[destLevel][LL], &hl = m_subband[destLevel][HL];
 	CSubband &lh = m_subband[destLevel][LH], &hh = m_subband[destLevel][HH];
+	DataT *llBuff = ll.GetBuffRow(row, ll.GetWidth()) + (begin >> 1), *hlBuff = hl.GetBuffRow(row, hl.GetWidth()) + (begin >> 1);
+	ASSERT(!(begin & 1));
+	loRow += begin;
 
 	if (hiRow) {
+		DataT *lhBuff = lh.GetBuffRow(row, lh.GetWidth()) + (begin >> 1), *hhBuff = hh.GetBuffRow(row, hh.GetWidth()) + (begin >> 1);
+		hiRow += begin;
+
 		for (UINT32 i=0; i < wquot; i++) {
-			ll.WriteBuffer(*loRow++);	// first access, than increment
-			hl.WriteBuffer(*loRow++);
-			lh.WriteBuffer(*hiRow++);	// first access, than increment
-			hh.WriteBuffer(*hiRow++);
+			llBuff[i] = *loRow++;	// first access, than increment
+			hlBuff[i] = *loRow++;
+			lhBuff[i] = *hiRow++;	// first access, than increment
+			hhBuff[i] = *hiRow++;
 		}
 		if (wrem) {
-			ll.WriteBuffer(*loRow);
-			lh.WriteBuffer(*hiRow);
+			llBuff[wquot] = *loRow;
+			lhBuff[wquot] = *hiRow;
 		}
 	} else {
 		for (UINT32 i=0; i < wquot; i++) {
-			ll.WriteBuffer(*loRow++);	// first access, than increment
-			hl.WriteBuffer(*loRow++);
+			llBuff[i] = *loRow++;	// first access, than increment
+			hlBuff[i] = *loRow++;
 		}
-		if (wrem) ll.WriteBuffer(*loRow);
+		if (wrem) llBuff[wquot] = *loRow;
 	}
 }
 
@@ -241,8 +781,9 @@ void CWaveletTransform::LinearToMallat(int destLevel, DataT* loRow, DataT* hiRow
 // @param w [out] A pointer to the returned width of subband LL (in pixels)
 // @param h [out] A pointer to the returned height of subband LL (in pixels)
 // @param data [out] A pointer to the returned array of image data
+// @param maxThreads Maximum number of threads used to transform the level
 // @return error in case of a memory allocation problem
-OSError CWaveletTransform::InverseTransform(int srcLevel, UINT32* w, UINT32* h, DataT** data) {
+OSError CWaveletTransform::InverseTransform(int srcLevel, UINT32* w, UINT32* h, DataT** data, int maxThreads) {
 	ASSERT(srcLevel > 0 && srcLevel < m_nLevels);
 	const int destLevel = srcLevel - 1;
 	ASSERT(m_subband[destLevel]);
@@ -251,7 +792,7 @@ OSError CWaveletTransform::InverseTransform(int srcLevel, UINT32* w, UINT32* h,
 
 	// allocate memory for the results of the inverse transform 
 	if (!destBand->AllocMemory()) return InsufficientMemory;
-	DataT *dest = destBand->GetBuffer(), *origin = dest, *row0, *row1, *row2, *row3;
+	DataT *dest = destBand->GetBuffer(), *origin = dest;
 
 #ifdef __PGFROISUPPORT__
 	PGFRect destROI = destBand->GetROI();	// is valid only after AllocMemory
@@ -281,7 +822,6 @@ OSError CWaveletTransform::InverseTransform(int srcLevel, UINT32* w, UINT32* h,
 #else
 	width = destBand->GetWidth();
 	height = destBand->GetHeight();
-	PGFRect destROI(0, 0, width, height);
 	const UINT32 destWidth = width; // destination buffer width
 	const UINT32 destHeight = height; // destination buffer height
 
@@ -292,58 +832,46 @@ OSError CWaveletTransform::InverseTransform(int srcLevel, UINT32* w, UINT32* h,
 #endif
 
 	if (destHeight >= FilterHeight) {
-		// top border handling
-		row0 = origin; row1 = row0 + destWidth;
-		MallatToLinear(srcLevel, row0, row1, width);
-		for (UINT32 k=0; k < width; k++) {
-			row0[k] -= ((row1[k] + c1) >> 1);
-		}
+		// inverse transform in horizontal bands
+		const int nBands = NumberOfBands(width, height, maxThreads);
 
-		// middle part
-		row2 = row1 + destWidth; row3 = row2 + destWidth;
-		for (UINT32 i=destROI.top + 2; i < destROI.bottom - 1; i += 2) {
-			MallatToLinear(srcLevel, row2, row3, width);
-			for (UINT32 k=0; k < width; k++) {
-				row2[k] -= ((row1[k] + row3[k] + c2) >> 2);
-				row1[k] += ((row0[k] + row2[k] + c1) >> 1);
-			}
-			InverseRow(row0, width);
-			InverseRow(row1, width);
-			row0 = row2; row1 = row3; row2 = row1 + destWidth; row3 = row2 + destWidth;
-		}
+		if (nBands > 1) {
+			// each band reads the subband rows next to its borders again into two private rows (halo)
+			DataT* halo = new(std::nothrow) DataT[2*nBands*width];
+			if (!halo) return InsufficientMemory;
 
-		// bottom border handling
-		if (height & 1) {
-			MallatToLinear(srcLevel, row2, NULL, width);
-			for (UINT32 k=0; k < width; k++) {
-				row2[k] -= ((row1[k] + c1) >> 1);
-				row1[k] += ((row0[k] + row2[k] + c1) >> 1);
+#ifdef LIBPGF_USE_OPENMP_TASKS
+			if (omp_in_parallel()) {
+				for (int b=0; b < nBands; b++) {
+					#pragma omp task default(shared) firstprivate(b)
+					InverseBand(srcLevel, origin, destWidth, width, height, BandTop(b, nBands, height), BandTop(b + 1, nBands, height), halo + 2*b*width);
+				}
+				#pragma omp taskwait
+			} else
+#endif
+			{
+				#pragma omp parallel for default(shared) num_threads(nBands)
+				for (int b=0; b < nBands; b++) {
+					InverseBand(srcLevel, origin, destWidth, width, height, BandTop(b, nBands, height), BandTop(b + 1, nBands, height), halo + 2*b*width);
+				}
 			}
-			InverseRow(row0, width);
-			InverseRow(row1, width);
-			InverseRow(row2, width);
-			row0 = row1; row1 = row2; row2 += destWidth;
+			delete[] halo;
 		} else {
-			for (UINT32 k=0; k < width; k++) {
-				row1[k] += row0[k];
-			}
-			InverseRow(row0, width);
-			InverseRow(row1, width);
-			row0 = row1; row1 += destWidth;
+			InverseBand(srcLevel, origin, destWidth, width, height, 0, height, NULL);
 		}
 	} else {
 		// height is too small
-		row0 = origin; row1 = row0 + destWidth;
+		DataT *row0 = origin, *row1 = row0 + destWidth;
 		// first part
 		for (UINT32 k=0; k < height; k += 2) {
-			MallatToLinear(srcLevel, row0, row1, width);
+			MallatToLinear(srcLevel, k >> 1, row0, row1, width);
 			InverseRow(row0, width);
 			InverseRow(row1, width);
 			row0 += destWidth << 1; row1 += destWidth << 1;
 		}
 		// bottom
 		if (height & 1) {
-			MallatToLinear(srcLevel, row0, NULL, width);
+			MallatToLinear(srcLevel, height >> 1, row0, NULL, width);
 			InverseRow(row0, width);
 		} 
 	}
@@ -361,101 +889,210 @@ OSError CWaveletTransform::InverseTransform(int srcLevel, UINT32* w, UINT32* h,
 }
 
 //////////////////////////////////////////////////////////////////////
-// Inverse Wavelet Transform of one row
+// Copy the wavelet coefficients of all subbands of a completely forward transformed image of the same size, 
+// and quantize and dequantize them. The LL subband is only copied on the top level.
+// @param source A completely forward transformed image without quantization
+// @param quant A quantization value (linear scalar quantization)
+// @return error in case of a memory allocation problem
+OSError CWaveletTransform::CopyCoefficients(const CWaveletTransform& source, int quant) {
+	ASSERT(m_nLevels == source.m_nLevels);
+	const int top = m_nLevels - 1;
+
+	for (int level=1; level <= top; level++) {
+		for (int i=(level == top) ? LL : HL; i < NSubbands; i++) {
+			CSubband& band = m_subband[level][i];
+			const CSubband& srcBand = source.m_subband[level][i];
+			if (!band.AllocMemory()) return InsufficientMemory;
+			ASSERT(srcBand.m_data && band.m_size == srcBand.m_size);
+			memcpy(band.m_data, srcBand.m_data, band.m_size*DataTSize);
+			if (quant > 0) {
+				band.Quantize(quant);
+				band.Dequantize(quant);
+			}
+		}
+	}
+	return NoError;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Inverse transform of the rows [top, bottom) of the LL subband at level srcLevel - 1.
+// Reads the subbands of srcLevel. Several bands can be transformed in parallel.
+// @param srcLevel Source level
+// @param origin First row of the destination buffer
+// @param pitch Destination buffer width
+// @param width Number of columns to transform
+// @param height Number of rows to transform
+// @param top First row of the band (even)
+// @param bottom Row after the last row of the band (even or height)
+// @param halo Buffer of two rows or NULL if the band covers all rows
+void CWaveletTransform::InverseBand(int srcLevel, DataT* origin, UINT32 pitch, UINT32 width, UINT32 height, UINT32 top, UINT32 bottom, DataT* halo) {
+	ASSERT(!(top & 1) && top < bottom && bottom <= height);
+	ASSERT(!(bottom & 1) || bottom == height);
+	ASSERT(halo || (top == 0 && bottom == height));
+	DataT *row0, *row1, *row2, *row3;
+
+	// top border handling
+	row0 = origin + top*pitch; row1 = row0 + pitch;
+	MallatToLinear(srcLevel, top >> 1, row0, row1, width);
+	if (top == 0) {
+		for (UINT32 k=0; k < width; k++) {
+			row0[k] -= ((row1[k] + c1) >> 1);
+		}
+	} else {
+		// halo handling: odd row top - 1 is read again into the halo
+		MallatToLinear(srcLevel, (top >> 1) - 1, halo, halo + width, width);
+		row2 = halo + width;
+		for (UINT32 k=0; k < width; k++) {
+			row0[k] -= ((row2[k] + row1[k] + c2) >> 2);
+		}
+	}
+
+	// middle part
+	const UINT32 rowEnd = (bottom < height) ? bottom + 1 : height - 1;
+	for (UINT32 i=top + 2; i < rowEnd; i += 2) {
+		if (i < bottom) {
+			row2 = row1 + pitch; row3 = row2 + pitch;
+		} else {
+			// halo handling: the rows below the band are read into the halo
+			row2 = halo; row3 = halo + width;
+		}
+		MallatToLinear(srcLevel, i >> 1, row2, row3, width);
+
+		// vertical and horizontal lifting in column strips
+		for (UINT32 x=0; x < width; x += StripWidth) {
+			const UINT32 right = __min(x + StripWidth, width);
+			UINT32 k = x;
+		#ifdef __PGFSIMDLIFTING__
+			k = InverseColumnsSIMD(row0, row1, row2, row3, k, right);
+		#endif
+			for (; k < right; k++) {
+				row2[k] -= ((row1[k] + row3[k] + c2) >> 2);
+				row1[k] += ((row0[k] + row2[k] + c1) >> 1);
+			}
+			InverseRow(row0, width, x, right);
+			InverseRow(row1, width, x, right);
+		}
+		row0 = row2; row1 = row3;
+	}
+
+	if (bottom == height) {
+		// bottom border handling
+		if (height & 1) {
+			row2 = row1 + pitch;
+			MallatToLinear(srcLevel, height >> 1, row2, NULL, width);
+			for (UINT32 k=0; k < width; k++) {
+				row2[k] -= ((row1[k] + c1) >> 1);
+				row1[k] += ((row0[k] + row2[k] + c1) >> 1);
+			}
+			InverseRow(row0, width);
+			InverseRow(row1, width);
+			InverseRow(row2, width);
+		} else {
+			for (UINT32 k=0; k < width; k++) {
+				row1[k] += row0[k];
+			}
+			InverseRow(row0, width);
+			InverseRow(row1, width);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Inverse Wavelet Transform of the columns [begin, end) of one row.
+// The lifting steps at the columns left of begin must have been done before.
+// The last column end - 1 of a strip is completed by the next strip.
 // inverse high pass filter for even positions: 1/4(-1, 4, -1)
 // inverse low pass filter for odd positions: 1/8(-1, 4, 6, 4, -1)
-void CWaveletTransform::InverseRow(DataT* dest, UINT32 width) {
+// @param dest Row
+// @param width Row width
+// @param begin First column (even)
+// @param end Column after the last column (even or width)
+void CWaveletTransform::InverseRow(DataT* dest, UINT32 width, UINT32 begin, UINT32 end) {
 	if (width >= FilterWidth) {
-		UINT32 i = 2;
+		ASSERT(!(begin & 1) && begin < end && end <= width);
+		ASSERT(!(end & 1) || end == width);
+		const UINT32 last = __min(end, width - 1);
+		UINT32 i = begin;
 
-		// left border handling
-		dest[0] -= ((dest[1] + c1) >> 1);
+		if (begin == 0) {
+			// left border handling
+			dest[0] -= ((dest[1] + c1) >> 1);
+			i = 2;
+		}
 
 		// middle part
-		for (; i < width - 1; i += 2) {
+	#ifdef __PGFSIMDLIFTING__
+		i = 2*InverseRowSIMD(dest, i >> 1, (last + 1) >> 1);
+	#endif
+		for (; i < last; i += 2) {
 			dest[i] -= ((dest[i-1] + dest[i+1] + c2) >> 2);
 			dest[i-1] += ((dest[i-2] + dest[i] + c1) >> 1);
 		}
 
-		// right border handling
-		if (width & 1) {
-			dest[i] -= ((dest[i-1] + c1) >> 1);
-			dest[i-1] += ((dest[i-2] + dest[i] + c1) >> 1);
-		} else {
-			dest[i-1] += dest[i-2];
+		if (end == width) {
+			// right border handling
+			if (width & 1) {
+				dest[i] -= ((dest[i-1] + c1) >> 1);
+				dest[i-1] += ((dest[i-2] + dest[i] + c1) >> 1);
+			} else {
+				dest[i-1] += dest[i-2];
+			}
 		}
 	}
 }
 
 ///////////////////////////////////////////////////////////////////
 // Copy transformed coefficients from subbands LL,HL,LH,HH to interleaved format
-void CWaveletTransform::MallatToLinear(int srcLevel, DataT* loRow, DataT* hiRow, UINT32 width) {
+// @param srcLevel Source level
+// @param row Subband row relative to the current subband buffer positions
+// @param loRow Even row
+// @param hiRow Odd row or NULL
+// @param width Row width
+void CWaveletTransform::MallatToLinear(int srcLevel, UINT32 row, DataT* loRow, DataT* hiRow, UINT32 width) {
 	const UINT32 wquot = width >> 1;
-	const bool wrem = width & 1;
+	const UINT32 wrem = width & 1;
 	CSubband &ll = m_subband[srcLevel][LL], &hl = m_subband[srcLevel][HL];
 	CSubband &lh = m_subband[srcLevel][LH], &hh = m_subband[srcLevel][HH];
 
 	if (hiRow) {
-	#ifdef __PGFROISUPPORT__
-		const bool storePos = wquot < ll.BufferWidth();
-		UINT32 llPos = 0, hlPos = 0, lhPos = 0, hhPos = 0;
+		MallatToLinear(ll.GetBuffRow(row, wquot + wrem), hl.GetBuffRow(row, wquot), lh.GetBuffRow(row, wquot + wrem), hh.GetBuffRow(row, wquot), loRow, hiRow, width);
+	} else {
+		MallatToLinear(ll.GetBuffRow(row, wquot + wrem), hl.GetBuffRow(row, wquot), NULL, NULL, loRow, NULL, width);
+	}
+}
 
-		if (storePos) {
-			// save current src buffer positions
-			llPos = ll.GetBuffPos(); 
-			hlPos = hl.GetBuffPos(); 
-			lhPos = lh.GetBuffPos(); 
-			hhPos = hh.GetBuffPos(); 
-		}
-	#endif
+///////////////////////////////////////////////////////////////////
+// Copy transformed coefficients of one row of each subband LL,HL,LH,HH to interleaved format
+// @param llBuff Row of subband LL
+// @param hlBuff Row of subband HL
+// @param lhBuff Row of subband LH or NULL
+// @param hhBuff Row of subband HH or NULL
+// @param loRow Even row
+// @param hiRow Odd row or NULL
+// @param width Row width
+void CWaveletTransform::MallatToLinear(const DataT* llBuff, const DataT* hlBuff, const DataT* lhBuff, const DataT* hhBuff, DataT* loRow, DataT* hiRow, UINT32 width) {
+	const UINT32 wquot = width >> 1;
+	const bool wrem = width & 1;
 
+	if (hiRow) {
+		ASSERT(lhBuff && hhBuff);
 		for (UINT32 i=0; i < wquot; i++) {
-			*loRow++ = ll.ReadBuffer();// first access, than increment
-			*loRow++ = hl.ReadBuffer();// first access, than increment
-			*hiRow++ = lh.ReadBuffer();// first access, than increment
-			*hiRow++ = hh.ReadBuffer();// first access, than increment
+			*loRow++ = llBuff[i];// first access, than increment
+			*loRow++ = hlBuff[i];// first access, than increment
+			*hiRow++ = lhBuff[i];// first access, than increment
+			*hiRow++ = hhBuff[i];// first access, than increment
 		}
 
 		if (wrem) {
-			*loRow++ = ll.ReadBuffer();// first access, than increment
-			*hiRow++ = lh.ReadBuffer();// first access, than increment
+			*loRow++ = llBuff[wquot];// first access, than increment
+			*hiRow++ = lhBuff[wquot];// first access, than increment
 		}
-
-	#ifdef __PGFROISUPPORT__
-		if (storePos) {
-			// increment src buffer positions
-			ll.IncBuffRow(llPos); 
-			hl.IncBuffRow(hlPos); 
-			lh.IncBuffRow(lhPos); 
-			hh.IncBuffRow(hhPos); 
-		}
-	#endif
-
 	} else {
-	#ifdef __PGFROISUPPORT__
-		const bool storePos = wquot < ll.BufferWidth();
-		UINT32 llPos = 0, hlPos = 0;
-
-		if (storePos) {
-			// save current src buffer positions
-			llPos = ll.GetBuffPos(); 
-			hlPos = hl.GetBuffPos(); 
-		}
-	#endif
-
 		for (UINT32 i=0; i < wquot; i++) {
-			*loRow++ = ll.ReadBuffer();// first access, than increment
-			*loRow++ = hl.ReadBuffer();// first access, than increment
+			*loRow++ = llBuff[i];// first access, than increment
+			*loRow++ = hlBuff[i];// first access, than increment
 		}
-		if (wrem) *loRow++ = ll.ReadBuffer();
-
-	#ifdef __PGFROISUPPORT__
-		if (storePos) {
-			// increment src buffer positions
-			ll.IncBuffRow(llPos); 
-			hl.IncBuffRow(hlPos); 
-		}
-	#endif
+		if (wrem) *loRow++ = llBuff[wquot];
 	}
 }
 
@@ -490,6 +1127,564 @@ void CWaveletTransform::SetROI(const PGFRect& rect) {
 	}
 }
 
+//////////////////////////////////////////////////////////////////////
+// Prepare line based forward transform: the image is transformed row by row with ForwardLine.
+// Only the last 4 rows of each LL subband and only the current tile rows of the other subbands are buffered.
+// The LL subband of the top level is buffered completely.
+// @param quant A quantization value (linear scalar quantization)
+// @return error in case of a memory allocation problem
+OSError CWaveletTransform::InitLineTransform(int quant) {
+	ASSERT(m_nLevels > 1);
+	const int topLevel = m_nLevels - 1;
+	UINT32 left, top, bottom, w, h;
+
+	// all tiles are encoded
+	SetROI(PGFRect(0, 0, m_subband[0][LL].GetWidth(), m_subband[0][LL].GetHeight()));
+	m_quant = quant;
+
+	delete[] m_lines;
+	m_lines = new(std::nothrow) CLineLevel[topLevel];
+	if (!m_lines) return InsufficientMemory;
+
+	for (int level=0; level < topLevel; level++) {
+		CLineLevel& lines = m_lines[level];
+		const int destLevel = level + 1;
+		const UINT32 nTiles = GetNofTiles(destLevel);
+
+		lines.m_buffer = new(std::nothrow) DataT[4*m_subband[level][LL].GetWidth()];
+		lines.m_tileRowPos = new(std::nothrow) UINT64[nTiles];
+		lines.m_tileRowLen = new(std::nothrow) UINT32[nTiles];
+		if (!lines.m_buffer || !lines.m_tileRowPos || !lines.m_tileRowLen) return InsufficientMemory;
+
+		// a tile row is encoded as soon as its HL rows are complete; 
+		// at that time subbands LH and HH might already contain rows of the next tile row
+		for (int o=HL; o < NSubbands; o++) {
+			CSubband& band = m_subband[destLevel][o];
+			const UINT32 height = band.GetHeight();
+			UINT32 rows = 0;
+
+			for (UINT32 tileY=0; tileY < nTiles; tileY++) {
+				m_subband[destLevel][HL].TilePosition(0, tileY, left, bottom, w, h);
+				bottom += h;
+				band.TilePosition(0, tileY, left, top, w, h);
+				ASSERT(h > 0);
+				rows = __max(rows, __min(bottom, height) - top);
+			}
+			lines.m_bandRows[o] = rows;
+			band.SetROI(PGFRect(0, 0, band.GetWidth(), rows));
+			if (!band.AllocMemory()) return InsufficientMemory;
+		}
+	}
+
+	// the LL subband of the top level is encoded at once
+	if (!m_subband[topLevel][LL].AllocMemory()) return InsufficientMemory;
+
+	return NoError;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Compute forward wavelet transform of the next image row. Rows have to be passed from top to bottom.
+// Each completed tile row of a subband level is immediately encoded and written into the stream of encoder.
+// It might throw an IOException.
+// @param row Image row of subband LL at level 0
+// @param encoder An encoder instance writing encoded macro blocks without headers
+void CWaveletTransform::ForwardLine(const DataT* row, CEncoder& encoder) THROW_ {
+	ASSERT(m_lines);
+	ASSERT(row);
+	CLineLevel& lines = m_lines[0];
+	const UINT32 width = m_subband[0][LL].GetWidth();
+	ASSERT(lines.m_nRows < (UINT32)m_subband[0][LL].GetHeight());
+
+	memcpy(lines.m_buffer + (lines.m_nRows & 3)*width, row, width*DataTSize);
+	ForwardLine(0, encoder);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Forward transform of the last received row of the LL subband at given level.
+// The same lifting steps as in ForwardBand are applied, but as soon as the rows are available.
+// Completed rows of the subbands at level + 1 are stored with StoreLine.
+// It might throw an IOException.
+// @param level A wavelet transform pyramid level (>= 0 && < Levels() - 1)
+// @param encoder An encoder instance
+void CWaveletTransform::ForwardLine(int level, CEncoder& encoder) THROW_ {
+	ASSERT(level >= 0 && level < m_nLevels - 1);
+	CLineLevel& lines = m_lines[level];
+	const int destLevel = level + 1;
+	const UINT32 width = m_subband[level][LL].GetWidth();
+	const UINT32 height = m_subband[level][LL].GetHeight();
+	const UINT32 r = lines.m_nRows++;
+	DataT* row[4];	// rows r - 3, r - 2, r - 1, r in the ring buffer
+	UINT32 k;
+
+	for (int i=0; i < 4; i++) row[i] = lines.m_buffer + ((r + i + 1) & 3)*width;
+
+	ForwardRow(row[3], width);
+
+	if (height < FilterHeight) {
+		// if height is too small
+		if (r & 1) {
+			StoreLine(destLevel, r >> 1, row[2], row[3], encoder);
+		} else if (r == height - 1) {
+			StoreLine(destLevel, r >> 1, row[3], NULL, encoder);
+		}
+		return;
+	}
+
+	if (r == 2) {
+		// top border handling
+		for (k=0; k < width; k++) {
+			row[2][k] -= ((row[1][k] + row[3][k] + c1) >> 1);
+			row[1][k] += ((row[2][k] + c1) >> 1);
+		}
+		StoreLine(destLevel, 0, row[1], row[2], encoder);
+	} else if (r > 2 && !(r & 1)) {
+		// middle part
+		k = 0;
+	#ifdef __PGFSIMDLIFTING__
+		k = ForwardColumnsSIMD(row[0], row[1], row[2], row[3], k, width);
+	#endif
+		for (; k < width; k++) {
+			row[2][k] -= ((row[1][k] + row[3][k] + c1) >> 1);
+			row[1][k] += ((row[0][k] + row[2][k] + c2) >> 2);
+		}
+		StoreLine(destLevel, (r - 2) >> 1, row[1], row[2], encoder);
+	}
+
+	if (r == height - 1) {
+		// bottom border handling
+		if (height & 1) {
+			for (k=0; k < width; k++) {
+				row[3][k] += ((row[2][k] + c1) >> 1);
+			}
+			StoreLine(destLevel, r >> 1, row[3], NULL, encoder);
+		} else {
+			for (k=0; k < width; k++) {
+				row[3][k] -= row[2][k];
+				row[2][k] += ((row[1][k] + row[3][k] + c2) >> 2);
+			}
+			StoreLine(destLevel, (r - 1) >> 1, row[2], row[3], encoder);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Copy transformed rows loRow and hiRow to subbands LL,HL,LH,HH and quantize them.
+// The LL row is forwarded to the next level. A tile row is encoded as soon as it is complete.
+// It might throw an IOException.
+// @param destLevel Destination level
+// @param row Subband row
+// @param loRow Transformed even row
+// @param hiRow Transformed odd row or NULL
+// @param encoder An encoder instance
+void CWaveletTransform::StoreLine(int destLevel, UINT32 row, const DataT* loRow, const DataT* hiRow, CEncoder& encoder) THROW_ {
+	const bool topLevel = (destLevel == m_nLevels - 1);
+	const UINT32 width = m_subband[destLevel - 1][LL].GetWidth();
+	const UINT32 wquot = width >> 1;
+	const bool wrem = width & 1;
+	CSubband &ll = m_subband[destLevel][LL], &hl = m_subband[destLevel][HL];
+	CSubband &lh = m_subband[destLevel][LH], &hh = m_subband[destLevel][HH];
+	DataT *llBuff, *hlBuff = hl.GetBuffRow(row - hl.GetROI().top, hl.GetWidth());
+	UINT32 left, top, w, h;
+
+	if (topLevel) {
+		llBuff = ll.GetBuffRow(row, ll.GetWidth());
+	} else {
+		CLineLevel& next = m_lines[destLevel];
+		llBuff = next.m_buffer + (next.m_nRows & 3)*ll.GetWidth();
+	}
+
+	for (UINT32 i=0; i < wquot; i++) {
+		llBuff[i] = *loRow++;	// first access, than increment
+		hlBuff[i] = *loRow++;
+	}
+	if (wrem) llBuff[wquot] = *loRow;
+
+	if (hiRow) {
+		DataT *lhBuff = lh.GetBuffRow(row - lh.GetROI().top, lh.GetWidth());
+		DataT *hhBuff = hh.GetBuffRow(row - hh.GetROI().top, hh.GetWidth());
+
+		for (UINT32 i=0; i < wquot; i++) {
+			lhBuff[i] = *hiRow++;	// first access, than increment
+			hhBuff[i] = *hiRow++;
+		}
+		if (wrem) lhBuff[wquot] = *hiRow;
+
+		if (m_quant > 0) {
+			lh.Quantize(m_quant, UINT32(lhBuff - lh.GetBuffer()), lh.GetWidth());
+			hh.Quantize(m_quant, UINT32(hhBuff - hh.GetBuffer()), hh.GetWidth());
+		}
+	}
+	if (m_quant > 0) {
+		// subband quantization (LL subband only at top level)
+		hl.Quantize(m_quant, UINT32(hlBuff - hl.GetBuffer()), hl.GetWidth());
+		if (topLevel) ll.Quantize(m_quant, UINT32(llBuff - ll.GetBuffer()), ll.GetWidth());
+	}
+
+	// transform LL row at next level
+	if (!topLevel) ForwardLine(destLevel, encoder);
+
+	// encode tile row as soon as its HL rows are complete
+	hl.TilePosition(0, m_lines[destLevel - 1].m_tileRow, left, top, w, h);
+	if (row + 1 == top + h) WriteTileRow(destLevel, encoder);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Encode the current tile row of the subbands at given level and write it into the stream of encoder.
+// The buffered rows of the next tile row are moved to the beginning of the subband buffers.
+// It might throw an IOException.
+// @param destLevel A wavelet transform pyramid level (> 0 && < Levels())
+// @param encoder An encoder instance
+void CWaveletTransform::WriteTileRow(int destLevel, CEncoder& encoder) THROW_ {
+	CLineLevel& lines = m_lines[destLevel - 1];
+	const UINT32 nTiles = GetNofTiles(destLevel);
+	const UINT32 lastTile = nTiles - 1;
+	const UINT32 tileY = lines.m_tileRow;
+	const UINT64 pos = encoder.GetStreamPos();
+
+	if (destLevel == m_nLevels - 1) {
+		// top level also has LL band
+		ASSERT(nTiles == 1);
+		m_subband[destLevel][LL].ExtractTile(encoder, 0); // rows are already quantized in StoreLine
+		encoder.EncodeTileBuffer();
+	}
+	for (UINT32 tileX=0; tileX < nTiles; tileX++) {
+		m_subband[destLevel][HL].ExtractTile(encoder, 0, true, tileX, tileY);
+		m_subband[destLevel][LH].ExtractTile(encoder, 0, true, tileX, tileY);
+		m_subband[destLevel][HH].ExtractTile(encoder, 0, true, tileX, tileY);
+		if (tileX == lastTile) {
+			// the whole tile row has to be written into the stream, before its length is known
+			encoder.ForceWriting();
+		}
+		encoder.EncodeTileBuffer();
+	}
+	lines.m_tileRowPos[tileY] = pos;
+	lines.m_tileRowLen[tileY] = UINT32(encoder.GetStreamPos() - pos);
+	lines.m_tileRow++;
+
+	if (lines.m_tileRow < nTiles) {
+		// move already received rows of the next tile row to the beginning of the subband buffers
+		UINT32 left, top, received, w, h;
+		m_subband[destLevel][HL].TilePosition(0, lines.m_tileRow, left, received, w, h);
+
+		for (int o=HL; o < NSubbands; o++) {
+			CSubband& band = m_subband[destLevel][o];
+			const UINT32 height = band.GetHeight();
+			const UINT32 bufferWidth = band.BufferWidth();
+
+			band.TilePosition(0, lines.m_tileRow, left, top, w, h);
+			memmove(band.m_data, band.m_data + (top - band.GetROI().top)*bufferWidth, (__min(received, height) - top)*bufferWidth*DataTSize);
+			band.SetROI(PGFRect(0, top, band.GetWidth(), __min(lines.m_bandRows[o], height - top)));
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Prepare line based inverse transform: subband LL at given level is reconstructed row by row with InverseLine.
+// Only the last 4 rows of each LL subband and only the current tile rows of the other subbands are buffered.
+// The LL subband of the top level is buffered completely.
+// @param level A wavelet transform pyramid level (>= 0 && < Levels() - 1)
+// @param quant A dequantization value
+// @return error in case of a memory allocation problem
+OSError CWaveletTransform::InitInverseLineTransform(int level, int quant) {
+	ASSERT(level >= 0 && level < m_nLevels - 1);
+	const int topLevel = m_nLevels - 1;
+	UINT32 left, top, w, h;
+
+	// all tiles are decoded
+	SetROI(PGFRect(0, 0, m_subband[0][LL].GetWidth(), m_subband[0][LL].GetHeight()));
+	m_quant = quant;
+
+	delete[] m_lines;
+	m_lines = new(std::nothrow) CLineLevel[topLevel];
+	if (!m_lines) return InsufficientMemory;
+
+	for (int destLevel=level; destLevel < topLevel; destLevel++) {
+		CLineLevel& lines = m_lines[destLevel];
+		const int srcLevel = destLevel + 1;
+		const UINT32 nTiles = GetNofTiles(srcLevel);
+
+		lines.m_buffer = new(std::nothrow) DataT[4*m_subband[destLevel][LL].GetWidth()];
+		lines.m_tileRowPos = new(std::nothrow) UINT64[nTiles];
+		if (!lines.m_buffer || !lines.m_tileRowPos) return InsufficientMemory;
+
+		// a tile row is decoded as soon as the first of its subband rows is needed;
+		// at that time subband HL might still contain needed rows of the previous tile row
+		for (int o=HL; o < NSubbands; o++) {
+			CSubband& band = m_subband[srcLevel][o];
+			UINT32 rows = 0;
+
+			for (UINT32 tileY=0; tileY < nTiles; tileY++) {
+				band.TilePosition(0, tileY, left, top, w, h);
+				rows = __max(rows, top + h - TileRowTop(srcLevel, tileY));
+			}
+			lines.m_bandRows[o] = rows;
+			band.SetROI(PGFRect(0, 0, band.GetWidth(), rows));
+			if (!band.AllocMemory()) return InsufficientMemory;
+		}
+	}
+
+	// the LL subband of the top level is decoded at once
+	if (!m_subband[topLevel][LL].AllocMemory()) return InsufficientMemory;
+
+	return NoError;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Release all buffers of a line based inverse transform.
+void CWaveletTransform::FreeLineTransform() {
+	if (m_lines) {
+		for (int level=0; level < m_nLevels; level++) {
+			for (int o=0; o < NSubbands; o++) {
+				// LL subbands of lower levels might contain the result of a previous inverse transform
+				if (o != LL || level == m_nLevels - 1) m_subband[level][o].FreeMemory();
+			}
+		}
+		delete[] m_lines; m_lines = 0;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Compute inverse wavelet transform of the next row of subband LL at given level. Rows are returned from top to bottom.
+// The same lifting steps as in InverseBand are applied, but only when the next row is requested.
+// Each step transforms two more rows, hence a ring buffer of 4 rows is sufficient.
+// Tile rows of the higher levels are decoded as soon as they are needed.
+// It might throw an IOException.
+// @param level The wavelet transform pyramid level used in InitInverseLineTransform
+// @param decoder A decoder instance of the ROI encoding scheme
+// @return The next row of subband LL; it is valid until the next call of InverseLine
+const DataT* CWaveletTransform::InverseLine(int level, CDecoder& decoder) THROW_ {
+	ASSERT(m_lines);
+	ASSERT(level >= 0 && level < m_nLevels - 1);
+	CLineLevel& lines = m_lines[level];
+	const int srcLevel = level + 1;
+	const UINT32 width = m_subband[level][LL].GetWidth();
+	const UINT32 height = m_subband[level][LL].GetHeight();
+	ASSERT(lines.m_buffer);
+	ASSERT(lines.m_nRead < height);
+
+	while (lines.m_nRead == lines.m_nDone) {
+		const UINT32 i = lines.m_nRows;
+		DataT* row[4];	// rows i - 2, i - 1, i, i + 1 in the ring buffer
+		UINT32 k;
+
+		for (int j=0; j < 4; j++) row[j] = lines.m_buffer + ((i + j + 2) & 3)*width;
+
+		if (height < FilterHeight) {
+			// height is too small
+			const bool hiRow = i + 1 < height;
+			LoadLine(srcLevel, i >> 1, row[2], (hiRow) ? row[3] : NULL, decoder);
+			InverseRow(row[2], width);
+			if (hiRow) InverseRow(row[3], width);
+			lines.m_nRows = lines.m_nDone = __min(i + 2, height);
+		} else if (i == 0) {
+			// top border handling
+			LoadLine(srcLevel, 0, row[2], row[3], decoder);
+			for (k=0; k < width; k++) {
+				row[2][k] -= ((row[3][k] + c1) >> 1);
+			}
+			lines.m_nRows = 2;
+		} else if (i + 1 < height) {
+			// middle part
+			LoadLine(srcLevel, i >> 1, row[2], row[3], decoder);
+
+			// vertical and horizontal lifting in column strips
+			for (UINT32 x=0; x < width; x += StripWidth) {
+				const UINT32 right = __min(x + StripWidth, width);
+				k = x;
+			#ifdef __PGFSIMDLIFTING__
+				k = InverseColumnsSIMD(row[0], row[1], row[2], row[3], k, right);
+			#endif
+				for (; k < right; k++) {
+					row[2][k] -= ((row[1][k] + row[3][k] + c2) >> 2);
+					row[1][k] += ((row[0][k] + row[2][k] + c1) >> 1);
+				}
+				InverseRow(row[0], width, x, right);
+				InverseRow(row[1], width, x, right);
+			}
+			lines.m_nRows = i + 2;
+			lines.m_nDone = i;
+		} else if (height & 1) {
+			// bottom border handling: last row is even
+			LoadLine(srcLevel, i >> 1, row[2], NULL, decoder);
+			for (k=0; k < width; k++) {
+				row[2][k] -= ((row[1][k] + c1) >> 1);
+				row[1][k] += ((row[0][k] + row[2][k] + c1) >> 1);
+			}
+			InverseRow(row[0], width);
+			InverseRow(row[1], width);
+			InverseRow(row[2], width);
+			lines.m_nRows = lines.m_nDone = height;
+		} else {
+			// bottom border handling: last row is odd
+			for (k=0; k < width; k++) {
+				row[1][k] += row[0][k];
+			}
+			InverseRow(row[0], width);
+			InverseRow(row[1], width);
+			lines.m_nDone = height;
+		}
+	}
+	return lines.m_buffer + (lines.m_nRead++ & 3)*width;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Copy one row of each subband LL,HL,LH,HH at srcLevel to interleaved format.
+// The tile rows containing the subband rows are decoded first, if they are not yet available.
+// The LL row is taken from the inverse transform of the next level.
+// It might throw an IOException.
+// @param srcLevel Source level
+// @param row Subband row
+// @param loRow Even row
+// @param hiRow Odd row or NULL
+// @param decoder A decoder instance
+void CWaveletTransform::LoadLine(int srcLevel, UINT32 row, DataT* loRow, DataT* hiRow, CDecoder& decoder) THROW_ {
+	CLineLevel& lines = m_lines[srcLevel - 1];
+	const UINT32 nTiles = GetNofTiles(srcLevel);
+	const DataT* lhBuff = NULL;
+	const DataT* hhBuff = NULL;
+	const DataT* llBuff;
+
+	while (lines.m_tileRow < nTiles && row >= TileRowTop(srcLevel, lines.m_tileRow)) {
+		ReadTileRow(srcLevel, row, decoder);
+	}
+
+	if (srcLevel == m_nLevels - 1) {
+		CSubband& ll = m_subband[srcLevel][LL];
+		llBuff = ll.m_data + row*ll.BufferWidth();
+	} else {
+		llBuff = InverseLine(srcLevel, decoder);
+	}
+
+	CSubband &hl = m_subband[srcLevel][HL], &lh = m_subband[srcLevel][LH], &hh = m_subband[srcLevel][HH];
+	const DataT* hlBuff = hl.m_data + (row - hl.GetROI().top)*hl.BufferWidth();
+	if (hiRow) {
+		lhBuff = lh.m_data + (row - lh.GetROI().top)*lh.BufferWidth();
+		hhBuff = hh.m_data + (row - hh.GetROI().top)*hh.BufferWidth();
+	}
+	MallatToLinear(llBuff, hlBuff, lhBuff, hhBuff, loRow, hiRow, m_subband[srcLevel - 1][LL].GetWidth());
+}
+
+//////////////////////////////////////////////////////////////////////
+// Decode the next tile row of the subbands at given level.
+// The buffered rows, which are still needed, are moved to the beginning of the subband buffers.
+// It might throw an IOException.
+// @param srcLevel A wavelet transform pyramid level (> 0 && < Levels())
+// @param row The first subband row, which is still needed
+// @param decoder A decoder instance
+void CWaveletTransform::ReadTileRow(int srcLevel, UINT32 row, CDecoder& decoder) THROW_ {
+	CLineLevel& lines = m_lines[srcLevel - 1];
+	const UINT32 nTiles = GetNofTiles(srcLevel);
+	const UINT32 tileY = lines.m_tileRow++;
+	UINT32 left, top, w, h;
+
+	// move still needed rows of the previous tile row to the beginning of the subband buffers
+	for (int o=HL; o < NSubbands; o++) {
+		CSubband& band = m_subband[srcLevel][o];
+		const PGFRect& roi = band.GetROI();
+		const UINT32 bufferWidth = band.BufferWidth();
+
+		band.TilePosition(0, tileY, left, top, w, h);
+		const UINT32 first = __min(row, top);
+		ASSERT(first >= roi.top && top <= roi.bottom);
+		if (first > roi.top) {
+			memmove(band.m_data, band.m_data + (first - roi.top)*bufferWidth, (top - first)*bufferWidth*DataTSize);
+		}
+		band.SetROI(PGFRect(0, first, band.GetWidth(), __min(lines.m_bandRows[o], band.GetHeight() - first)));
+	}
+
+	// decode tile row
+	decoder.SetStreamPos(lines.m_tileRowPos[tileY]);
+	if (srcLevel == m_nLevels - 1) {
+		// top level also has LL band
+		ASSERT(nTiles == 1);
+		decoder.DecodeTileBuffer();
+		m_subband[srcLevel][LL].PlaceTile(decoder, m_quant);
+	}
+	for (UINT32 tileX=0; tileX < nTiles; tileX++) {
+		decoder.DecodeTileBuffer();
+		m_subband[srcLevel][HL].PlaceTile(decoder, m_quant, true, tileX, tileY);
+		m_subband[srcLevel][LH].PlaceTile(decoder, m_quant, true, tileX, tileY);
+		m_subband[srcLevel][HH].PlaceTile(decoder, m_quant, true, tileX, tileY);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return the first subband row of a tile row at given level.
+// @param srcLevel A wavelet transform pyramid level (> 0 && < Levels())
+// @param tileY Tile index in y-direction
+// @return Smallest top position of the tiles of subbands HL, LH, and HH
+UINT32 CWaveletTransform::TileRowTop(int srcLevel, UINT32 tileY) const {
+	UINT32 left, top, w, h, result = 0;
+
+	for (int o=HL; o < NSubbands; o++) {
+		m_subband[srcLevel][o].TilePosition(0, tileY, left, top, w, h);
+		if (o == HL || top < result) result = top;
+	}
+	return result;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Copy a cached tile into its subband. The subband has to use the current ROI, which must contain the tile.
+// @param level A wavelet transform pyramid level (> 0 && < Levels())
+// @param orientation A quarter of the subband (LL, LH, HL, HH)
+// @param tileX Tile index in x-direction
+// @param tileY Tile index in y-direction
+// @return true if the tile has been cached and placed in the subband
+bool CWaveletTransform::LoadTile(int level, Orientation orientation, UINT32 tileX, UINT32 tileY) {
+	ASSERT(level > 0 && level < m_nLevels);
+	CTileCache::CTile* tile = m_tileCache.Find(level, orientation, tileX, tileY);
+	if (!tile) return false;
+
+	CSubband& band = m_subband[level][orientation];
+	if (!band.AllocMemory()) return false;
+
+	UINT32 xPos, yPos, w, h;
+	band.TilePosition(tileX, tileY, xPos, yPos, w, h);
+	ASSERT(w*h == tile->m_size);
+	ASSERT(xPos >= band.GetROI().left && xPos + w <= band.GetROI().right);
+	ASSERT(yPos >= band.GetROI().top && yPos + h <= band.GetROI().bottom);
+
+	const UINT32 pitch = band.BufferWidth();
+	DataT* dst = band.GetBuffer() + (xPos - band.GetROI().left) + (yPos - band.GetROI().top)*pitch;
+	const DataT* src = tile->m_data;
+
+	for (UINT32 y=0; y < h; y++) {
+		memcpy(dst, src, w*DataTSize);
+		dst += pitch;
+		src += w;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Store a decoded tile of a subband in the tile cache. Nothing happens if the tile exceeds the memory budget.
+// @param level A wavelet transform pyramid level (> 0 && < Levels())
+// @param orientation A quarter of the subband (LL, LH, HL, HH)
+// @param tileX Tile index in x-direction
+// @param tileY Tile index in y-direction
+void CWaveletTransform::StoreTile(int level, Orientation orientation, UINT32 tileX, UINT32 tileY) {
+	ASSERT(level > 0 && level < m_nLevels);
+	if (!m_tileCache.m_budget) return;
+
+	const CSubband& band = m_subband[level][orientation];
+	ASSERT(band.m_data);
+
+	UINT32 xPos, yPos, w, h;
+	band.TilePosition(tileX, tileY, xPos, yPos, w, h);
+	CTileCache::CTile* tile = m_tileCache.Insert(level, orientation, tileX, tileY, w*h);
+	if (!tile) return;
+
+	const UINT32 pitch = band.BufferWidth();
+	const DataT* src = band.m_data + (xPos - band.GetROI().left) + (yPos - band.GetROI().top)*pitch;
+	DataT* dst = tile->m_data;
+
+	for (UINT32 y=0; y < h; y++) {
+		memcpy(dst, src, w*DataTSize);
+		dst += w;
+		src += pitch;
+	}
+}
+
 /////////////////////////////////////////////////////////////////////
 
 /////////////////////////////////////////////////////////////////////
@@ -556,4 +1751,144 @@ void CRoiIndices::ComputeIndices(UINT32 width, UINT32 height, const PGFRect& rec
 	ComputeTileIndex(width, height, rect.bottom, false, false);
 }
 
+/////////////////////////////////////////////////////////////////////
+/// Set the memory budget and remove least recently used tiles until the budget is kept.
+/// @param budget Memory budget in bytes (0: no tiles are cached)
+void CTileCache::SetBudget(UINT64 budget) {
+	m_budget = budget;
+	while (m_last && m_size > m_budget) Remove(m_last);
+}
+
+/////////////////////////////////////////////////////////////////////
+/// Remove all cached tiles.
+void CTileCache::Clear() {
+	while (m_last) Remove(m_last);
+	ASSERT(m_nTiles == 0 && m_size == 0);
+}
+
+/////////////////////////////////////////////////////////////////////
+/// Find a cached tile and mark it as most recently used.
+/// @param level Subband level
+/// @param orientation Subband orientation
+/// @param tileX Tile index in x-direction
+/// @param tileY Tile index in y-direction
+/// @return The cached tile or NULL
+CTileCache::CTile* CTileCache::Find(int level, Orientation orientation, UINT32 tileX, UINT32 tileY) {
+	if (!m_nTiles) return NULL;
+
+	CTile* tile = m_buckets[Bucket(level, orientation, tileX, tileY)];
+	while (tile && (tile->m_level != level || tile->m_orientation != orientation || tile->m_tileX != tileX || tile->m_tileY != tileY)) {
+		tile = tile->m_nextInBucket;
+	}
+	if (tile && tile != m_first) {
+		Unlink(tile);
+		PushFront(tile);
+	}
+	return tile;
+}
+
+/////////////////////////////////////////////////////////////////////
+/// Insert a new tile as most recently used tile. Least recently used tiles are removed to keep the memory budget.
+/// An already cached tile with the same key is replaced.
+/// @param level Subband level
+/// @param orientation Subband orientation
+/// @param tileX Tile index in x-direction
+/// @param tileY Tile index in y-direction
+/// @param size Number of coefficients of the tile
+/// @return The new tile with uninitialized coefficients or NULL, if the tile cannot be cached
+CTileCache::CTile* CTileCache::Insert(int level, Orientation orientation, UINT32 tileX, UINT32 tileY, UINT32 size) {
+	const UINT64 bytes = UINT64(size)*DataTSize;
+	if (bytes > m_budget) return NULL;
+
+	CTile* tile = Find(level, orientation, tileX, tileY);
+	if (tile) Remove(tile);
+	while (m_last && m_size + bytes > m_budget) Remove(m_last);
+
+	if (m_nTiles >= m_nBuckets && !Rehash(__max(64U, 2*m_nBuckets))) return NULL;
+
+	tile = new(std::nothrow) CTile;
+	if (!tile) return NULL;
+	tile->m_data = new(std::nothrow) DataT[size];
+	if (!tile->m_data) {
+		delete tile;
+		return NULL;
+	}
+	tile->m_size = size;
+	tile->m_level = level;
+	tile->m_orientation = orientation;
+	tile->m_tileX = tileX;
+	tile->m_tileY = tileY;
+
+	CTile*& bucket = m_buckets[Bucket(level, orientation, tileX, tileY)];
+	tile->m_nextInBucket = bucket;
+	bucket = tile;
+	PushFront(tile);
+	m_nTiles++;
+	m_size += bytes;
+	return tile;
+}
+
+/////////////////////////////////////////////////////////////////////
+/// Remove a cached tile and release its memory.
+/// @param tile A cached tile
+void CTileCache::Remove(CTile* tile) {
+	ASSERT(tile);
+	CTile** p = &m_buckets[Bucket(tile->m_level, tile->m_orientation, tile->m_tileX, tile->m_tileY)];
+	while (*p != tile) {
+		ASSERT(*p);
+		p = &(*p)->m_nextInBucket;
+	}
+	*p = tile->m_nextInBucket;
+	Unlink(tile);
+
+	ASSERT(m_nTiles > 0 && m_size >= UINT64(tile->m_size)*DataTSize);
+	m_nTiles--;
+	m_size -= UINT64(tile->m_size)*DataTSize;
+	delete[] tile->m_data;
+	delete tile;
+}
+
+/////////////////////////////////////////////////////////////////////
+/// Remove a tile from the list of recently used tiles.
+/// @param tile A cached tile
+void CTileCache::Unlink(CTile* tile) {
+	if (tile->m_prev) tile->m_prev->m_next = tile->m_next;
+	else m_first = tile->m_next;
+	if (tile->m_next) tile->m_next->m_prev = tile->m_prev;
+	else m_last = tile->m_prev;
+}
+
+/////////////////////////////////////////////////////////////////////
+/// Insert a tile at the beginning of the list of recently used tiles.
+/// @param tile A cached tile
+void CTileCache::PushFront(CTile* tile) {
+	tile->m_prev = NULL;
+	tile->m_next = m_first;
+	if (m_first) m_first->m_prev = tile;
+	else m_last = tile;
+	m_first = tile;
+}
+
+/////////////////////////////////////////////////////////////////////
+/// Resize the hash table.
+/// @param nBuckets New number of buckets (power of two)
+/// @return false in case of a memory allocation problem
+bool CTileCache::Rehash(UINT32 nBuckets) {
+	ASSERT(nBuckets > 0 && (nBuckets & (nBuckets - 1)) == 0);
+	CTile** buckets = new(std::nothrow) CTile*[nBuckets];
+	if (!buckets) return false;
+	memset(buckets, 0, nBuckets*sizeof(CTile*));
+
+	delete[] m_buckets;
+	m_buckets = buckets;
+	m_nBuckets = nBuckets;
+
+	for (CTile* tile = m_first; tile; tile = tile->m_next) {
+		CTile*& bucket = m_buckets[Bucket(tile->m_level, tile->m_orientation, tile->m_tileX, tile->m_tileY)];
+		tile->m_nextInBucket = bucket;
+		bucket = tile;
+	}
+	return true;
+}
+
 #endif // __PGFROISUPPORT__
@@ -32,10 +32,16 @@
 #include "PGFtypes.h"
 #include "Subband.h"
 
+class CEncoder;
+class CDecoder;
+
 //////////////////////////////////////////////////////////////////////
 // Constants
 #define FilterWidth			5					///< number of coefficients of the row wavelet filter
 #define FilterHeight		3					///< number of coefficients of the column wavelet filter
+#define StripWidth			2048				///< number of columns lifted together (rows of a strip fit in the L1/L2 cache)
+#define MinBandHeight		16					///< minimum number of rows transformed by one thread
+#define MinBandSize			(1 << 16)			///< minimum number of coefficients transformed by one thread
 
 #ifdef __PGFROISUPPORT__
 //////////////////////////////////////////////////////////////////////
@@ -74,6 +80,102 @@ private:
 	PGFRect *m_indices;			///< array of tile indices (index is level)
 
 };
+
+//////////////////////////////////////////////////////////////////////
+/// PGF line based forward and inverse transform support. This is a helper class for CWaveletTransform.
+/// It contains the few rows of a LL subband, which are needed to lift the next rows,
+/// and the stream positions of the encoded tile rows of the next level.
+/// @author C. Stamm
+/// @brief Line transform state of one level
+class CLineLevel {
+	friend class CWaveletTransform;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Constructor: Creates an empty line transform state
+	CLineLevel()
+	: m_buffer(0)
+	, m_nRows(0)
+	, m_nDone(0)
+	, m_nRead(0)
+	, m_tileRow(0)
+	, m_tileRowPos(0)
+	, m_tileRowLen(0)
+	{ for (int i=0; i < NSubbands; i++) m_bandRows[i] = 0; }
+
+	//////////////////////////////////////////////////////////////////////
+	/// Destructor
+	~CLineLevel() { delete[] m_buffer; delete[] m_tileRowPos; delete[] m_tileRowLen; }
+
+	DataT*	m_buffer;					///< ring buffer of the last 4 rows of the LL subband
+	UINT32	m_nRows;					///< number of rows of the LL subband received so far
+	UINT32	m_nDone;					///< number of completely inverse transformed rows of the LL subband
+	UINT32	m_nRead;					///< number of rows of the LL subband returned by the inverse transform
+	UINT32	m_tileRow;					///< next tile row to be encoded or decoded in the next level
+	UINT32	m_bandRows[NSubbands];		///< number of buffered rows of each subband of the next level
+	UINT64*	m_tileRowPos;				///< stream positions of the encoded tile rows of the next level
+	UINT32*	m_tileRowLen;				///< lengths of the encoded tile rows of the next level (only used in forward transform)
+};
+
+//////////////////////////////////////////////////////////////////////
+/// PGF tile cache. This is a helper class for CWaveletTransform.
+/// It keeps copies of decoded and dequantized subband tiles, hence a following read of an overlapping ROI 
+/// only decodes the newly exposed tiles. The least recently used tiles are removed when the memory budget is exceeded.
+/// @author C. Stamm
+/// @brief Cache of decoded subband tiles
+class CTileCache {
+	friend class CWaveletTransform;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Cached tile of a subband
+	struct CTile {
+		DataT*		m_data;				///< coefficients of the tile, row by row without padding
+		UINT32		m_size;				///< number of coefficients
+		int			m_level;			///< subband level
+		Orientation	m_orientation;		///< subband orientation
+		UINT32		m_tileX;			///< tile index in x-direction
+		UINT32		m_tileY;			///< tile index in y-direction
+		CTile*		m_nextInBucket;		///< next tile of the same hash bucket
+		CTile*		m_prev;				///< next more recently used tile
+		CTile*		m_next;				///< next less recently used tile
+	};
+
+	//////////////////////////////////////////////////////////////////////
+	/// Constructor: Creates an empty tile cache without memory budget
+	CTileCache()
+	: m_buckets(0)
+	, m_nBuckets(0)
+	, m_nTiles(0)
+	, m_first(0)
+	, m_last(0)
+	, m_size(0)
+	, m_budget(0)
+	{}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Destructor
+	~CTileCache() { Clear(); delete[] m_buckets; }
+
+	void SetBudget(UINT64 budget);
+	void Clear();
+	CTile* Find(int level, Orientation orientation, UINT32 tileX, UINT32 tileY);
+	CTile* Insert(int level, Orientation orientation, UINT32 tileX, UINT32 tileY, UINT32 size);
+	void Remove(CTile* tile);
+	void Unlink(CTile* tile);
+	void PushFront(CTile* tile);
+	bool Rehash(UINT32 nBuckets);
+	UINT32 Bucket(int level, Orientation orientation, UINT32 tileX, UINT32 tileY) const {
+		ASSERT(m_nBuckets > 0);
+		return ((((tileY*2654435761U) ^ tileX)*40503U + level*NSubbands + orientation)*2654435761U) & (m_nBuckets - 1);
+	}
+
+	CTile**	m_buckets;					///< hash table of the cached tiles
+	UINT32	m_nBuckets;					///< number of hash buckets (power of two)
+	UINT32	m_nTiles;					///< number of cached tiles
+	CTile*	m_first;					///< most recently used tile
+	CTile*	m_last;						///< least recently used tile
+	UINT64	m_size;						///< memory used by the cached coefficients in bytes
+	UINT64	m_budget;					///< memory budget in bytes (0: no caching)
+};
 #endif //__PGFROISUPPORT__
 
 
@@ -102,8 +204,9 @@ public:
 	/// stores result on all 4 subbands of level + 1.
 	/// @param level A wavelet transform pyramid level (>= 0 && < Levels())
 	/// @param quant A quantization value (linear scalar quantization)
+	/// @param maxThreads Maximum number of threads used to transform the level
 	/// @return error in case of a memory allocation problem
-	OSError ForwardTransform(int level, int quant);
+	OSError ForwardTransform(int level, int quant, int maxThreads);
 
 	//////////////////////////////////////////////////////////////////////
 	/// Compute fast inverse wavelet transform of all 4 subbands of given level and
@@ -112,8 +215,17 @@ public:
 	/// @param width A pointer to the returned width of subband LL (in pixels)
 	/// @param height A pointer to the returned height of subband LL (in pixels)
 	/// @param data A pointer to the returned array of image data
+	/// @param maxThreads Maximum number of threads used to transform the level
+	/// @return error in case of a memory allocation problem
+	OSError InverseTransform(int level, UINT32* width, UINT32* height, DataT** data, int maxThreads);
+
+	//////////////////////////////////////////////////////////////////////
+	/// Copy the wavelet coefficients of all subbands of a completely forward transformed image of the same size, 
+	/// and quantize and dequantize them, e.g., for measuring the quantization error with the inverse transform.
+	/// @param source A completely forward transformed image without quantization
+	/// @param quant A quantization value (linear scalar quantization)
 	/// @return error in case of a memory allocation problem
-	OSError InverseTransform(int level, UINT32* width, UINT32* height, DataT** data);
+	OSError CopyCoefficients(const CWaveletTransform& source, int quant);
 
 	//////////////////////////////////////////////////////////////////////
 	/// Get pointer to one of the 4 subband at a given level.
@@ -145,6 +257,91 @@ public:
 	/// @param level A valid subband level.
 	const PGFRect& GetROI(int level) const				{ return m_subband[level][LL].GetROI(); }
 
+	//////////////////////////////////////////////////////////////////////
+	/// Prepare line based forward transform: the image is transformed row by row with ForwardLine.
+	/// Only a few rows of each LL subband and only the current tile rows of the other subbands are buffered.
+	/// The ROI encoding scheme is used.
+	/// @param quant A quantization value (linear scalar quantization)
+	/// @return error in case of a memory allocation problem
+	OSError InitLineTransform(int quant);
+
+	//////////////////////////////////////////////////////////////////////
+	/// Compute forward wavelet transform of the next image row. Rows have to be passed from top to bottom.
+	/// Each completed tile row of a subband level is immediately encoded and written into the stream of encoder.
+	/// It might throw an IOException.
+	/// @param row Image row of subband LL at level 0
+	/// @param encoder An encoder instance writing encoded macro blocks without headers
+	void ForwardLine(const DataT* row, CEncoder& encoder) THROW_;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Get stream position and length of an encoded tile row.
+	/// @param level A wavelet transform pyramid level (> 0 && < Levels())
+	/// @param tileY Tile index in y-direction
+	/// @param pos [out] Stream position of the encoded tile row
+	/// @param len [out] Length of the encoded tile row in bytes
+	void GetEncodedTileRow(int level, UINT32 tileY, UINT64& pos, UINT32& len) const {
+		ASSERT(m_lines); ASSERT(level > 0 && level < m_nLevels); ASSERT(tileY < m_lines[level - 1].m_tileRow);
+		pos = m_lines[level - 1].m_tileRowPos[tileY]; len = m_lines[level - 1].m_tileRowLen[tileY];
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Prepare line based inverse transform: subband LL at given level is reconstructed row by row with InverseLine.
+	/// Only a few rows of each LL subband and only the current tile rows of the other subbands are buffered.
+	/// The stream positions of all tile rows have to be set with SetTileRowPos before the first call of InverseLine.
+	/// @param level A wavelet transform pyramid level (>= 0 && < Levels() - 1)
+	/// @param quant A dequantization value
+	/// @return error in case of a memory allocation problem
+	OSError InitInverseLineTransform(int level, int quant);
+
+	//////////////////////////////////////////////////////////////////////
+	/// Set stream position of an encoded tile row.
+	/// @param level A wavelet transform pyramid level (> 0 && < Levels())
+	/// @param tileY Tile index in y-direction
+	/// @param pos Stream position of the first block of the tile row (at top level: of subband LL)
+	void SetTileRowPos(int level, UINT32 tileY, UINT64 pos) {
+		ASSERT(m_lines); ASSERT(level > 0 && level < m_nLevels); ASSERT(tileY < GetNofTiles(level));
+		m_lines[level - 1].m_tileRowPos[tileY] = pos;
+	}
+
+	//////////////////////////////////////////////////////////////////////
+	/// Compute inverse wavelet transform of the next row of subband LL at given level. Rows are returned from top to bottom.
+	/// Tile rows of the higher levels are decoded as soon as they are needed.
+	/// It might throw an IOException.
+	/// @param level The wavelet transform pyramid level used in InitInverseLineTransform
+	/// @param decoder A decoder instance of the ROI encoding scheme
+	/// @return The next row of subband LL; it is valid until the next call of InverseLine
+	const DataT* InverseLine(int level, CDecoder& decoder) THROW_;
+
+	//////////////////////////////////////////////////////////////////////
+	/// Release all buffers of a line based inverse transform.
+	void FreeLineTransform();
+
+	//////////////////////////////////////////////////////////////////////
+	/// Set the memory budget of the tile cache. Least recently used tiles are removed until the budget is kept.
+	/// @param budget Memory budget in bytes (0: no tiles are cached)
+	void SetTileCacheSize(UINT64 budget)				{ m_tileCache.SetBudget(budget); }
+
+	//////////////////////////////////////////////////////////////////////
+	/// Remove all tiles from the tile cache, e.g., if the cached coefficients are no longer valid.
+	void ClearTileCache()								{ m_tileCache.Clear(); }
+
+	//////////////////////////////////////////////////////////////////////
+	/// Copy a cached tile into its subband. The subband has to use the current ROI, which must contain the tile.
+	/// @param level A wavelet transform pyramid level (> 0 && < Levels())
+	/// @param orientation A quarter of the subband (LL, LH, HL, HH)
+	/// @param tileX Tile index in x-direction
+	/// @param tileY Tile index in y-direction
+	/// @return true if the tile has been cached and placed in the subband
+	bool LoadTile(int level, Orientation orientation, UINT32 tileX, UINT32 tileY);
+
+	//////////////////////////////////////////////////////////////////////
+	/// Store a decoded tile of a subband in the tile cache. Nothing happens if the tile exceeds the memory budget.
+	/// @param level A wavelet transform pyramid level (> 0 && < Levels())
+	/// @param orientation A quarter of the subband (LL, LH, HL, HH)
+	/// @param tileX Tile index in x-direction
+	/// @param tileY Tile index in y-direction
+	void StoreTile(int level, Orientation orientation, UINT32 tileX, UINT32 tileY);
+
 #endif // __PGFROISUPPORT__
 
 private:
@@ -152,20 +349,40 @@ private:
 		delete[] m_subband; m_subband = 0; 
 	#ifdef __PGFROISUPPORT__
 		m_ROIindices.Destroy(); 
+		delete[] m_lines; m_lines = 0;
 	#endif
 	}
 	void InitSubbands(UINT32 width, UINT32 height, DataT* data);
-	void ForwardRow(DataT* buff, UINT32 width);
-	void InverseRow(DataT* buff, UINT32 width);
-	void LinearToMallat(int destLevel,DataT* loRow, DataT* hiRow, UINT32 width);
-	void MallatToLinear(int srcLevel, DataT* loRow, DataT* hiRow, UINT32 width);
+	void ForwardRow(DataT* buff, UINT32 width)			{ ForwardRow(buff, width, 0, width); }
+	void ForwardRow(DataT* buff, UINT32 width, UINT32 begin, UINT32 end);
+	void InverseRow(DataT* buff, UINT32 width)			{ InverseRow(buff, width, 0, width); }
+	void InverseRow(DataT* buff, UINT32 width, UINT32 begin, UINT32 end);
+	void ForwardBand(int destLevel, DataT* src, UINT32 width, UINT32 height, UINT32 top, UINT32 bottom, DataT* above, DataT* below);
+	void InverseBand(int srcLevel, DataT* origin, UINT32 pitch, UINT32 width, UINT32 height, UINT32 top, UINT32 bottom, DataT* halo);
+	void LinearToMallat(int destLevel, UINT32 row, DataT* loRow, DataT* hiRow, UINT32 begin, UINT32 end);
+	void MallatToLinear(int srcLevel, UINT32 row, DataT* loRow, DataT* hiRow, UINT32 width);
+	void MallatToLinear(const DataT* llBuff, const DataT* hlBuff, const DataT* lhBuff, const DataT* hhBuff, DataT* loRow, DataT* hiRow, UINT32 width);
+#ifdef __PGFROISUPPORT__
+	void ForwardLine(int level, CEncoder& encoder) THROW_;
+	void StoreLine(int destLevel, UINT32 row, const DataT* loRow, const DataT* hiRow, CEncoder& encoder) THROW_;
+	void WriteTileRow(int destLevel, CEncoder& encoder) THROW_;
+	void LoadLine(int srcLevel, UINT32 row, DataT* loRow, DataT* hiRow, CDecoder& decoder) THROW_;
+	void ReadTileRow(int srcLevel, UINT32 row, CDecoder& decoder) THROW_;
+	UINT32 TileRowTop(int srcLevel, UINT32 tileY) const;
+#endif //__PGFROISUPPORT__
 
 #ifdef __PGFROISUPPORT__
 	CRoiIndices		m_ROIindices;				///< ROI indices 
+	CTileCache		m_tileCache;				///< decoded tiles of previous ROI reads
 #endif //__PGFROISUPPORT__
 
 	int			m_nLevels;						///< number of transform levels: one more than the number of level in PGFimage
 	CSubband	(*m_subband)[NSubbands];		///< quadtree of subbands: LL HL LH HH
+
+#ifdef __PGFROISUPPORT__
+	CLineLevel*	m_lines;						///< line transform state of each level (only used in line based forward transform)
+	int			m_quant;						///< quantization value of line based forward or inverse transform
+#endif //__PGFROISUPPORT__
 };
 
 #endif //PGF_WAVELETTRANSFORM_H